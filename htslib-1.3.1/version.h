@@ -0,0 +1 @@
+#define HTS_VERSION "1.3.1"
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include "utils.h"
 #include "bed_utils.h"
+#include "trace.h"
 #include "htslib/hts.h"
 #include "htslib/khash.h"
 #include "htslib/ksort.h"
@@ -65,6 +66,8 @@ struct bedaux *bedaux_init()
     bed->length_ori = 0;
     bed->length = 0;
     bed->line = 0;
+    bed->m_splits = 0;
+    bed->splits = NULL;
     bed->fname = NULL;
     bed->block_size = mempool_max_lines;
     return bed;
@@ -100,7 +103,7 @@ void bed_destroy(struct bedaux *file)
 	}
     }
     kh_destroy(reg, hash);
-    
+    free(file->splits);
     free(file);    
 }
 int get_name_id(struct bedaux *bed, const char *name)
@@ -131,11 +134,11 @@ struct bed_chrom *get_chrom(struct bedaux *bed, const char *name)
 // 2 for malformed line
 static int prase_string(struct bedaux *bed, kstring_t *string, struct bed_line *line)
 {
-    int nfields = 0;
-    int *splits = ksplit(string, 0, &nfields);
-    if ( splits == NULL ) return 1;
+    int nfields = ksplit_core(string->s, 0, &bed->m_splits, &bed->splits);
+    int *splits = bed->splits;
+    if ( nfields == 0 ) return 1;
     if ( nfields < 2)
-	goto malformed_line;
+	return 2;
     reghash_type * hash = (reghash_type*)bed->hash;
     khiter_t k;
     k = kh_get(reg, hash, string->s);
@@ -170,12 +173,7 @@ static int prase_string(struct bedaux *bed, kstring_t *string, struct bed_line *
 	kh_val(hash, k) = chrom;
     }
     line->chrom_id = id;
-    free(splits);
     return 0;
-
-  malformed_line:
-    free(splits);
-    return 2;
 }
 
 static int bed_fill(struct bedaux *bed)
@@ -444,6 +442,41 @@ int bed_sort(struct bedaux *bed)
     bed->flag |= bed_bit_sorted;
     return 0;
 }
+void bed_reorder(struct bedaux *bed, const char **names, int n)
+{
+    if ( bed->l_names == 0 )
+	return;
+    reghash_type *hash = (reghash_type*)bed->hash;
+    char **order = (char**)malloc(bed->l_names * sizeof(char*));
+    khint_t k;
+    int i, l = 0;
+    for ( i = 0; i < bed->l_names; ++i ) {
+	k = kh_get(reg, hash, bed->names[i]);
+	if ( k != kh_end(hash) )
+	    kh_val(hash, k)->id = -1;
+    }
+    for ( i = 0; i < n; ++i ) {
+	k = kh_get(reg, hash, names[i]);
+	if ( k == kh_end(hash) || kh_val(hash, k)->id != -1 )
+	    continue;
+	kh_val(hash, k)->id = l;
+	order[l++] = (char*)kh_key(hash, k);
+    }
+    for ( i = 0; i < bed->l_names; ++i ) {
+	k = kh_get(reg, hash, bed->names[i]);
+	if ( k == kh_end(hash) ) {
+	    order[l++] = bed->names[i];
+	    continue;
+	}
+	if ( kh_val(hash, k)->id != -1 )
+	    continue;
+	kh_val(hash, k)->id = l;
+	order[l++] = bed->names[i];
+    }
+    memcpy(bed->names, order, l * sizeof(char*));
+    free(order);
+    bed->i = 0;
+}
 int bed_merge(struct bedaux *bed)
 {
     if ( bed->flag & bed_bit_merged)
@@ -537,6 +570,8 @@ static void copy_line(struct bed_line *dest, struct bed_line *line)
 }
 // bed_find_rough_bigfile() is a function to retrieve most nearest or covered regions in the tbx databases for target regions
 // for probe design programs, gap_size is usually slightly smaller than the fragement size.
+static const struct trace_kind trace_db_query = { "db_query", "database", "chrom", { "start", "end", "regions" } };
+
 struct bedaux *bed_find_rough_bigfile(struct bedaux *target, htsFile *fp, tbx_t *data, int gap_size, int region_limit)
 {
     bed_merge(target);
@@ -546,6 +581,7 @@ struct bedaux *bed_find_rough_bigfile(struct bedaux *target, htsFile *fp, tbx_t
     struct bedaux *design = bedaux_init();
     design->flag &= ~bed_bit_empty;
     while ( bed_getline(target, &line) == 0 ) {
+        TRACE_BEGIN(t);
 	// retrieve target in dataset
 	int tid = tbx_name2id(data, target->names[line.chrom_id]);
 	if (tid == -1) {
@@ -596,6 +632,7 @@ struct bedaux *bed_find_rough_bigfile(struct bedaux *target, htsFile *fp, tbx_t
 	    }
 	    string.l = 0;
 	}
+        TRACE_SPAN(&trace_db_query, t, target->names[line.chrom_id], line.start, line.end, n_regions);
     }
     bed_merge(design);
     return design;
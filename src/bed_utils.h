@@ -65,6 +65,9 @@ struct bedaux {
     BGZF *fp; 
     //kstream_t *ks;
     uint32_t line;
+    // field offsets of current line, reused by each line
+    int m_splits;
+    int *splits;
     // used by bed_fill_bigdata(), if regions are greater than block size, merge cached regions and increase block_size, 
     uint32_t block_size;
     void *hash;
@@ -94,6 +97,9 @@ extern int bed_getline(struct bedaux *bed, struct bed_line *line);
 extern int bed_read(struct bedaux *bed, const char *fname);
 // sort
 extern int bed_sort(struct bedaux *bed);
+// reorder chromosomes in the order of names (like contigs of reference), chromosomes not in names are kept at the end.
+// chromosome ids are renumbered in the new order
+extern void bed_reorder(struct bedaux *bed, const char **names, int n);
 // merge
 extern int bed_merge(struct bedaux *bed);
 extern struct bedaux *bed_merge_several_files(struct bedaux **beds, int n);
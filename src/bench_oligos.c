@@ -0,0 +1,384 @@
+// bench_oligos.c - benchmark generate_oligos and merge_oligos on a synthesized corpus.
+//
+// The corpus is made by synth_corpus, the exome, hotspot and whole-genome panels are designed by generate_oligos, and
+// the three probe files are merged by merge_oligos. Every stage runs as a child process, the wall time is taken around
+// it, the CPU time and peak RSS come from wait4(), and the oligos and bytes are counted from the output afterwards.
+// Output of each stage is kept in stage.log of the working directory, and the stage timers of generate_oligos
+// (-stats) in stage.json, which are reported as the breakdown of each design.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "htslib/kstring.h"
+#include "htslib/bgzf.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+#define MAX_ARGS 256
+
+// stages of generate_oligos -stats
+#define N_DESIGN_STAGES 9
+static const char *design_stages[N_DESIGN_STAGES] = {
+    "setup", "bed_parse", "merge", "db_join", "fetch", "score", "format", "compress", "summary"
+};
+
+enum { STAGE_CORPUS, STAGE_EXOME, STAGE_HOTSPOT, STAGE_WGS, STAGE_MERGE, N_STAGES };
+
+static const char *stage_names[N_STAGES] = { "corpus", "exome", "hotspot", "wgs", "merge" };
+
+struct stage {
+    double wall;
+    double user;
+    double sys;
+    // kilobytes
+    long max_rss;
+    uint64_t oligos;
+    // bytes of output, uncompressed
+    uint64_t bytes;
+    // wall time of the stages of generate_oligos
+    double design_wall[N_DESIGN_STAGES];
+    int done;
+};
+
+struct command {
+    int n;
+    char *argv[MAX_ARGS + 1];
+};
+
+struct args {
+    const char *bin_dir;
+    const char *work_dir;
+    const char *size;
+    const char *threads;
+    int reuse;
+    // options passed to generate_oligos
+    int n_extra;
+    char **extra;
+    struct stage stages[N_STAGES];
+} args = {
+    .bin_dir = 0,
+    .work_dir = 0,
+    .size = 0,
+    .threads = 0,
+    .reuse = 0,
+    .n_extra = 0,
+    .extra = 0,
+};
+
+int usage()
+{
+    fprintf(stderr,
+	    "bench_oligos - benchmark generate_oligos and merge_oligos on a synthesized corpus.\n"
+	    "Usage: \n"
+	    "bench_oligos -o bench -size 100M -threads 4 [-- options of generate_oligos]\n"
+	    "Options:\n"
+	    "  -o [bench]\n"
+	    "            working directory, keeps the corpus, probe files and logs of stages.\n"
+	    "  -bin [bin]\n"
+	    "            directory of synth_corpus, generate_oligos and merge_oligos.\n"
+	    "  -size [20M]\n"
+	    "            bases of the synthesized reference genome.\n"
+	    "  -threads [1]\n"
+	    "            threads of generate_oligos and merge_oligos.\n"
+	    "  -reuse\n"
+	    "            reuse the corpus in the working directory if it exists.\n"
+	    "  --\n"
+	    "            the rest are passed to generate_oligos.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int parse_args(int argc, char **argv)
+{
+    int i;
+    for (i = 0; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	if ( strcmp(a, "-reuse") == 0 ) {
+	    args.reuse = 1;
+	    continue;
+	}
+	if ( strcmp(a, "--") == 0 ) {
+	    args.n_extra = argc - i;
+	    args.extra = argv + i;
+	    break;
+	}
+	const char **var = 0;
+	if ( strcmp(a, "-o") == 0 && args.work_dir == 0 )
+	    var = &args.work_dir;
+	else if ( strcmp(a, "-bin") == 0 && args.bin_dir == 0 )
+	    var = &args.bin_dir;
+	else if ( strcmp(a, "-size") == 0 && args.size == 0 )
+	    var = &args.size;
+	else if ( (strcmp(a, "-t") == 0 || strcmp(a, "-threads") == 0) && args.threads == 0 )
+	    var = &args.threads;
+
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return -2;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( args.work_dir == 0 )
+	args.work_dir = "bench";
+    if ( args.bin_dir == 0 )
+	args.bin_dir = "bin";
+    if ( args.size == 0 )
+	args.size = "20M";
+    if ( args.threads == 0 )
+	args.threads = "1";
+    if ( args.n_extra > MAX_ARGS / 2 )
+	error("Too many options of generate_oligos.");
+    struct stat s;
+    if ( stat(args.work_dir, &s) == -1 && mkdir(args.work_dir, 0755) )
+	error("Failed to create directory %s : %s.", args.work_dir, strerror(errno));
+    return 0;
+}
+
+static void command_add(struct command *c, const char *fmt, ...)
+{
+    kstring_t str = KSTRING_INIT;
+    va_list ap;
+    va_start(ap, fmt);
+    kvsprintf(&str, fmt, ap);
+    va_end(ap);
+    if ( c->n == MAX_ARGS )
+	error("Too many arguments.");
+    c->argv[c->n++] = str.s;
+    c->argv[c->n] = NULL;
+}
+
+static void command_clear(struct command *c)
+{
+    int i;
+    for ( i = 0; i < c->n; ++i )
+	free(c->argv[i]);
+    c->n = 0;
+}
+
+static double wall_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// run the command with output to the log, exit if it fails
+static void run_stage(int id, struct command *c)
+{
+    struct stage *s = &args.stages[id];
+    kstring_t log = KSTRING_INIT;
+    ksprintf(&log, "%s/%s.log", args.work_dir, stage_names[id]);
+    LOG_print("Run %s : %s ...", stage_names[id], c->argv[0]);
+    double start = wall_time();
+    pid_t pid = fork();
+    if ( pid < 0 )
+	error("Failed to fork : %s.", strerror(errno));
+    if ( pid == 0 ) {
+	int fd = open(log.s, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if ( fd < 0 || dup2(fd, 1) < 0 || dup2(fd, 2) < 0 )
+	    _exit(126);
+	close(fd);
+	execv(c->argv[0], c->argv);
+	fprintf(stderr, "Failed to run %s : %s.\n", c->argv[0], strerror(errno));
+	_exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if ( wait4(pid, &status, 0, &ru) < 0 )
+	error("Failed to wait %s : %s.", c->argv[0], strerror(errno));
+    s->wall = wall_time() - start;
+    if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+	error("Stage %s failed, see %s.", stage_names[id], log.s);
+    s->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+    s->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    // kilobytes on Linux, bytes on macOS
+#ifdef __APPLE__
+    s->max_rss = ru.ru_maxrss / 1024;
+#else
+    s->max_rss = ru.ru_maxrss;
+#endif
+    s->done = 1;
+    free(log.s);
+}
+
+// count records and uncompressed bytes of a probe file
+static void count_output(int id, const char *fname)
+{
+    struct stage *s = &args.stages[id];
+    BGZF *fp = bgzf_open(fname, "r");
+    if ( fp == NULL )
+	error("Failed to open %s : %s.", fname, strerror(errno));
+    kstring_t str = KSTRING_INIT;
+    while ( bgzf_getline(fp, '\n', &str) >= 0 ) {
+	s->bytes += str.l + 1;
+	if ( str.l && str.s[0] != '#' )
+	    s->oligos++;
+    }
+    bgzf_close(fp);
+    free(str.s);
+}
+
+// pick the wall time of stages from the report of generate_oligos, "fetch": { "wall_sec": 0.123, ...
+static void load_design_stages(int id, const char *fname)
+{
+    FILE *fp = fopen(fname, "r");
+    if ( fp == NULL )
+	error("Failed to open %s : %s.", fname, strerror(errno));
+    kstring_t str = KSTRING_INIT;
+    kstring_t key = KSTRING_INIT;
+    char buf[4096];
+    size_t n;
+    while ( (n = fread(buf, 1, sizeof(buf), fp)) > 0 )
+	kputsn(buf, n, &str);
+    fclose(fp);
+    int i;
+    for ( i = 0; i < N_DESIGN_STAGES && str.l; ++i ) {
+	key.l = 0;
+	ksprintf(&key, "\"%s\": { \"wall_sec\": ", design_stages[i]);
+	char *p = strstr(str.s, key.s);
+	if ( p )
+	    args.stages[id].design_wall[i] = strtod(p + key.l, NULL);
+    }
+    free(str.s);
+    free(key.s);
+}
+
+static void bench_corpus()
+{
+    struct command c = { 0 };
+    struct stat st;
+    kstring_t ref = KSTRING_INIT;
+    ksprintf(&ref, "%s/ref.fa.fai", args.work_dir);
+    if ( args.reuse && stat(ref.s, &st) == 0 ) {
+	LOG_print("Reuse the corpus in %s.", args.work_dir);
+    }
+    else {
+	command_add(&c, "%s/synth_corpus", args.bin_dir);
+	command_add(&c, "-o");
+	command_add(&c, "%s", args.work_dir);
+	command_add(&c, "-size");
+	command_add(&c, "%s", args.size);
+	run_stage(STAGE_CORPUS, &c);
+	command_clear(&c);
+    }
+    // bases of the reference
+    ref.l -= 4;
+    ref.s[ref.l] = '\0';
+    if ( stat(ref.s, &st) == 0 )
+	args.stages[STAGE_CORPUS].bytes = st.st_size;
+    free(ref.s);
+}
+
+static void bench_design(int id)
+{
+    struct command c = { 0 };
+    const char *name = stage_names[id];
+    int i;
+    command_add(&c, "%s/generate_oligos", args.bin_dir);
+    command_add(&c, "-p");
+    command_add(&c, "%s", name);
+    command_add(&c, "-r");
+    command_add(&c, "%s/ref.fa", args.work_dir);
+    command_add(&c, "-t");
+    command_add(&c, "%s/%s.bed", args.work_dir, name);
+    command_add(&c, "-u");
+    command_add(&c, "%s/db.bed.gz", args.work_dir);
+    command_add(&c, "-o");
+    command_add(&c, "%s/%s", args.work_dir, name);
+    command_add(&c, "-threads");
+    command_add(&c, "%s", args.threads);
+    command_add(&c, "-stats");
+    command_add(&c, "%s/%s.json", args.work_dir, name);
+    for ( i = 0; i < args.n_extra; ++i )
+	command_add(&c, "%s", args.extra[i]);
+    run_stage(id, &c);
+    command_clear(&c);
+
+    kstring_t str = KSTRING_INIT;
+    ksprintf(&str, "%s/%s/probes.txt.gz", args.work_dir, name);
+    count_output(id, str.s);
+    str.l = 0;
+    ksprintf(&str, "%s/%s.json", args.work_dir, name);
+    load_design_stages(id, str.s);
+    free(str.s);
+}
+
+static void bench_merge()
+{
+    struct command c = { 0 };
+    int i;
+    command_add(&c, "%s/merge_oligos", args.bin_dir);
+    command_add(&c, "-r");
+    command_add(&c, "%s/ref.fa", args.work_dir);
+    command_add(&c, "-threads");
+    command_add(&c, "%s", args.threads);
+    command_add(&c, "-o");
+    command_add(&c, "%s/merged.txt.gz", args.work_dir);
+    for ( i = STAGE_EXOME; i <= STAGE_WGS; ++i )
+	command_add(&c, "%s/%s/probes.txt.gz", args.work_dir, stage_names[i]);
+    run_stage(STAGE_MERGE, &c);
+    command_clear(&c);
+
+    kstring_t str = KSTRING_INIT;
+    ksprintf(&str, "%s/merged.txt.gz", args.work_dir);
+    count_output(STAGE_MERGE, str.s);
+    free(str.s);
+}
+
+static void report()
+{
+    int i;
+    printf("#stage\twall(s)\tuser(s)\tsys(s)\tpeak_rss(MB)\toligos\toligos/s\toutput(MB)\tMB/s\n");
+    for ( i = 0; i < N_STAGES; ++i ) {
+	struct stage *s = &args.stages[i];
+	if ( s->done == 0 )
+	    continue;
+	double wall = s->wall > 1e-6 ? s->wall : 1e-6;
+	printf("%s\t%.3f\t%.3f\t%.3f\t%.1f\t%"PRIu64"\t%.0f\t%.2f\t%.2f\n", stage_names[i], s->wall, s->user, s->sys,
+	       s->max_rss / 1024.0, s->oligos, s->oligos / wall, s->bytes / 1e6, s->bytes / 1e6 / wall);
+    }
+    // wall time of the stages in each design
+    int j;
+    printf("#design");
+    for ( j = 0; j < N_DESIGN_STAGES; ++j )
+	printf("\t%s(s)", design_stages[j]);
+    printf("\n");
+    for ( i = STAGE_EXOME; i <= STAGE_WGS; ++i ) {
+	printf("%s", stage_names[i]);
+	for ( j = 0; j < N_DESIGN_STAGES; ++j )
+	    printf("\t%.3f", args.stages[i].design_wall[j]);
+	printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if ( parse_args(--argc, ++argv) )
+	return 1;
+    int i;
+    bench_corpus();
+    for ( i = STAGE_EXOME; i <= STAGE_WGS; ++i )
+	bench_design(i);
+    bench_merge();
+    report();
+    return 0;
+}
@@ -0,0 +1,67 @@
+// build_fm_index.c - build the FM-index of reference genome for seed occurrence counting of generate_oligos.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "number.h"
+#include "fm_index.h"
+
+int usage()
+{
+    fprintf(stderr,
+	    "build_fm_index - build FM-index of reference genome for exact seed counting.\n"
+	    "Usage: \n"
+	    "build_fm_index [options] -fasta hg19.fa -o hg19.fmi\n"
+	    "Options:\n"
+	    "  -r, -fasta [fasta file]\n"
+	    "            reference genome sequences, in fasta format.\n"
+	    "  -o [file]\n"
+	    "            output index.\n"
+	    "  -sa_intv [32]\n"
+	    "            sample interval of suffix array, smaller value locates faster with larger index.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *fasta_fname = 0;
+    const char *output_fname = 0;
+    const char *sa_interval = 0;
+    int i;
+    for (i = 1; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	const char **var = 0;
+	if ( (strcmp(a, "-r") == 0 || strcmp(a, "-fasta") == 0) && fasta_fname == 0 )
+	    var = &fasta_fname;
+	else if ( strcmp(a, "-o") == 0 && output_fname == 0 )
+	    var = &output_fname;
+	else if ( strcmp(a, "-sa_intv") == 0 && sa_interval == 0 )
+	    var = &sa_interval;
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return 1;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( fasta_fname == 0 || output_fname == 0 )
+	return usage();
+    int sa_intv = sa_interval ? str2int((char*)sa_interval) : 32;
+    if ( sa_intv < 1 )
+	error("Sample interval of suffix array should be a positive integer. %d", sa_intv);
+    LOG_print("Build FM-index of %s, sa_intv = %d.", fasta_fname, sa_intv);
+    fm_index_build(fasta_fname, sa_intv, output_fname);
+    LOG_print("Sucess.");
+    return 0;
+}
@@ -0,0 +1,75 @@
+// build_mini_index.c - build the minimizer index of reference genome for off-target screening of generate_oligos.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "number.h"
+#include "mini_index.h"
+
+int usage()
+{
+    fprintf(stderr,
+	    "build_mini_index - build minimizer index of reference genome for off-target screening.\n"
+	    "Usage: \n"
+	    "build_mini_index [options] -fasta hg19.fa -o hg19.mmi\n"
+	    "Options:\n"
+	    "  -r, -fasta [fasta file]\n"
+	    "            reference genome sequences, in fasta format.\n"
+	    "  -o [file]\n"
+	    "            output index.\n"
+	    "  -k [15]\n"
+	    "            k-mer size of minimizers, no more than 28.\n"
+	    "  -w [10]\n"
+	    "            window size of minimizers.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *fasta_fname = 0;
+    const char *output_fname = 0;
+    const char *kmer_size = 0;
+    const char *window_size = 0;
+    int i;
+    for (i = 1; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	const char **var = 0;
+	if ( (strcmp(a, "-r") == 0 || strcmp(a, "-fasta") == 0) && fasta_fname == 0 )
+	    var = &fasta_fname;
+	else if ( strcmp(a, "-o") == 0 && output_fname == 0 )
+	    var = &output_fname;
+	else if ( strcmp(a, "-k") == 0 && kmer_size == 0 )
+	    var = &kmer_size;
+	else if ( strcmp(a, "-w") == 0 && window_size == 0 )
+	    var = &window_size;
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return 1;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( fasta_fname == 0 || output_fname == 0 )
+	return usage();
+    int k = kmer_size ? str2int((char*)kmer_size) : 15;
+    int w = window_size ? str2int((char*)window_size) : 10;
+    if ( k < 8 || k > 28 )
+	error("K-mer size should be between 8 and 28. %d", k);
+    if ( w < 1 || w > 255 )
+	error("Window size should be between 1 and 255. %d", w);
+    LOG_print("Build minimizer index of %s, k = %d, w = %d.", fasta_fname, k, w);
+    mini_index_build(fasta_fname, k, w, output_fname);
+    LOG_print("Sucess.");
+    return 0;
+}
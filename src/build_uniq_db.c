@@ -0,0 +1,555 @@
+// build_uniq_db.c - build the database of designable (unique or low-copy) regions for generate_oligos.
+//
+// The reference is streamed through faidx in chunks, every canonical k-mer is hashed into one of n partitions and
+// spilled to disk together with its genome position. Each partition is then loaded, sorted and counted separately,
+// so only a slice of all k-mers lives in memory at any time. The number of partitions is chosen from the memory
+// budget. Positions of k-mers whose copy number is not greater than -max_copy are merged back in genome order and
+// exported as a bgzipped, tabix-indexed BED file, which can be passed to generate_oligos by -database directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "htslib/kstring.h"
+#include "htslib/faidx.h"
+#include "htslib/bgzf.h"
+#include "htslib/tbx.h"
+#include "htslib/ksort.h"
+#include "utils.h"
+#include "number.h"
+#include "seq_utils.h"
+
+#ifndef KSTRING_INIT
+#define KSTRING_INIT { 0, 0, 0 }
+#endif
+
+// fetch reference in chunks, in case of loading a whole chromosome into memory
+#define FETCH_CHUNK_SIZE 1000000
+// records cached for each partition before spilled to disk
+#define SPILL_BUFFER_MAX 65536
+#define SPILL_BUFFER_MIN 1024
+
+struct kmer_rec {
+    uint64_t kmer;
+    uint64_t pos;
+};
+
+#define kmer_rec_lt(a, b) ((a).kmer < (b).kmer)
+KSORT_INIT(kmer, struct kmer_rec, kmer_rec_lt)
+KSORT_INIT_GENERIC(uint64_t)
+
+struct args {
+    const char *fasta_fname;
+    const char *output_fname;
+    const char *tmp_dir;
+    int kmer_size;
+    // k-mers occur no more than max_copy times in the genome (both strands) are treated as designable
+    int max_copy;
+    // skip short designable regions
+    int min_length;
+    // treat soft-masked bases as non-designable
+    int mask_lower;
+    int n_threads;
+    uint64_t mem_limit;
+    int n_parts;
+    int spill_size;
+    int n_seqs;
+    // genome offsets of each sequence, positions of k-mers are kept in genome offsets
+    uint64_t *offsets;
+    uint64_t genome_length;
+    // shared by workers
+    int next;
+    pthread_mutex_t lock;
+    uint64_t n_kmers;
+    uint64_t n_uniq;
+} args = {
+    .fasta_fname = 0,
+    .output_fname = 0,
+    .tmp_dir = 0,
+    .kmer_size = 32,
+    .max_copy = 1,
+    .min_length = 0,
+    .mask_lower = 0,
+    .n_threads = 1,
+    .mem_limit = 0,
+    .n_parts = 0,
+    .spill_size = SPILL_BUFFER_MAX,
+    .n_seqs = 0,
+    .offsets = 0,
+    .genome_length = 0,
+    .next = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .n_kmers = 0,
+    .n_uniq = 0,
+};
+
+static int quiet_mode = 0;
+
+int usage()
+{
+    fprintf(stderr,
+	    "build_uniq_db - build designable regions database from k-mer copy numbers of reference genome.\n"
+	    "Usage: \n"
+	    "build_uniq_db [options] -fasta hg19.fa -o database.bed.gz\n"
+	    "Options:\n"
+	    "  -r, -fasta [fasta file]\n"
+	    "            reference genome sequences, in fasta format.\n"
+	    "  -o [bed.gz]\n"
+	    "            output database, bgzipped and tabix indexed.\n"
+	    "  -k [32]\n"
+	    "            k-mer size, no more than 32.\n"
+	    "  -max_copy [1]\n"
+	    "            k-mers occur no more than this times (both strands) are designable.\n"
+	    "  -min_length [k]\n"
+	    "            skip designable regions shorter than this length.\n"
+	    "  -mask_lower\n"
+	    "            treat soft-masked (lower case) bases as non-designable.\n"
+	    "  -t, -threads [1]\n"
+	    "            threads used to count k-mers.\n"
+	    "  -mem [4G]\n"
+	    "            memory budget, k-mers are partitioned on disk to fit it.\n"
+	    "  -tmpdir [dir]\n"
+	    "            directory for temporary partitions, default is the directory of output.\n"
+	    "  -quiet\n"
+	    "            quiet mode.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int parse_args(int argc, char **argv)
+{
+    int i;
+    const char *kmer_size = 0;
+    const char *max_copy = 0;
+    const char *min_length = 0;
+    const char *threads = 0;
+    const char *mem = 0;
+    for (i = 0; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	if ( strcmp(a, "-quiet") == 0 ) {
+	    quiet_mode = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-mask_lower") == 0 ) {
+	    args.mask_lower = 1;
+	    continue;
+	}
+	const char **var = 0;
+	if ( (strcmp(a, "-r") == 0 || strcmp(a, "-fasta") == 0) && args.fasta_fname == 0 )
+	    var = &args.fasta_fname;
+	else if ( strcmp(a, "-o") == 0 && args.output_fname == 0 )
+	    var = &args.output_fname;
+	else if ( strcmp(a, "-tmpdir") == 0 && args.tmp_dir == 0 )
+	    var = &args.tmp_dir;
+	else if ( strcmp(a, "-k") == 0 && kmer_size == 0 )
+	    var = &kmer_size;
+	else if ( strcmp(a, "-max_copy") == 0 && max_copy == 0 )
+	    var = &max_copy;
+	else if ( strcmp(a, "-min_length") == 0 && min_length == 0 )
+	    var = &min_length;
+	else if ( (strcmp(a, "-t") == 0 || strcmp(a, "-threads") == 0) && threads == 0 )
+	    var = &threads;
+	else if ( strcmp(a, "-mem") == 0 && mem == 0 )
+	    var = &mem;
+
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return -2;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( args.fasta_fname == 0 )
+	error("Required a reference genome sequence. Use -r or -fasta to specify.");
+    if ( args.output_fname == 0 )
+	error("Required an output file. Use -o to specify.");
+    if ( kmer_size ) {
+	args.kmer_size = str2int((char*)kmer_size);
+	if ( args.kmer_size < 8 || args.kmer_size > 32 )
+	    error("K-mer size should be between 8 and 32. %s", kmer_size);
+    }
+    if ( max_copy ) {
+	args.max_copy = str2int((char*)max_copy);
+	if ( args.max_copy < 1 )
+	    error("-max_copy should be a positive number. %s", max_copy);
+    }
+    args.min_length = min_length ? str2int((char*)min_length) : args.kmer_size;
+    if ( threads ) {
+	args.n_threads = str2int((char*)threads);
+	if ( args.n_threads < 1 ) args.n_threads = 1;
+    }
+    args.mem_limit = parse_mem_size(mem ? mem : "4G");
+    if ( args.mem_limit == 0 )
+	error("Failed to parse memory size. %s", mem);
+    if ( args.tmp_dir == 0 ) {
+	char *p = strrchr(args.output_fname, '/');
+	args.tmp_dir = p ? strndup(args.output_fname, p - args.output_fname + 1) : strdup("./");
+    } else {
+	args.tmp_dir = strdup(args.tmp_dir);
+    }
+    return 0;
+}
+
+static void partition_fname(kstring_t *str, const char *tag, int part, int thread)
+{
+    str->l = 0;
+    ksprintf(str, "%s/build_uniq_db.%d.%s%d", args.tmp_dir, (int)getpid(), tag, part);
+    if ( thread >= 0 )
+	ksprintf(str, ".t%d", thread);
+}
+
+struct spill_buffer {
+    int thread;
+    int *n;
+    struct kmer_rec **a;
+    kstring_t fname;
+};
+
+static void spill_partition(struct spill_buffer *buf, int part)
+{
+    if ( buf->n[part] == 0 )
+	return;
+    partition_fname(&buf->fname, "p", part, buf->thread);
+    FILE *fp = fopen(buf->fname.s, "ab");
+    if ( fp == NULL )
+	error("Failed to write %s : %s.", buf->fname.s, strerror(errno));
+    if ( fwrite(buf->a[part], sizeof(struct kmer_rec), buf->n[part], fp) != buf->n[part] )
+	error("Failed to write %s : %s.", buf->fname.s, strerror(errno));
+    fclose(fp);
+    buf->n[part] = 0;
+}
+
+static int next_job(void)
+{
+    pthread_mutex_lock(&args.lock);
+    int i = args.next++;
+    pthread_mutex_unlock(&args.lock);
+    return i;
+}
+
+// stage one, stream the reference and spill canonical k-mers into partitions
+static void *count_kmers_worker(void *data)
+{
+    struct spill_buffer *buf = (struct spill_buffer*)data;
+    faidx_t *fai = fai_load(args.fasta_fname);
+    if ( fai == NULL )
+	error("Failed to load index of %s.", args.fasta_fname);
+    unsigned char *table = args.mask_lower ? seq_nt4_upper_table : seq_nt4_table;
+    int k = args.kmer_size;
+    int shift = 2 * (k - 1);
+    uint64_t mask = k == 32 ? ~0ULL : (1ULL << 2*k) - 1;
+    uint64_t n_kmers = 0;
+    int id;
+    while ( (id = next_job()) < args.n_seqs ) {
+	const char *name = faidx_iseq(fai, id);
+	int length = faidx_seq_len(fai, name);
+	uint64_t x[2] = { 0, 0 };
+	int l = 0;
+	int beg;
+	for ( beg = 0; beg < length; beg += FETCH_CHUNK_SIZE ) {
+	    int end = beg + FETCH_CHUNK_SIZE > length ? length : beg + FETCH_CHUNK_SIZE;
+	    int n = 0;
+	    char *seq = faidx_fetch_seq(fai, name, beg, end - 1, &n);
+	    if ( seq == NULL || n != end - beg )
+		error("Failed to fetch %s:%d-%d.", name, beg, end);
+	    int i;
+	    for ( i = 0; i < n; ++i ) {
+		int c = table[(unsigned char)seq[i]];
+		if ( c > 3 ) {
+		    l = 0, x[0] = x[1] = 0;
+		    continue;
+		}
+		x[0] = (x[0] << 2 | c) & mask;
+		x[1] = x[1] >> 2 | (uint64_t)(3 - c) << shift;
+		if ( ++l < k )
+		    continue;
+		uint64_t kmer = x[0] < x[1] ? x[0] : x[1];
+		int part = hash64(kmer, ~0ULL) % args.n_parts;
+		struct kmer_rec *r = &buf->a[part][buf->n[part]++];
+		r->kmer = kmer;
+		r->pos = args.offsets[id] + beg + i - k + 1;
+		if ( buf->n[part] == args.spill_size )
+		    spill_partition(buf, part);
+		n_kmers++;
+	    }
+	    free(seq);
+	}
+    }
+    int i;
+    for ( i = 0; i < args.n_parts; ++i )
+	spill_partition(buf, i);
+    fai_destroy(fai);
+    pthread_mutex_lock(&args.lock);
+    args.n_kmers += n_kmers;
+    pthread_mutex_unlock(&args.lock);
+    return NULL;
+}
+
+// stage two, load a partition, sort and count k-mers, keep positions of low copy k-mers
+static void *sort_partition_worker(void *data)
+{
+    kstring_t fname = KSTRING_INIT;
+    struct kmer_rec *a = NULL;
+    size_t m = 0;
+    uint64_t n_uniq = 0;
+    int part;
+    while ( (part = next_job()) < args.n_parts ) {
+	size_t n = 0;
+	int t;
+	for ( t = 0; t < args.n_threads; ++t ) {
+	    struct stat s;
+	    partition_fname(&fname, "p", part, t);
+	    if ( stat(fname.s, &s) != 0 )
+		continue;
+	    size_t l = s.st_size / sizeof(struct kmer_rec);
+	    if ( n + l > m ) {
+		m = n + l;
+		a = (struct kmer_rec*)realloc(a, m * sizeof(struct kmer_rec));
+		check_mem(a);
+	    }
+	    FILE *fp = fopen(fname.s, "rb");
+	    if ( fp == NULL || fread(a + n, sizeof(struct kmer_rec), l, fp) != l )
+		error("Failed to read %s : %s.", fname.s, strerror(errno));
+	    fclose(fp);
+	    unlink(fname.s);
+	    n += l;
+	}
+	ks_introsort(kmer, n, a);
+	// positions of low copy k-mers are written into the head of the same buffer
+	uint64_t *pos = (uint64_t*)a;
+	size_t i, j, l = 0;
+	for ( i = 0; i < n; i = j ) {
+	    for ( j = i + 1; j < n && a[j].kmer == a[i].kmer; ++j );
+	    if ( j - i > args.max_copy )
+		continue;
+	    for ( ; i < j; ++i ) {
+		uint64_t p = a[i].pos;
+		memcpy(pos + l++, &p, sizeof(uint64_t));
+	    }
+	}
+	ks_introsort(uint64_t, l, pos);
+	partition_fname(&fname, "u", part, -1);
+	FILE *fp = fopen(fname.s, "wb");
+	if ( fp == NULL || fwrite(pos, sizeof(uint64_t), l, fp) != l )
+	    error("Failed to write %s : %s.", fname.s, strerror(errno));
+	fclose(fp);
+	n_uniq += l;
+    }
+    free(a);
+    free(fname.s);
+    pthread_mutex_lock(&args.lock);
+    args.n_uniq += n_uniq;
+    pthread_mutex_unlock(&args.lock);
+    return NULL;
+}
+
+static void run_workers(void *(*func)(void*), void *data, size_t size)
+{
+    pthread_t *threads = (pthread_t*)malloc(args.n_threads * sizeof(pthread_t));
+    int i;
+    args.next = 0;
+    for ( i = 0; i < args.n_threads; ++i )
+	pthread_create(&threads[i], NULL, func, (char*)data + i * size);
+    for ( i = 0; i < args.n_threads; ++i )
+	pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+// sorted positions of low copy k-mers in one partition
+struct uniq_stream {
+    FILE *fp;
+    uint64_t *a;
+    int n, i;
+    uint64_t pos;
+};
+
+#define UNIQ_STREAM_BUFFER 8192
+
+static int uniq_stream_next(struct uniq_stream *s)
+{
+    if ( s->i == s->n ) {
+	s->n = fread(s->a, sizeof(uint64_t), UNIQ_STREAM_BUFFER, s->fp);
+	s->i = 0;
+	if ( s->n == 0 )
+	    return 1;
+    }
+    s->pos = s->a[s->i++];
+    return 0;
+}
+
+typedef struct uniq_stream *uniq_stream_point;
+#define uniq_stream_gt(a, b) ((a)->pos > (b)->pos)
+KSORT_INIT(uniq, uniq_stream_point, uniq_stream_gt)
+
+struct bed_writer {
+    BGZF *fp;
+    kstring_t str;
+    faidx_t *fai;
+    int id;
+    uint64_t regions;
+    uint64_t length;
+};
+
+static void write_region(struct bed_writer *w, uint64_t start, uint64_t end)
+{
+    if ( end - start < args.min_length )
+	return;
+    while ( start >= args.offsets[w->id + 1] )
+	w->id++;
+    ksprintf(&w->str, "%s\t%"PRIu64"\t%"PRIu64"\n", faidx_iseq(w->fai, w->id), start - args.offsets[w->id], end - args.offsets[w->id]);
+    w->regions++;
+    w->length += end - start;
+    if ( w->str.l > 1<<16 ) {
+	if ( bgzf_write(w->fp, w->str.s, w->str.l) != w->str.l )
+	    error("Write error : %d.", w->fp->errcode);
+	w->str.l = 0;
+    }
+}
+
+// stage three, merge sorted positions of all partitions and export designable regions
+static void export_regions(faidx_t *fai)
+{
+    struct bed_writer w = { NULL, KSTRING_INIT, fai, 0, 0, 0 };
+    w.fp = bgzf_open(args.output_fname, "w");
+    if ( w.fp == NULL )
+	error("Failed to write %s : %s.", args.output_fname, strerror(errno));
+
+    kstring_t fname = KSTRING_INIT;
+    struct uniq_stream *streams = (struct uniq_stream*)calloc(args.n_parts, sizeof(struct uniq_stream));
+    uniq_stream_point *heap = (uniq_stream_point*)malloc(args.n_parts * sizeof(uniq_stream_point));
+    int i, n = 0;
+    for ( i = 0; i < args.n_parts; ++i ) {
+	struct uniq_stream *s = &streams[i];
+	partition_fname(&fname, "u", i, -1);
+	s->fp = fopen(fname.s, "rb");
+	if ( s->fp == NULL )
+	    error("Failed to read %s : %s.", fname.s, strerror(errno));
+	unlink(fname.s);
+	s->a = (uint64_t*)malloc(UNIQ_STREAM_BUFFER * sizeof(uint64_t));
+	if ( uniq_stream_next(s) == 0 )
+	    heap[n++] = s;
+    }
+    ks_heapmake(uniq, n, heap);
+
+    uint64_t start = 0, end = 0;
+    int id = 0, last_id = -1;
+    while ( n ) {
+	struct uniq_stream *s = heap[0];
+	uint64_t p = s->pos;
+	// k-mers never cross sequence boundaries, but two regions may touch at the boundary
+	while ( p >= args.offsets[id + 1] )
+	    id++;
+	if ( id == last_id && p <= end ) {
+	    if ( p + args.kmer_size > end )
+		end = p + args.kmer_size;
+	} else {
+	    if ( last_id != -1 )
+		write_region(&w, start, end);
+	    start = p;
+	    end = p + args.kmer_size;
+	    last_id = id;
+	}
+	if ( uniq_stream_next(s) ) {
+	    heap[0] = heap[--n];
+	}
+	ks_heapadjust(uniq, 0, n, heap);
+    }
+    if ( last_id != -1 )
+	write_region(&w, start, end);
+
+    if ( w.str.l && bgzf_write(w.fp, w.str.s, w.str.l) != w.str.l )
+	error("Write error : %d.", w.fp->errcode);
+    bgzf_close(w.fp);
+    for ( i = 0; i < args.n_parts; ++i ) {
+	fclose(streams[i].fp);
+	free(streams[i].a);
+    }
+    free(streams);
+    free(heap);
+    free(fname.s);
+    free(w.str.s);
+
+    if ( tbx_index_build(args.output_fname, 0, &tbx_conf_bed) )
+	error("Failed to build tabix index of %s.", args.output_fname);
+    if ( quiet_mode == 0 )
+	LOG_print("Export %"PRIu64" designable regions, %"PRIu64" bases.", w.regions, w.length);
+}
+
+void build_uniq_db()
+{
+    faidx_t *fai = fai_load(args.fasta_fname);
+    if ( fai == NULL ) {
+	if ( fai_build(args.fasta_fname) == -1 )
+	    error("Failed to build the index of %s.", args.fasta_fname);
+	fai = fai_load(args.fasta_fname);
+    }
+    int i;
+    args.n_seqs = faidx_nseq(fai);
+    args.offsets = (uint64_t*)malloc((args.n_seqs + 1) * sizeof(uint64_t));
+    args.offsets[0] = 0;
+    for ( i = 0; i < args.n_seqs; ++i )
+	args.offsets[i+1] = args.offsets[i] + faidx_seq_len(fai, faidx_iseq(fai, i));
+    args.genome_length = args.offsets[args.n_seqs];
+
+    // every sorting thread holds one partition in memory
+    uint64_t total = args.genome_length * sizeof(struct kmer_rec) * args.n_threads;
+    args.n_parts = total / args.mem_limit + 1;
+    uint64_t spill = args.mem_limit / 4 / args.n_parts / args.n_threads / sizeof(struct kmer_rec);
+    args.spill_size = spill > SPILL_BUFFER_MAX ? SPILL_BUFFER_MAX : spill < SPILL_BUFFER_MIN ? SPILL_BUFFER_MIN : spill;
+    if ( quiet_mode == 0 )
+	LOG_print("Genome length %"PRIu64", split k-mers into %d partitions.", args.genome_length, args.n_parts);
+
+    struct spill_buffer *bufs = (struct spill_buffer*)calloc(args.n_threads, sizeof(struct spill_buffer));
+    for ( i = 0; i < args.n_threads; ++i ) {
+	int j;
+	bufs[i].thread = i;
+	bufs[i].n = (int*)calloc(args.n_parts, sizeof(int));
+	bufs[i].a = (struct kmer_rec**)malloc(args.n_parts * sizeof(struct kmer_rec*));
+	for ( j = 0; j < args.n_parts; ++j ) {
+	    bufs[i].a[j] = (struct kmer_rec*)malloc(args.spill_size * sizeof(struct kmer_rec));
+	    check_mem(bufs[i].a[j]);
+	}
+    }
+    run_workers(count_kmers_worker, bufs, sizeof(struct spill_buffer));
+    for ( i = 0; i < args.n_threads; ++i ) {
+	int j;
+	for ( j = 0; j < args.n_parts; ++j )
+	    free(bufs[i].a[j]);
+	free(bufs[i].a);
+	free(bufs[i].n);
+	free(bufs[i].fname.s);
+    }
+    free(bufs);
+    if ( quiet_mode == 0 )
+	LOG_print("%"PRIu64" k-mers spilled.", args.n_kmers);
+
+    run_workers(sort_partition_worker, NULL, 0);
+    if ( quiet_mode == 0 )
+	LOG_print("%"PRIu64" k-mers occur no more than %d times.", args.n_uniq, args.max_copy);
+
+    export_regions(fai);
+    fai_destroy(fai);
+}
+
+int main(int argc, char **argv)
+{
+    if ( parse_args(--argc, ++argv) != 0 )
+	return 1;
+    build_uniq_db();
+    free(args.offsets);
+    free((char*)args.tmp_dir);
+    if ( quiet_mode == 0 )
+	LOG_print("Sucess.");
+    return 0;
+}
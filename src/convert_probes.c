@@ -0,0 +1,214 @@
+// convert_probes.c - convert probe file between text format (probes.txt.gz) and binary columnar format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include "utils.h"
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
+#include "probe_binary.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+
+int usage()
+{
+    fprintf(stderr,
+	    "convert_probes - convert probe file between text and binary columnar format.\n"
+	    "Usage: \n"
+	    "convert_probes -i probes.txt.gz -o probes.bin\n"
+	    "convert_probes -i probes.bin -o probes.txt.gz\n"
+	    "Options:\n"
+	    "  -i [file]\n"
+	    "            input probe file, the format is detected by the content.\n"
+	    "  -o [file]\n"
+	    "            output probe file, in the other format of input.\n"
+	    "  -stat\n"
+	    "            summarize a binary probe file instead of converting it.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+// parse "start1,start2," of block columns, return the number of blocks
+static int parse_blocks(char *s, int *a)
+{
+    int n = 0;
+    while ( *s && n < 2 ) {
+	a[n++] = strtol(s, &s, 10);
+	if ( *s == ',' ) s++;
+    }
+    return n;
+}
+
+static int text_to_binary(const char *input, const char *output)
+{
+    BGZF *fp = bgzf_open(input, "r");
+    if ( fp == NULL )
+	error("Failed to open %s : %s.", input, strerror(errno));
+    struct probe_writer *w = probe_writer_open(output);
+    if ( w == NULL )
+	return 1;
+    kstring_t str = KSTRING_INIT;
+    kstring_t header = KSTRING_INIT;
+    uint64_t lines = 0;
+    while ( bgzf_getline(fp, '\n', &str) >= 0 ) {
+	lines++;
+	if ( str.l == 0 )
+	    continue;
+	if ( str.s[0] == '#' ) {
+	    kputsn(str.s, str.l, &header);
+	    kputc('\n', &header);
+	    continue;
+	}
+	char *fields[12];
+	int n = 0;
+	char *p = str.s;
+	fields[n++] = p;
+	// optional columns after rank are kept as they are
+	while ( n < 12 && (p = strchr(p, '\t')) != NULL ) {
+	    *p++ = '\0';
+	    fields[n++] = p;
+	}
+	if ( n < 11 )
+	    error("Bad format at line %"PRIu64" of %s.", lines, input);
+	struct probe_record r;
+	memset(&r, 0, sizeof(r));
+	r.cid = probe_writer_add_name(w, fields[0]);
+	r.start = atoi(fields[1]);
+	r.end = atoi(fields[2]);
+	r.length = atoi(fields[3]);
+	r.seq = fields[4];
+	r.n_block = atoi(fields[5]);
+	if ( strlen(r.seq) != r.length || parse_blocks(fields[6], r.starts) != r.n_block ||
+	     parse_blocks(fields[7], r.ends) != r.n_block )
+	    error("Bad format at line %"PRIu64" of %s.", lines, input);
+	r.repeat = (int)lrint(atof(fields[8]) * 100);
+	r.gc = (int)lrint(atof(fields[9]) * 100);
+	r.rank = atoi(fields[10]);
+	if ( n == 12 ) {
+	    r.extra = fields[11];
+	    r.l_extra = str.s + str.l - fields[11];
+	}
+	if ( probe_writer_push(w, &r) )
+	    error("Failed to convert line %"PRIu64" of %s.", lines, input);
+    }
+    probe_writer_set_header(w, header.s, header.l);
+    uint64_t n_records = probe_writer_records(w);
+    if ( probe_writer_close(w) )
+	error("Failed to write %s : %s.", output, strerror(errno));
+    bgzf_close(fp);
+    free(str.s);
+    free(header.s);
+    LOG_print("%"PRIu64" oligos converted.", n_records);
+    return 0;
+}
+
+static int binary_to_text(const char *input, const char *output)
+{
+    struct probe_file *pf = probe_file_open(input);
+    if ( pf == NULL )
+	return 1;
+    BGZF *fp = bgzf_open(output, "w");
+    if ( fp == NULL )
+	error("Failed to write %s : %s.", output, strerror(errno));
+    if ( pf->l_header && bgzf_write(fp, pf->header, pf->l_header) != pf->l_header )
+	error("Write error : %d.", fp->errcode);
+    kstring_t str = KSTRING_INIT;
+    struct probe_iter it;
+    struct probe_record r;
+    probe_iter_init(&it, pf);
+    while ( probe_iter_next(&it, &r) == 0 ) {
+	probe_record_format(pf, &r, &str);
+	if ( str.l > 1<<20 ) {
+	    if ( bgzf_write(fp, str.s, str.l) != str.l )
+		error("Write error : %d.", fp->errcode);
+	    str.l = 0;
+	}
+    }
+    if ( str.l && bgzf_write(fp, str.s, str.l) != str.l )
+	error("Write error : %d.", fp->errcode);
+    bgzf_close(fp);
+    probe_iter_destroy(&it);
+    free(str.s);
+    LOG_print("%"PRIu64" oligos converted.", pf->n_records);
+    probe_file_close(pf);
+    return 0;
+}
+
+// summary of columns, read from the mapped chunks without decoding records
+static int binary_stat(const char *input)
+{
+    struct probe_file *pf = probe_file_open(input);
+    if ( pf == NULL )
+	return 1;
+    uint64_t bases = 0, bubbles = 0, gc = 0, repeat = 0, rank[4] = { 0, 0, 0, 0 };
+    int i, j;
+    for ( i = 0; i < pf->n_chunks; ++i ) {
+	struct probe_chunk c;
+	probe_file_chunk(pf, i, &c);
+	bases += c.n_bases;
+	for ( j = 0; j < c.n; ++j ) {
+	    gc += c.gc[j];
+	    repeat += c.repeat[j];
+	    rank[c.rank[j] > 3 ? 3 : c.rank[j]]++;
+	    bubbles += (c.n_block[j] & ~PROBE_BLOCK_STORED) == 2;
+	}
+    }
+    uint64_t n = pf->n_records ? pf->n_records : 1;
+    fprintf(stdout, "Chromosomes : %d\n", pf->n_names);
+    fprintf(stdout, "Chunks : %d\n", pf->n_chunks);
+    fprintf(stdout, "Oligos : %"PRIu64"\n", pf->n_records);
+    fprintf(stdout, "Bases : %"PRIu64"\n", bases);
+    fprintf(stdout, "Bubble oligos : %"PRIu64"\n", bubbles);
+    fprintf(stdout, "Mean GC content : %.4f\n", (double)gc / n / 100);
+    fprintf(stdout, "Mean repeat ratio : %.4f\n", (double)repeat / n / 100);
+    fprintf(stdout, "Rank 0, 1, 2, 3+ : %"PRIu64", %"PRIu64", %"PRIu64", %"PRIu64"\n", rank[0], rank[1], rank[2], rank[3]);
+    probe_file_close(pf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *input_fname = 0;
+    const char *output_fname = 0;
+    int stat = 0;
+    int i;
+    for (i = 1; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	if ( strcmp(a, "-stat") == 0 ) {
+	    stat = 1;
+	    continue;
+	}
+	const char **var = 0;
+	if ( strcmp(a, "-i") == 0 && input_fname == 0 )
+	    var = &input_fname;
+	else if ( strcmp(a, "-o") == 0 && output_fname == 0 )
+	    var = &output_fname;
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return 1;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( input_fname == 0 || (output_fname == 0 && stat == 0) )
+	return usage();
+    int binary = probe_file_is_binary(input_fname);
+    if ( stat ) {
+	if ( binary == 0 )
+	    error("%s is not a binary probe file.", input_fname);
+	return binary_stat(input_fname);
+    }
+    return binary ? binary_to_text(input_fname, output_fname) : text_to_binary(input_fname, output_fname);
+}
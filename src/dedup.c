@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include "htslib/khash.h"
+#include "seq_utils.h"
+#include "dedup.h"
+
+// hashes of the window, each hash is in the ring buffer only once
+KHASH_SET_INIT_INT64(dedup)
+
+struct dedup *dedup_init(int window)
+{
+    struct dedup *d = (struct dedup*)calloc(1, sizeof(struct dedup));
+    d->window = window < 0 ? 0 : window;
+    if ( d->window )
+        d->ring = (uint64_t*)malloc(d->window * sizeof(uint64_t));
+    d->hash = kh_init(dedup);
+    return d;
+}
+
+void dedup_destroy(struct dedup *d)
+{
+    if ( d == NULL )
+        return;
+    kh_destroy(dedup, (khash_t(dedup)*)d->hash);
+    free(d->ring);
+    free(d);
+}
+
+uint64_t dedup_hash(const char *seq, int len)
+{
+    uint64_t h = len, x = 0;
+    int i;
+    for ( i = 0; i < len; ++i ) {
+        int c = seq_nt4_table[(unsigned char)seq[i]];
+        // ambiguous bases are mixed by their positions
+        if ( c > 3 ) {
+            h ^= hash64(i + 1, ~0ULL);
+            c = 0;
+        }
+        x = x << 2 | c;
+        if ( (i & 31) == 31 ) {
+            h = hash64(h ^ x, ~0ULL);
+            x = 0;
+        }
+    }
+    if ( len & 31 )
+        h = hash64(h ^ x, ~0ULL);
+    return h;
+}
+
+int dedup_check(struct dedup *d, const char *seq, int len)
+{
+    khash_t(dedup) *hash = (khash_t(dedup)*)d->hash;
+    uint64_t key = dedup_hash(seq, len);
+    int ret;
+    kh_put(dedup, hash, key, &ret);
+    if ( ret == 0 ) {
+        d->duplicates++;
+        return 1;
+    }
+    if ( d->window == 0 )
+        return 0;
+    // evict the oldest hash of the window
+    if ( d->n == d->window ) {
+        khint_t old = kh_get(dedup, hash, d->ring[d->i]);
+        if ( old != kh_end(hash) )
+            kh_del(dedup, hash, old);
+    } else {
+        d->n++;
+    }
+    d->ring[d->i] = key;
+    d->i = d->i + 1 == d->window ? 0 : d->i + 1;
+    return 0;
+}
@@ -0,0 +1,25 @@
+// dedup.h - drop exact duplicate oligos in stream. Sequences are packed in 2 bits and hashed to 64 bits, the hashes of
+// the last window oligos are kept in a hash set, since duplicates are usually close to each other. Set window to 0 to
+// keep all hashes, for merged panels.
+
+#ifndef DEDUP_HEADER
+#define DEDUP_HEADER
+#include <stdint.h>
+
+struct dedup {
+    int window;
+    // ring buffer of hashes in the window
+    int n, i;
+    uint64_t *ring;
+    void *hash;
+    uint64_t duplicates;
+};
+
+extern struct dedup *dedup_init(int window);
+extern void dedup_destroy(struct dedup *d);
+// hash of sequence, case insensitive
+extern uint64_t dedup_hash(const char *seq, int len);
+// return 1 if the sequence is a duplicate of one in the window, otherwise remember it and return 0
+extern int dedup_check(struct dedup *d, const char *seq, int len);
+
+#endif
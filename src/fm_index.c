@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "htslib/faidx.h"
+#include "utils.h"
+#include "seq_utils.h"
+#include "fm_index.h"
+
+struct fm_index_header {
+    char magic[8];
+    int32_t n_seqs;
+    int32_t sa_intv;
+    uint64_t n;
+    uint64_t primary;
+    uint64_t C[FM_SIGMA + 1];
+    // length of names block, padded to 64 bytes
+    uint64_t l_names;
+    uint64_t n_blocks;
+    uint64_t n_samples;
+};
+
+#define pad64(x) (((x) + 63) & ~(uint64_t)63)
+
+// SA-IS suffix array construction (Nong, Zhang and Chan 2009). The text at the top level is in bytes, and the reduced
+// texts of recursion are in int64_t.
+#define sais_chr(i) (cs == sizeof(int64_t) ? ((const int64_t*)T)[i] : ((const uint8_t*)T)[i])
+#define tget(i) ((t[(i)>>3] >> ((i)&7)) & 1)
+#define tset(i, b) (t[(i)>>3] = (b) ? (t[(i)>>3] | (1 << ((i)&7))) : (t[(i)>>3] & ~(1 << ((i)&7))))
+#define is_lms(i) ((i) > 0 && tget(i) && !tget((i)-1))
+
+static void sais_buckets(const void *T, int64_t *B, int64_t n, int64_t k, int cs, int end)
+{
+    int64_t i, sum = 0;
+    memset(B, 0, k * sizeof(int64_t));
+    for ( i = 0; i < n; ++i )
+	B[sais_chr(i)]++;
+    for ( i = 0; i < k; ++i ) {
+	sum += B[i];
+	B[i] = end ? sum : sum - B[i];
+    }
+}
+
+static void sais_induce(const void *T, int64_t *SA, const uint8_t *t, int64_t *B, int64_t n, int64_t k, int cs)
+{
+    int64_t i, j;
+    sais_buckets(T, B, n, k, cs, 0);
+    for ( i = 0; i < n; ++i ) {
+	j = SA[i] - 1;
+	if ( j >= 0 && !tget(j) )
+	    SA[B[sais_chr(j)]++] = j;
+    }
+    sais_buckets(T, B, n, k, cs, 1);
+    for ( i = n - 1; i >= 0; --i ) {
+	j = SA[i] - 1;
+	if ( j >= 0 && tget(j) )
+	    SA[--B[sais_chr(j)]] = j;
+    }
+}
+
+// the last symbol of T must be the unique smallest one
+static void sais_main(const void *T, int64_t *SA, int64_t n, int64_t k, int cs)
+{
+    int64_t i, j;
+    uint8_t *t = (uint8_t*)calloc(n / 8 + 1, 1);
+    int64_t *B = (int64_t*)malloc(k * sizeof(int64_t));
+    check_mem(t);
+    check_mem(B);
+    tset(n - 1, 1);
+    if ( n > 1 )
+	tset(n - 2, 0);
+    for ( i = n - 3; i >= 0; --i )
+	tset(i, sais_chr(i) < sais_chr(i+1) || (sais_chr(i) == sais_chr(i+1) && tget(i+1)));
+
+    // sort LMS substrings
+    sais_buckets(T, B, n, k, cs, 1);
+    for ( i = 0; i < n; ++i )
+	SA[i] = -1;
+    for ( i = 1; i < n; ++i )
+	if ( is_lms(i) )
+	    SA[--B[sais_chr(i)]] = i;
+    sais_induce(T, SA, t, B, n, k, cs);
+
+    // compact sorted LMS substrings and name them
+    int64_t n1 = 0;
+    for ( i = 0; i < n; ++i )
+	if ( is_lms(SA[i]) )
+	    SA[n1++] = SA[i];
+    for ( i = n1; i < n; ++i )
+	SA[i] = -1;
+    int64_t name = 0, prev = -1;
+    for ( i = 0; i < n1; ++i ) {
+	int64_t pos = SA[i], d;
+	int diff = 0;
+	for ( d = 0; d < n; ++d ) {
+	    if ( prev == -1 || sais_chr(pos+d) != sais_chr(prev+d) || tget(pos+d) != tget(prev+d) ) {
+		diff = 1;
+		break;
+	    } else if ( d > 0 && (is_lms(pos+d) || is_lms(prev+d)) ) {
+		break;
+	    }
+	}
+	if ( diff ) {
+	    name++;
+	    prev = pos;
+	}
+	SA[n1 + pos/2] = name - 1;
+    }
+    for ( i = n - 1, j = n - 1; i >= n1; --i )
+	if ( SA[i] >= 0 )
+	    SA[j--] = SA[i];
+
+    // sort the reduced text
+    int64_t *SA1 = SA, *s1 = SA + n - n1;
+    if ( name < n1 ) {
+	sais_main(s1, SA1, n1, name, sizeof(int64_t));
+    } else {
+	for ( i = 0; i < n1; ++i )
+	    SA1[s1[i]] = i;
+    }
+
+    // induce the suffix array from sorted LMS suffixes
+    sais_buckets(T, B, n, k, cs, 1);
+    for ( i = 1, j = 0; i < n; ++i )
+	if ( is_lms(i) )
+	    s1[j++] = i;
+    for ( i = 0; i < n1; ++i )
+	SA1[i] = s1[SA1[i]];
+    for ( i = n1; i < n; ++i )
+	SA[i] = -1;
+    for ( i = n1 - 1; i >= 0; --i ) {
+	j = SA[i];
+	SA[i] = -1;
+	SA[--B[sais_chr(j)]] = j;
+    }
+    sais_induce(T, SA, t, B, n, k, cs);
+    free(B);
+    free(t);
+}
+
+static inline int fm_code(int c)
+{
+    int x = seq_nt4_table[c];
+    return x > 3 ? FM_N : x + 1;
+}
+
+static const char zeros[64] = { 0 };
+
+static void write_block(FILE *fp, const void *data, uint64_t size, const char *fname)
+{
+    if ( size && fwrite(data, 1, size, fp) != size )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    if ( pad64(size) > size && fwrite(zeros, 1, pad64(size) - size, fp) != pad64(size) - size )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+}
+
+int fm_index_build(const char *fasta_fname, int sa_intv, const char *fname)
+{
+    faidx_t *fai = fai_load(fasta_fname);
+    if ( fai == NULL ) {
+	if ( fai_build(fasta_fname) == -1 )
+	    error("Failed to build the index of %s.", fasta_fname);
+	fai = fai_load(fasta_fname);
+    }
+    struct fm_index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FM_INDEX_MAGIC, sizeof(FM_INDEX_MAGIC));
+    h.n_seqs = faidx_nseq(fai);
+    h.sa_intv = sa_intv;
+
+    int i;
+    uint64_t *lengths = (uint64_t*)malloc(h.n_seqs * sizeof(uint64_t));
+    uint64_t *text_offsets = (uint64_t*)malloc(h.n_seqs * sizeof(uint64_t));
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	lengths[i] = faidx_seq_len(fai, name);
+	text_offsets[i] = h.n;
+	// forward and reverse complement strands, each followed by a separator
+	h.n += 2 * (lengths[i] + 1);
+	h.l_names += strlen(name) + 1;
+    }
+    h.n++;
+    uint8_t *text = (uint8_t*)malloc(h.n);
+    check_mem(text);
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	int j, l = 0;
+	char *seq = faidx_fetch_seq(fai, name, 0, lengths[i] - 1, &l);
+	if ( seq == NULL || l != lengths[i] )
+	    error("Failed to fetch %s.", name);
+	uint8_t *fwd = text + text_offsets[i];
+	uint8_t *rev = fwd + l + 1;
+	for ( j = 0; j < l; ++j ) {
+	    int c = fm_code((unsigned char)seq[j]);
+	    fwd[j] = c;
+	    rev[l-1-j] = c == FM_N ? FM_N : 5 - c;
+	}
+	fwd[l] = rev[l] = FM_N;
+	free(seq);
+    }
+    text[h.n-1] = FM_SENTINEL;
+
+    int64_t *SA = (int64_t*)malloc(h.n * sizeof(int64_t));
+    check_mem(SA);
+    sais_main(text, SA, h.n, FM_SIGMA, 1);
+
+    uint64_t j;
+    for ( j = 0; j < h.n; ++j )
+	h.C[text[j]+1]++;
+    for ( i = 1; i <= FM_SIGMA; ++i )
+	h.C[i] += h.C[i-1];
+
+    h.n_blocks = h.n / 64 + 1;
+    h.n_samples = (h.n + sa_intv - 1) / sa_intv;
+    struct fm_block *blocks = (struct fm_block*)calloc(h.n_blocks, sizeof(struct fm_block));
+    uint64_t *samples = (uint64_t*)malloc(h.n_samples * sizeof(uint64_t));
+    check_mem(blocks);
+    check_mem(samples);
+    uint64_t occ[5] = { 0, 0, 0, 0, 0 };
+    for ( j = 0; j < h.n; ++j ) {
+	struct fm_block *b = &blocks[j>>6];
+	if ( (j & 63) == 0 )
+	    memcpy(b->occ, occ, sizeof(occ));
+	int c;
+	if ( SA[j] == 0 ) {
+	    h.primary = j;
+	    c = FM_SENTINEL;
+	} else {
+	    c = text[SA[j]-1];
+	}
+	if ( c ) {
+	    occ[c-1]++;
+	    int p;
+	    for ( p = 0; p < 3; ++p )
+		if ( c >> p & 1 )
+		    b->bits[p] |= 1ULL << (j & 63);
+	}
+	if ( j % sa_intv == 0 )
+	    samples[j / sa_intv] = SA[j];
+    }
+    if ( (h.n & 63) == 0 )
+	memcpy(blocks[h.n>>6].occ, occ, sizeof(occ));
+    free(SA);
+    free(text);
+
+    FILE *fp = fopen(fname, "wb");
+    if ( fp == NULL )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    h.l_names = pad64(h.l_names);
+    write_block(fp, &h, sizeof(h), fname);
+    uint64_t l_names = 0;
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	if ( fwrite(name, 1, strlen(name) + 1, fp) != strlen(name) + 1 )
+	    error("Failed to write %s : %s.", fname, strerror(errno));
+	l_names += strlen(name) + 1;
+    }
+    if ( h.l_names > l_names && fwrite(zeros, 1, h.l_names - l_names, fp) != h.l_names - l_names )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    write_block(fp, lengths, h.n_seqs * sizeof(uint64_t), fname);
+    write_block(fp, text_offsets, h.n_seqs * sizeof(uint64_t), fname);
+    write_block(fp, blocks, h.n_blocks * sizeof(struct fm_block), fname);
+    write_block(fp, samples, h.n_samples * sizeof(uint64_t), fname);
+    fclose(fp);
+
+    free(blocks);
+    free(samples);
+    free(lengths);
+    free(text_offsets);
+    fai_destroy(fai);
+    return 0;
+}
+
+struct fm_index *fm_index_load(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if ( fd == -1 ) {
+	error_print("Failed to open %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    struct stat s;
+    if ( fstat(fd, &s) != 0 || s.st_size < sizeof(struct fm_index_header) ) {
+	error_print("Failed to load index %s.", fname);
+	close(fd);
+	return NULL;
+    }
+    void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+	error_print("Failed to map %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    const struct fm_index_header *h = (const struct fm_index_header*)map;
+    if ( memcmp(h->magic, FM_INDEX_MAGIC, sizeof(FM_INDEX_MAGIC)) != 0 ) {
+	error_print("%s is not a FM-index.", fname);
+	munmap(map, s.st_size);
+	return NULL;
+    }
+    struct fm_index *idx = (struct fm_index*)calloc(1, sizeof(struct fm_index));
+    idx->map = map;
+    idx->map_size = s.st_size;
+    idx->n_seqs = h->n_seqs;
+    idx->sa_intv = h->sa_intv;
+    idx->n = h->n;
+    idx->primary = h->primary;
+    memcpy(idx->C, h->C, sizeof(idx->C));
+
+    const uint8_t *p = (const uint8_t*)map + pad64(sizeof(*h));
+    const char *names = (const char*)p;
+    p += h->l_names;
+    idx->lengths = (const uint64_t*)p;
+    p += pad64(h->n_seqs * sizeof(uint64_t));
+    idx->text_offsets = (const uint64_t*)p;
+    p += pad64(h->n_seqs * sizeof(uint64_t));
+    idx->blocks = (const struct fm_block*)p;
+    p += pad64(h->n_blocks * sizeof(struct fm_block));
+    idx->samples = (const uint64_t*)p;
+    if ( (const uint8_t*)(idx->samples + h->n_samples) > (const uint8_t*)map + s.st_size )
+	error("Truncated index %s.", fname);
+
+    idx->names = (const char**)malloc(idx->n_seqs * sizeof(char*));
+    int i;
+    for ( i = 0; i < idx->n_seqs; ++i ) {
+	idx->names[i] = names;
+	names += strlen(names) + 1;
+    }
+    return idx;
+}
+
+void fm_index_destroy(struct fm_index *idx)
+{
+    if ( idx == NULL )
+	return;
+    free(idx->names);
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+// occurrences of symbol c (A,C,G,T or N) in BWT[0,i)
+static inline uint64_t fm_occ(const struct fm_index *idx, int c, uint64_t i)
+{
+    const struct fm_block *b = &idx->blocks[i>>6];
+    int r = i & 63;
+    if ( r == 0 )
+	return b->occ[c-1];
+    uint64_t m = ~0ULL >> (64 - r);
+    m &= c & 1 ? b->bits[0] : ~b->bits[0];
+    m &= c & 2 ? b->bits[1] : ~b->bits[1];
+    m &= c & 4 ? b->bits[2] : ~b->bits[2];
+    return b->occ[c-1] + __builtin_popcountll(m);
+}
+
+static inline int fm_bwt(const struct fm_index *idx, uint64_t i)
+{
+    const struct fm_block *b = &idx->blocks[i>>6];
+    int r = i & 63;
+    return (b->bits[0] >> r & 1) | (b->bits[1] >> r & 1) << 1 | (b->bits[2] >> r & 1) << 2;
+}
+
+uint64_t fm_index_count(const struct fm_index *idx, const char *seq, int len)
+{
+    uint64_t l = 0, r = idx->n;
+    int i;
+    for ( i = len - 1; i >= 0 && l < r; --i ) {
+	int c = fm_code((unsigned char)seq[i]);
+	if ( c == FM_N )
+	    return 0;
+	l = idx->C[c] + fm_occ(idx, c, l);
+	r = idx->C[c] + fm_occ(idx, c, r);
+    }
+    return l < r ? r - l : 0;
+}
+
+uint64_t fm_index_locate(const struct fm_index *idx, uint64_t row)
+{
+    uint64_t steps = 0;
+    while ( row % idx->sa_intv ) {
+	int c = fm_bwt(idx, row);
+	if ( c == FM_SENTINEL )
+	    return steps;
+	row = idx->C[c] + fm_occ(idx, c, row);
+	steps++;
+    }
+    return idx->samples[row / idx->sa_intv] + steps;
+}
+
+int fm_index_text2pos(const struct fm_index *idx, uint64_t offset, uint64_t *pos, int *strand)
+{
+    int lo = 0, hi = idx->n_seqs;
+    while ( lo + 1 < hi ) {
+	int mid = (lo + hi) / 2;
+	if ( idx->text_offsets[mid] <= offset ) lo = mid;
+	else hi = mid;
+    }
+    uint64_t x = offset - idx->text_offsets[lo];
+    uint64_t l = idx->lengths[lo];
+    if ( x < l ) {
+	*pos = x;
+	*strand = 0;
+    } else if ( x > l && x < 2 * l + 1 ) {
+	*pos = 2 * l - x;
+	*strand = 1;
+    } else {
+	return -1;
+    }
+    return lo;
+}
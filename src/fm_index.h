@@ -0,0 +1,56 @@
+// fm_index.h - FM-index of reference genome and its reverse complement, used to count exact occurrences of oligo
+// seeds.
+//
+// The BWT is kept in blocks of 64 symbols, each block takes one cache line: cumulative occurrences of A,C,G,T,N before
+// the block followed by three bit planes of the symbols. Every sa_intv-th suffix array entry is sampled for locating.
+// The index is built by build_fm_index and mapped into memory by fm_index_load().
+
+#ifndef FM_INDEX_HEADER
+#define FM_INDEX_HEADER
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define FM_INDEX_MAGIC "FMIX\1"
+
+// symbols of the text, N and the separators of sequences are the same symbol
+#define FM_SENTINEL 0
+#define FM_N 5
+#define FM_SIGMA 6
+
+struct fm_block {
+    uint64_t occ[5];
+    uint64_t bits[3];
+};
+
+struct fm_index {
+    int n_seqs;
+    int sa_intv;
+    const char **names;
+    // lengths of sequences
+    const uint64_t *lengths;
+    // start of each sequence in the text, the forward strand is followed by reverse complement
+    const uint64_t *text_offsets;
+    // length of text, including the sentinel
+    uint64_t n;
+    // row of the sentinel in BWT
+    uint64_t primary;
+    uint64_t C[FM_SIGMA + 1];
+    const struct fm_block *blocks;
+    const uint64_t *samples;
+    void *map;
+    size_t map_size;
+};
+
+extern int fm_index_build(const char *fasta_fname, int sa_intv, const char *fname);
+extern struct fm_index *fm_index_load(const char *fname);
+extern void fm_index_destroy(struct fm_index *idx);
+
+// count exact occurrences of seq on both strands, 0 if seq contains bases other than A,C,G,T
+extern uint64_t fm_index_count(const struct fm_index *idx, const char *seq, int len);
+// locate the text offset of a row of suffix array
+extern uint64_t fm_index_locate(const struct fm_index *idx, uint64_t row);
+// convert text offset to sequence id and position of forward strand, return -1 for separators
+extern int fm_index_text2pos(const struct fm_index *idx, uint64_t offset, uint64_t *pos, int *strand);
+
+#endif
@@ -6,13 +6,33 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <math.h>
+#include <limits.h>
 #include "htslib/kstring.h"
 #include "htslib/khash.h"
 #include "htslib/faidx.h"
 #include "htslib/kseq.h"
+#include "htslib/vcf.h"
+#include "htslib/tbx.h"
+#include "htslib/ksort.h"
+#include "cram/thread_pool.h"
 #include "utils.h"
 #include "number.h"
 #include "bed_utils.h"
+#include "seq_utils.h"
+#include "mini_index.h"
+#include "fm_index.h"
+#include "thermo.h"
+#include "secondary.h"
+#include "profile.h"
+#include "set_cover.h"
+#include "dedup.h"
+#include "variants.h"
+#include "probe_binary.h"
+#include "probe_shard.h"
+#include "run_stats.h"
+#include "trace.h"
+#include "probe_format.h"
 #include "version.h"
 
 //#define ROUND_SIZE  100
@@ -21,6 +41,85 @@
 #ifndef KSTRING_INIT
 #define KSTRING_INIT { 0, 0, 0 }
 #endif
+
+// designed oligo, cached in the batch for screening before export
+struct oligo {
+    int cid;
+    int start;
+    int end;
+    int length;
+    int n_block;
+    int starts[2];
+    int ends[2];
+    float repeat;
+    float gc;
+    float tm;
+    float dg;
+    int rank;
+    // genome loci similar to this oligo, -1 for unscreened
+    int off_target;
+    // max occurrences of seeds in the genome, -1 for unscreened
+    int64_t seed_occ;
+    int homopolymer;
+    // common variant sites in the oligo and in its central half
+    int variants;
+    int central_variants;
+    // composite score, only calculated with -score
+    float score;
+    // longest stems of hairpin and self-dimer, -1 for unscreened
+    int hairpin;
+    int dimer;
+    // reasons of rejection by screening, rejected oligos are not exported
+    int rejected;
+    // offset of sequence in the batch
+    int seq_offset;
+    // offset of allele tag in the batch, -1 for no tag
+    int tag_offset;
+};
+
+#define REJECT_SEED     1
+#define REJECT_HAIRPIN  2
+#define REJECT_DIMER    4
+#define REJECT_OFFTARGET 8
+#define REJECT_TYPES    4
+
+#define OLIGO_BATCH_SIZE 4096
+
+struct oligo_batch {
+    int n, m;
+    struct oligo *a;
+    kstring_t seq;
+};
+
+#define OLIGO_BATCH_INIT { 0, 0, 0, KSTRING_INIT }
+
+// screen a slice of batch in the thread pool, query buffers are kept between batches
+struct screen_job {
+    int beg;
+    int end;
+    struct mini_query_buf buf;
+};
+
+// state of tile selection, the best chain of candidates ends at this candidate
+struct tile_state {
+    // bases left uncovered by the chain, candidates out of spec may break it
+    int uncovered;
+    int count;
+    float score;
+    int prev;
+    // candidate is in spec
+    int valid;
+    float window_score;
+};
+
+// design region of set cover mode, candidates [first, last) are windows of it
+struct cover_region {
+    int start;
+    int end;
+    int first;
+    int last;
+};
+
 struct args {
     // species reference genome, retrieve oligos from this reference
     const char *fasta_fname;
@@ -43,9 +142,14 @@ struct args {
     int oligo_length;
     // temp parameters for dynamic design mode
     int min_oligo_length;
-    uint64_t n_min;
     int max_oligo_length;
-    uint64_t n_max;
+    // number of exported oligos of each length
+    uint64_t *length_hist;
+    // target windows of Tm and GC ratio for dynamic design mode, pick the length of each oligo closest to them
+    int target_tm;
+    float tm_range[2];
+    int target_gc;
+    float gc_range[2];
 
     // round size to limit smallest region
     int ROUND_SIZE;
@@ -58,6 +162,34 @@ struct args {
     struct bedaux *design_regions;
     // prediction captured regions
     struct bedaux *predict_regions;
+    // names of chromosomes indexed by cid, from design regions or header of target VCF
+    char **chrom_names;
+    int n_chroms;
+    // allele-specific design of target VCF, reference is fetched in chunks and oligos are tagged by variant
+    const char *vcf_fname;
+    htsFile *vcf_fp;
+    bcf_hdr_t *vcf_hdr;
+    bcf1_t *vcf_rec;
+    char *vcf_chunk;
+    int vcf_chunk_rid;
+    int vcf_chunk_start;
+    int vcf_chunk_l;
+    kstring_t allele_seq;
+    kstring_t allele_tag;
+    // chunk of reference around the regions in design, served by fetch_region()
+    char *ref_chunk;
+    int ref_chunk_cid;
+    int ref_chunk_len;
+    int ref_chunk_start;
+    int ref_chunk_l;
+    uint32_t ref_chunks;
+    // scratch of the design loop, bases of current region and current window, reused so the steady state does not
+    // allocate
+    kstring_t region_seq;
+    kstring_t window;
+    const char *tag;
+    uint32_t site_number;
+    uint32_t skipped_sites;
     // required a uniq database, data_required == 0 if uniq_bed_fname and tolerant_bed_fname are empty
     int data_required;
     int variants_skip_required;
@@ -65,6 +197,14 @@ struct args {
     int gap_size;
     // oligo coverage 
     float depth;
+    // fit the design into a budget of oligos by scaling the depth of each design region, -depth is the cap
+    int max_oligos;
+    int budget_weight;
+    float depth_cap;
+    float *region_depth;
+    int i_region;
+    double planned_oligos;
+    float planned_depth[2];
     // Memory cache for output probes
     kstring_t string;
     // last chromosome id, default is -1
@@ -75,11 +215,117 @@ struct args {
     int last_end;
     // last region designed or not
     int last_is_empty;
+    // depth of last region
+    float last_depth;
     // current line cache
     struct bed_line line;
     faidx_t *fai;
     kstring_t commands;
     uint32_t probes_number;
+    // oligos wait for screening and export
+    struct oligo_batch batch;
+    int n_threads;
+    t_pool *pool;
+    t_results_queue *results;
+    struct screen_job *jobs;
+    // minimizer index for off-target screening
+    const char *offtarget_fname;
+    struct mini_index *offtarget;
+    struct mini_query_opts offtarget_opts;
+    // sequence id in the index of each chromosome, -2 for unchecked
+    int *offtarget_ids;
+    // FM-index for seed occurrence counting
+    const char *fm_fname;
+    struct fm_index *fm;
+    int seed_length;
+    // reject oligos with any seed occurs more than this times, 0 for no rejection
+    int64_t max_seed_occ;
+    // screen hairpin and self-dimer, reject oligos with longer stems than max_hairpin or max_dimer if not negative
+    int secondary;
+    int max_hairpin;
+    int max_dimer;
+    // rejected oligos of each reason
+    uint32_t rejected_number[REJECT_TYPES];
+    // filter and scoring stage, candidates out of spec are dropped before they are pushed to the batch
+    int filter;
+    int filter_gc;
+    float gc_limit[2];
+    float max_repeat;
+    int max_homopolymer;
+    int filter_tm;
+    float tm_limit[2];
+    int max_offtarget;
+    // common variant sites, tiled oligos are shifted by up to variant_shift bases to avoid them
+    struct variant_sites *variants;
+    int variant_shift;
+    int max_variants;
+    uint32_t shifted_number;
+    uint32_t variant_number;
+    uint32_t filtered_number;
+    // export composite score, weights of GC, repeat, homopolymer, Tm and off-target penalties
+    int score;
+    float score_weights[6];
+    // composition profile of current design region
+    struct region_profile region;
+    // score candidates at every dense_step bases and select tiles by dynamic programming, 0 for fixed tiling
+    int dense_step;
+    int m_tiles;
+    struct tile_state *tiles;
+    int *deque;
+    // select candidates of each chromosome by greedy set cover, candidates cover fragment_size bases around them
+    int set_cover;
+    int fragment_size;
+    struct set_cover cover;
+    int cover_cid;
+    int cover_last;
+    int n_cover_regions, m_cover_regions;
+    struct cover_region *cover_regions;
+    uint64_t cover_candidates;
+    uint64_t uncovered_bases;
+    // drop exact duplicate oligos in the last dedup_window oligos, or all oligos in global mode
+    int dedup_window;
+    int dedup_global;
+    struct dedup *dedup;
+    // export probes in binary columnar format instead of text
+    int binary;
+    struct probe_writer *probe_writer;
+    // probes.txt.gz is written in BGZF shards with more than one thread
+    struct probe_shards *shards;
+    // export coordinates only, sequences are filled back from the reference by materialize
+    int no_sequence;
+    // screened oligos wait here and are exported in coordinate order, oligos pushed later never start before the
+    // frontier, so oligos before it are ready
+    struct oligo_batch pending;
+    int frontier_cid;
+    int frontier_pos;
+    BGZF *fp;
+    // tabix (or csi for long contigs) index of probe file, built in the write pass
+    hts_idx_t *idx;
+    int idx_fmt;
+    struct probe_format format;
+    // export Tm and dG of oligos
+    int tm;
+    struct thermo_opts thermo_opts;
+    // thermo profile of current design region
+    struct thermo_profile profile;
+    // report of stage timers and counters, see run_stats.h
+    const char *stats_fname;
+    // timeline of spans in Chrome trace event JSON, see trace.h. -debug traces to trace.json of output directory
+    const char *trace_fname;
+    kstring_t trace_path;
+    uint64_t regions_number;
+    uint64_t candidates_number;
+    // windows scored by dense tiling or set cover
+    uint64_t scored_windows;
+    uint64_t dropped_n;
+    uint64_t dropped_length;
+    uint64_t bubbles_number;
+    uint64_t fetched_bytes;
+    uint64_t formatted_bytes;
+    uint64_t written_bytes;
+    // ends of formatted lines in string, compressed after a batch is formatted
+    int m_line_ends;
+    int *line_ends;
 };
 
 struct args args = {
@@ -94,16 +340,48 @@ struct args args = {
     .output_dir = 0,
     .oligo_length = 50,
     .min_oligo_length = 0,
-    .n_min = 0,
     .max_oligo_length = 0,
-    .n_max = 0,
+    .length_hist = 0,
+    .target_tm = 0,
+    .target_gc = 0,
     .ROUND_SIZE = 100,
     .target_regions = 0,
     .design_regions = 0,
+    .chrom_names = 0,
+    .n_chroms = 0,
+    .vcf_fname = 0,
+    .vcf_fp = 0,
+    .vcf_hdr = 0,
+    .vcf_rec = 0,
+    .vcf_chunk = 0,
+    .vcf_chunk_rid = -1,
+    .vcf_chunk_start = 0,
+    .vcf_chunk_l = 0,
+    .allele_seq = KSTRING_INIT,
+    .allele_tag = KSTRING_INIT,
+    .ref_chunk = 0,
+    .ref_chunk_cid = -1,
+    .ref_chunk_len = 0,
+    .ref_chunk_start = 0,
+    .ref_chunk_l = 0,
+    .ref_chunks = 0,
+    .region_seq = KSTRING_INIT,
+    .window = KSTRING_INIT,
+    .tag = 0,
+    .site_number = 0,
+    .skipped_sites = 0,
     //.uniq_data_tbx = 0,
     .gap_size = 200,
     .must_design = 0,
     .depth = 2,
+    .max_oligos = 0,
+    .budget_weight = 0,
+    .depth_cap = 2,
+    .region_depth = 0,
+    .i_region = 0,
+    .planned_oligos = 0,
+    .planned_depth = { 0, 0 },
+    .last_depth = 2,
     .last_chrom_id = -1,
     .last_start = 0,
     .last_end = 0,
@@ -113,6 +391,82 @@ struct args args = {
     .commands = KSTRING_INIT,
     .fai = 0,
     .probes_number = 0,
+    .batch = OLIGO_BATCH_INIT,
+    .n_threads = 1,
+    .pool = 0,
+    .results = 0,
+    .jobs = 0,
+    .offtarget_fname = 0,
+    .offtarget = 0,
+    .offtarget_opts = { 3, 0, 1000 },
+    .offtarget_ids = 0,
+    .fm_fname = 0,
+    .fm = 0,
+    .seed_length = 20,
+    .max_seed_occ = 0,
+    .secondary = 0,
+    .max_hairpin = -1,
+    .max_dimer = -1,
+    .rejected_number = { 0, 0, 0, 0 },
+    .filter = 0,
+    .filter_gc = 0,
+    .max_repeat = -1,
+    .max_homopolymer = -1,
+    .filter_tm = 0,
+    .max_offtarget = -1,
+    .variants = 0,
+    .variant_shift = -1,
+    .max_variants = -1,
+    .shifted_number = 0,
+    .variant_number = 0,
+    .filtered_number = 0,
+    .score = 0,
+    .score_weights = { 1, 1, 1, 1, 1, 1 },
+    .region = REGION_PROFILE_INIT,
+    .dense_step = 0,
+    .m_tiles = 0,
+    .tiles = 0,
+    .deque = 0,
+    .set_cover = 0,
+    .fragment_size = 0,
+    .cover = SET_COVER_INIT,
+    .cover_cid = -1,
+    .cover_last = INT_MIN,
+    .n_cover_regions = 0,
+    .m_cover_regions = 0,
+    .cover_regions = 0,
+    .cover_candidates = 0,
+    .uncovered_bases = 0,
+    .dedup_window = 4096,
+    .dedup_global = 0,
+    .dedup = 0,
+    .binary = 0,
+    .probe_writer = 0,
+    .shards = 0,
+    .no_sequence = 0,
+    .pending = OLIGO_BATCH_INIT,
+    .frontier_cid = -1,
+    .frontier_pos = 0,
+    .fp = 0,
+    .idx = 0,
+    .idx_fmt = HTS_FMT_TBI,
+    .format = PROBE_FORMAT_INIT,
+    .tm = 0,
+    .profile = THERMO_PROFILE_INIT,
+    .stats_fname = 0,
+    .trace_fname = 0,
+    .trace_path = KSTRING_INIT,
+    .regions_number = 0,
+    .candidates_number = 0,
+    .scored_windows = 0,
+    .dropped_n = 0,
+    .dropped_length = 0,
+    .bubbles_number = 0,
+    .fetched_bytes = 0,
+    .formatted_bytes = 0,
+    .written_bytes = 0,
+    .m_line_ends = 0,
+    .line_ends = 0,
 };
 
 static int oligo_length_minimal = 50;
@@ -170,6 +524,8 @@ int usage()
 	    "            reference genome sequences, in fasta format.\n"
 	    "  -t, -target [bed file]\n"
 	    "            target bed file to design.\n"
+	    "  -vcf [vcf file]\n"
+	    "            target variants to design reference and alternate allele oligos, instead of target bed file.\n"
 	    "  -o, -outdir [dir]\n"
 	    "            output directary, will create it if not exists.\n"
 	    "  -u, -database [tabix-indexed bed file]\n"
@@ -180,6 +536,10 @@ int usage()
             "            minimal oligo length for dynamic design mode\n"
             "  -max INT \n"
             "            maximal oligo length for dynamic design mode\n"
+            "  -target_tm FLOAT[,FLOAT]\n"
+            "            target Tm window for dynamic design mode, the length of each oligo is picked to get Tm closest to it.\n"
+            "  -target_gc FLOAT[,FLOAT]\n"
+            "            target GC ratio window for dynamic design mode, like -target_tm.\n"
 	    "  -d, -depth [2]\n"
 	    "            oligo depths pre base, increase this value will increase the dense of oligos.\n"
 	    "  -p, -project [string]\n"
@@ -188,6 +548,82 @@ int usage()
             "            smallest limitation of a designed region. All small regions will round to this size.\n"
 	    "  -must_design\n"
 	    "            if no uniq regions around small target, must design it no matter repeat regions.\n"
+	    "  -offtarget [index]\n"
+	    "            minimizer index built by build_mini_index, count off-target loci of each oligo.\n"
+	    "  -offtarget_diff [3]\n"
+	    "            max mismatches of an off-target locus.\n"
+	    "  -offtarget_edit\n"
+	    "            count edits (mismatches and indels) instead of mismatches for off-target loci.\n"
+	    "  -offtarget_max_occ [1000]\n"
+	    "            skip minimizers occur more than this times, oligos with skipped minimizers report at least this value.\n"
+	    "  -fm_index [index]\n"
+	    "            FM-index built by build_fm_index, count genome occurrences of seeds of each oligo.\n"
+	    "  -seed_length [20]\n"
+	    "            length of seeds, oligos are split into non-overlapped seeds.\n"
+	    "  -max_seed_occ INT\n"
+	    "            reject oligos with any seed occurs more than INT times in the genome (both strands).\n"
+	    "  -secondary\n"
+	    "            export the longest stems of hairpin and self-dimer of oligos.\n"
+	    "  -max_hairpin INT\n"
+	    "            reject oligos with hairpin stem longer than INT bases, imply -secondary.\n"
+	    "  -max_dimer INT\n"
+	    "            reject oligos with self-dimer stretch longer than INT bases, imply -secondary.\n"
+	    "  -gc_range FLOAT,FLOAT\n"
+	    "            drop candidates with GC ratio out of this range.\n"
+	    "  -max_repeat FLOAT\n"
+	    "            drop candidates with higher ratio of soft-masked bases.\n"
+	    "  -max_homopolymer INT\n"
+	    "            drop candidates with longer homopolymer.\n"
+	    "  -tm_range FLOAT,FLOAT\n"
+	    "            drop candidates with Tm out of this range.\n"
+	    "  -max_offtarget INT\n"
+	    "            reject oligos with more off-target loci, require -offtarget.\n"
+	    "  -score\n"
+	    "            export composite score of oligos, and rank oligos by the score.\n"
+	    "  -score_weights [1,1,1,1,1,1]\n"
+	    "            weights of GC, repeat, homopolymer, Tm, off-target and variant penalties of the score.\n"
+	    "  -variants [indexed vcf/bcf]\n"
+	    "            common variant sites, like dbSNP common or gnomAD, tiled oligos are shifted to avoid them.\n"
+	    "  -variant_shift INT\n"
+	    "            max shift of tiled oligos to avoid variant sites, default is 1/4 of the tiling step.\n"
+	    "  -max_variants INT\n"
+	    "            drop candidates with more variant sites.\n"
+	    "  -dense INT\n"
+	    "            score candidates at every INT bases and select the fewest tiles meeting the depth with best total\n"
+	    "            score, instead of fixed tiling positions. Every base of region, the edges included, is covered at\n"
+	    "            the depth. The step is at most oligo length / depth.\n"
+	    "  -max_oligos INT\n"
+	    "            budget of oligos, the depth of each region is scaled to fit the budget, and capped by -depth.\n"
+	    "  -budget_weight\n"
+	    "            weight the depth of each region by the score column (5th) of target bed file.\n"
+	    "  -set_cover\n"
+	    "            select oligos of each chromosome by greedy set cover, the fewest oligos covering every target base\n"
+	    "            at the depth. Candidates are windows at every base, or every -dense bases.\n"
+	    "  -fragment_size INT\n"
+	    "            expected fragment size, each oligo of set cover covers INT bases around it, default is oligo length.\n"
+	    "  -dedup_window INT\n"
+	    "            drop exact duplicate oligos within last INT oligos, set 0 to keep duplicates. default is 4096.\n"
+	    "  -dedup_global\n"
+	    "            drop exact duplicate oligos of the whole panel.\n"
+	    "  -binary\n"
+	    "            export probes.bin in binary columnar format instead of probes.txt.gz, see convert_probes.\n"
+	    "  -no_sequence\n"
+	    "            export coordinates only, with checksums of the reference in header, see materialize.\n"
+	    "  -tm\n"
+	    "            export melting temperature and free energy of oligos, by nearest-neighbor model.\n"
+	    "  -na [50]\n"
+	    "            Na+ concentration (mM) for Tm calculation.\n"
+	    "  -mg [0]\n"
+	    "            Mg2+ concentration (mM) for Tm calculation.\n"
+	    "  -oligo_conc [250]\n"
+	    "            oligo concentration (nM) for Tm calculation.\n"
+	    "  -threads [1]\n"
+	    "            threads used to screen oligos and compress probes.\n"
+	    "  -stats FILE\n"
+	    "            export wall and CPU time of stages, counters and peak memory in JSON.\n"
+	    "  -trace FILE\n"
+	    "            export the timeline of region design, fetch, database query, screening and compress spans of each\n"
+	    "            thread in Chrome trace event JSON, open it in chrome://tracing or Perfetto.\n"
 	    "  -h, -help\n"
 	    "            for help information.\n"
 	    "Version: %s\n"
@@ -199,6 +635,184 @@ int usage()
 // quiet mode, 0 for default, will export logs
 static int quiet_mode = 0;
 
+// parse window like 65,75 or a single value
+static int parse_range(const char *s, float *range)
+{
+    int n = sscanf(s, "%f,%f", &range[0], &range[1]);
+    if ( n < 1 )
+        return 1;
+    if ( n == 1 )
+        range[1] = range[0];
+    if ( range[0] > range[1] ) {
+        float t = range[0];
+        range[0] = range[1];
+        range[1] = t;
+    }
+    return 0;
+}
+// estimated oligos of a design region at depth, follow the tiling of titling_design(), short regions are designed by
+// bubble or must design with depth oligos. set cover usually needs a few more oligos to reach the depth at both ends
+static inline double estimate_oligos(int length, float depth)
+{
+    int oligo_length = args.oligo_length == 0 ?
+        length < SMALL_REGION ? oligo_length_minimal : oligo_length_maxmal
+        : args.oligo_length;
+    // set cover demands integer depth
+    if ( args.set_cover )
+        depth = depth < 1.5 ? 1 : (int)(depth + 0.5);
+    if ( length < oligo_length )
+        return ceil(depth);
+    return ceil((double)length / oligo_length * depth);
+}
+struct budget_weight {
+    int cid;
+    int start;
+    int end;
+    float weight;
+};
+static int budget_weight_cmp(const void *a, const void *b)
+{
+    const struct budget_weight *x = (const struct budget_weight*)a, *y = (const struct budget_weight*)b;
+    if ( x->cid != y->cid ) return x->cid - y->cid;
+    return x->start - y->start;
+}
+// weight of design regions by the max score of overlapped targets, 1 for regions without scored targets
+static float *load_budget_weights(int n)
+{
+    float *weights = (float*)malloc(n * sizeof(float));
+    int i, j, k = 0;
+    for ( i = 0; i < n; ++i )
+        weights[i] = 1;
+    BGZF *fp = bgzf_open(args.input_bed_fname, "r");
+    if ( fp == NULL )
+        error("Failed to open %s : %s.", args.input_bed_fname, strerror(errno));
+    kstring_t string = KSTRING_INIT;
+    int m_fields = 0, *fields = 0;
+    int n_scores = 0, m_scores = 0;
+    struct budget_weight *scores = 0;
+    while ( bgzf_getline(fp, '\n', &string) >= 0 ) {
+        if ( string.l == 0 || string.s[0] == '#' )
+            continue;
+        int nfields = ksplit_core(string.s, '\t', &m_fields, &fields);
+        if ( nfields >= 5 ) {
+            struct bed_chrom *chrom = get_chrom(args.design_regions, string.s + fields[0]);
+            float weight = atof(string.s + fields[4]);
+            if ( chrom != NULL && weight > 0 ) {
+                if ( n_scores == m_scores ) {
+                    m_scores = m_scores == 0 ? 1024 : m_scores << 1;
+                    scores = (struct budget_weight*)realloc(scores, m_scores * sizeof(struct budget_weight));
+                }
+                scores[n_scores].cid = chrom->id;
+                scores[n_scores].start = atoi(string.s + fields[1]);
+                scores[n_scores].end = atoi(string.s + fields[2]);
+                scores[n_scores].weight = weight;
+                n_scores++;
+            }
+        }
+    }
+    free(fields);
+    free(string.s);
+    bgzf_close(fp);
+    qsort(scores, n_scores, sizeof(struct budget_weight), budget_weight_cmp);
+    // sweep the sorted scores with design regions of each chromosome
+    for ( i = 0; i < args.design_regions->l_names; ++i ) {
+        struct bed_chrom *chrom = get_chrom(args.design_regions, args.design_regions->names[i]);
+        if ( chrom == NULL )
+            continue;
+        int p = 0;
+        while ( p < n_scores && scores[p].cid < chrom->id )
+            p++;
+        for ( j = 0; j < chrom->cached; ++j, ++k ) {
+            int start = chrom->a[j] >> 32, end = (uint32_t)chrom->a[j];
+            while ( p < n_scores && scores[p].cid == chrom->id && scores[p].end <= start )
+                p++;
+            float weight = 0;
+            int q;
+            for ( q = p; q < n_scores && scores[q].cid == chrom->id && scores[q].start < end; ++q )
+                if ( scores[q].end > start && scores[q].weight > weight )
+                    weight = scores[q].weight;
+            if ( weight > 0 )
+                weights[k] = weight;
+        }
+    }
+    free(scores);
+    return weights;
+}
+// plan the depth of each design region analytically, without fetching sequences. The depth of region is min(scale *
+// weight, -depth), the largest scale fits the budget is found by bisection, each step sums the estimated oligos of all
+// regions.
+static void plan_budget(void)
+{
+    int i, j, n = 0;
+    struct bedaux *bed = args.design_regions;
+    for ( i = 0; i < bed->l_names; ++i ) {
+        struct bed_chrom *chrom = get_chrom(bed, bed->names[i]);
+        if ( chrom != NULL )
+            n += chrom->cached;
+    }
+    if ( n == 0 )
+        return;
+    int *lengths = (int*)malloc(n * sizeof(int));
+    for ( i = 0, n = 0; i < bed->l_names; ++i ) {
+        struct bed_chrom *chrom = get_chrom(bed, bed->names[i]);
+        if ( chrom == NULL )
+            continue;
+        for ( j = 0; j < chrom->cached; ++j )
+            lengths[n++] = (uint32_t)chrom->a[j] - (chrom->a[j] >> 32);
+    }
+    float *weights = args.budget_weight ? load_budget_weights(n) : 0;
+    float max_weight = 1, min_weight = 1;
+    if ( weights ) {
+        for ( i = 0; i < n; ++i ) {
+            if ( i == 0 || weights[i] > max_weight ) max_weight = weights[i];
+            if ( i == 0 || weights[i] < min_weight ) min_weight = weights[i];
+        }
+    }
+    // regions with tiny depth still get one oligo, so the budget could not be smaller than the number of regions
+    double lo = 1e-6 / max_weight, hi = args.depth / min_weight, total = 0;
+    int iter;
+    for ( iter = 0; iter < 64; ++iter ) {
+        double scale = iter == 0 ? hi : (lo + hi) / 2;
+        total = 0;
+        for ( i = 0; i < n; ++i ) {
+            float depth = scale * (weights ? weights[i] : 1);
+            total += estimate_oligos(lengths[i], depth > args.depth ? args.depth : depth);
+        }
+        if ( total <= args.max_oligos ) {
+            lo = scale;
+            if ( iter == 0 )
+                break;
+        } else {
+            hi = scale;
+        }
+    }
+    args.region_depth = (float*)malloc(n * sizeof(float));
+    args.planned_oligos = 0;
+    for ( i = 0; i < n; ++i ) {
+        float depth = lo * (weights ? weights[i] : 1);
+        args.region_depth[i] = depth > args.depth ? args.depth : depth;
+        args.planned_oligos += estimate_oligos(lengths[i], args.region_depth[i]);
+        if ( i == 0 || args.region_depth[i] < args.planned_depth[0] ) args.planned_depth[0] = args.region_depth[i];
+        if ( i == 0 || args.region_depth[i] > args.planned_depth[1] ) args.planned_depth[1] = args.region_depth[i];
+    }
+    if ( args.planned_oligos > args.max_oligos )
+        warnings("Budget of %d oligos is too small for %d design regions, planned %.0f oligos.", args.max_oligos, n, args.planned_oligos);
+    else
+        LOG_print("Planned %.0f oligos for the budget of %d, depth %.2f ~ %.2f.", args.planned_oligos, args.max_oligos, args.planned_depth[0], args.planned_depth[1]);
+    free(lengths);
+    free(weights);
+}
+static void load_reference(void)
+{
+    if ( args.fai )
+        return;
+    args.fai = fai_load(args.fasta_fname);
+    if (args.fai == NULL ) {
+	if (fai_build(args.fasta_fname) == -1)
+	    error("Failed to build the index of %s.", args.fasta_fname);
+	args.fai = fai_load(args.fasta_fname);
+    }
+}
 int parse_args(int argc, char **argv)
 {
     int i;
@@ -212,6 +826,30 @@ int parse_args(int argc, char **argv)
     const char *max_oligo_length = 0;
     const char *min_oligo_length = 0;
     const char *round_size = 0;
+    const char *threads = 0;
+    const char *offtarget_diff = 0;
+    const char *offtarget_max_occ = 0;
+    const char *seed_length = 0;
+    const char *max_seed_occ = 0;
+    const char *na = 0;
+    const char *mg = 0;
+    const char *oligo_conc = 0;
+    const char *target_tm = 0;
+    const char *target_gc = 0;
+    const char *max_hairpin = 0;
+    const char *max_dimer = 0;
+    const char *gc_limit = 0;
+    const char *max_repeat = 0;
+    const char *max_homopolymer = 0;
+    const char *tm_limit = 0;
+    const char *max_offtarget = 0;
+    const char *score_weights = 0;
+    const char *dense_step = 0;
+    const char *fragment_size = 0;
+    const char *max_oligos = 0;
+    const char *dedup_window = 0;
+    const char *variant_shift = 0;
+    const char *max_variants = 0;
     
     for (i = 0; i < argc; ) {
 	const char *a = argv[i++];
@@ -232,6 +870,8 @@ int parse_args(int argc, char **argv)
 	    var = &args.project_name;
 	else if ( (strcmp(a, "-t") == 0 || strcmp(a, "-target") == 0) && args.input_bed_fname == 0 )
 	    var = &args.input_bed_fname;
+	else if ( strcmp(a, "-vcf") == 0 && args.vcf_fname == 0 )
+	    var = &args.vcf_fname;
 	else if ( (strcmp(a, "-u") == 0 || strcmp(a, "-database") == 0) && args.uniq_bed_fname == 0 )
 	    var = &args.uniq_bed_fname;
 	else if ( (strcmp(a, "-o") == 0 || strcmp(a, "-outdir") == 0) && args.output_dir == 0 )
@@ -244,8 +884,66 @@ int parse_args(int argc, char **argv)
             var = &min_oligo_length;
         else if ( (strcmp(a, "-max") == 0 ) && max_oligo_length == NULL )
             var = &max_oligo_length;
+        else if ( strcmp(a, "-target_tm") == 0 && target_tm == 0 )
+            var = &target_tm;
+        else if ( strcmp(a, "-target_gc") == 0 && target_gc == 0 )
+            var = &target_gc;
+        else if ( strcmp(a, "-max_hairpin") == 0 && max_hairpin == 0 )
+            var = &max_hairpin;
+        else if ( strcmp(a, "-max_dimer") == 0 && max_dimer == 0 )
+            var = &max_dimer;
+        else if ( strcmp(a, "-gc_range") == 0 && gc_limit == 0 )
+            var = &gc_limit;
+        else if ( strcmp(a, "-max_repeat") == 0 && max_repeat == 0 )
+            var = &max_repeat;
+        else if ( strcmp(a, "-max_homopolymer") == 0 && max_homopolymer == 0 )
+            var = &max_homopolymer;
+        else if ( strcmp(a, "-tm_range") == 0 && tm_limit == 0 )
+            var = &tm_limit;
+        else if ( strcmp(a, "-max_offtarget") == 0 && max_offtarget == 0 )
+            var = &max_offtarget;
+        else if ( strcmp(a, "-score_weights") == 0 && score_weights == 0 )
+            var = &score_weights;
+        else if ( strcmp(a, "-dense") == 0 && dense_step == 0 )
+            var = &dense_step;
+        else if ( strcmp(a, "-fragment_size") == 0 && fragment_size == 0 )
+            var = &fragment_size;
+        else if ( strcmp(a, "-max_oligos") == 0 && max_oligos == 0 )
+            var = &max_oligos;
+        else if ( strcmp(a, "-dedup_window") == 0 && dedup_window == 0 )
+            var = &dedup_window;
+        else if ( strcmp(a, "-variants") == 0 && args.common_variants_fname == 0 )
+            var = &args.common_variants_fname;
+        else if ( strcmp(a, "-variant_shift") == 0 && variant_shift == 0 )
+            var = &variant_shift;
+        else if ( strcmp(a, "-stats") == 0 && args.stats_fname == 0 )
+            var = &args.stats_fname;
+        else if ( strcmp(a, "-trace") == 0 && args.trace_fname == 0 )
+            var = &args.trace_fname;
+        else if ( strcmp(a, "-max_variants") == 0 && max_variants == 0 )
+            var = &max_variants;
         else if ( strcmp(a, "-ROUND_SIZE") == 0 )
             var = &round_size;
+        else if ( strcmp(a, "-threads") == 0 && threads == 0 )
+            var = &threads;
+        else if ( strcmp(a, "-offtarget") == 0 && args.offtarget_fname == 0 )
+            var = &args.offtarget_fname;
+        else if ( strcmp(a, "-offtarget_diff") == 0 && offtarget_diff == 0 )
+            var = &offtarget_diff;
+        else if ( strcmp(a, "-offtarget_max_occ") == 0 && offtarget_max_occ == 0 )
+            var = &offtarget_max_occ;
+        else if ( strcmp(a, "-fm_index") == 0 && args.fm_fname == 0 )
+            var = &args.fm_fname;
+        else if ( strcmp(a, "-seed_length") == 0 && seed_length == 0 )
+            var = &seed_length;
+        else if ( strcmp(a, "-max_seed_occ") == 0 && max_seed_occ == 0 )
+            var = &max_seed_occ;
+        else if ( strcmp(a, "-na") == 0 && na == 0 )
+            var = &na;
+        else if ( strcmp(a, "-mg") == 0 && mg == 0 )
+            var = &mg;
+        else if ( strcmp(a, "-oligo_conc") == 0 && oligo_conc == 0 )
+            var = &oligo_conc;
 	
 	if ( var != 0 ) {
 	    if (i == argc) {
@@ -259,6 +957,42 @@ int parse_args(int argc, char **argv)
 	    args.must_design = 1;
 	    continue;
 	}
+	if ( strcmp(a, "-score") == 0) {
+	    args.score = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-dedup_global") == 0) {
+	    args.dedup_global = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-binary") == 0) {
+	    args.binary = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-no_sequence") == 0) {
+	    args.no_sequence = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-budget_weight") == 0) {
+	    args.budget_weight = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-set_cover") == 0) {
+	    args.set_cover = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-secondary") == 0) {
+	    args.secondary = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-tm") == 0) {
+	    args.tm = 1;
+	    continue;
+	}
+	if ( strcmp(a, "-offtarget_edit") == 0) {
+	    args.offtarget_opts.use_edit = 1;
+	    continue;
+	}
 	error_print("Unknown parameter : %s. Use -h to for more help.", a);
 	return 1;
     }
@@ -282,11 +1016,32 @@ int parse_args(int argc, char **argv)
 	    }
 	}
     }
+    if ( args.debug_mode && args.trace_fname == 0 ) {
+        kstring_t *path = &args.trace_path;
+        if ( args.output_dir ) {
+            kputs(args.output_dir, path);
+            if ( path->l && path->s[path->l-1] != '/' )
+                kputc('/', path);
+        }
+        kputs("trace.json", path);
+        args.trace_fname = path->s;
+    }
+    if ( args.trace_fname )
+        trace_start();
     if (args.fasta_fname == 0)
 	error("Required a reference genome sequence. Use -r or -fasta to specify.");
 
-    if (args.input_bed_fname == 0)
+    if ( args.vcf_fname ) {
+        if ( args.input_bed_fname || args.uniq_bed_fname )
+            error("-vcf does not work with -t or -u.");
+        if ( args.common_variants_fname || args.set_cover || max_oligos || dense_step || target_tm || target_gc )
+            error("-vcf does not work with -variants, -set_cover, -max_oligos, -dense, -target_tm or -target_gc.");
+    } else if (args.input_bed_fname == 0) {
 	error("Required a target bed file. Use -t or -target to specify.");
+    }
+    // alleles of -vcf are not in the reference, and binary format packs sequences already
+    if ( args.no_sequence && (args.vcf_fname || args.binary) )
+        error("-no_sequence does not work with -vcf or -binary.");
 
     if (args.uniq_bed_fname == 0) {
 	if (quiet_mode == 0)
@@ -343,19 +1098,162 @@ int parse_args(int argc, char **argv)
     if (args.oligo_length == 0 && quiet_mode == 0) {
 	LOG_print("Use dynamic design mode, the length of oligos will set from %dnt to %dnt.", oligo_length_minimal, oligo_length_maxmal);
     }
+    if ( target_tm || target_gc ) {
+        if ( args.oligo_length != 0 )
+            error("-target_tm and -target_gc only work in dynamic design mode. Use -l 0 to enable it.");
+        if ( target_tm ) {
+            args.target_tm = 1;
+            if ( parse_range(target_tm, args.tm_range) )
+                error("Malformed Tm window : %s.", target_tm);
+            if ( quiet_mode == 0 )
+                LOG_print("Target Tm : %.1f - %.1f.", args.tm_range[0], args.tm_range[1]);
+        }
+        if ( target_gc ) {
+            args.target_gc = 1;
+            if ( parse_range(target_gc, args.gc_range) )
+                error("Malformed GC window : %s.", target_gc);
+            if ( quiet_mode == 0 )
+                LOG_print("Target GC ratio : %.2f - %.2f.", args.gc_range[0], args.gc_range[1]);
+        }
+    }
+    args.length_hist = (uint64_t*)calloc(oligo_length_maxmal + 1, sizeof(uint64_t));
+    if ( max_hairpin ) {
+        args.secondary = 1;
+        args.max_hairpin = str2int((char*)max_hairpin);
+    }
+    if ( max_dimer ) {
+        args.secondary = 1;
+        args.max_dimer = str2int((char*)max_dimer);
+    }
+    if ( gc_limit ) {
+        args.filter_gc = 1;
+        if ( parse_range(gc_limit, args.gc_limit) )
+            error("Malformed GC range : %s.", gc_limit);
+    }
+    if ( max_repeat )
+        args.max_repeat = atof(max_repeat);
+    if ( max_homopolymer )
+        args.max_homopolymer = str2int((char*)max_homopolymer);
+    if ( tm_limit ) {
+        args.filter_tm = 1;
+        if ( parse_range(tm_limit, args.tm_limit) )
+            error("Malformed Tm range : %s.", tm_limit);
+    }
+    if ( score_weights ) {
+        args.score = 1;
+        int n = sscanf(score_weights, "%f,%f,%f,%f,%f,%f", &args.score_weights[0], &args.score_weights[1], &args.score_weights[2], &args.score_weights[3], &args.score_weights[4], &args.score_weights[5]);
+        if ( n != 5 && n != 6 )
+            error("Malformed score weights : %s.", score_weights);
+    }
+    if ( dense_step ) {
+        args.dense_step = str2int((char*)dense_step);
+        if ( args.dense_step < 1 )
+            error("Step of dense candidates should be a positive integer. %s", dense_step);
+        if ( args.target_tm || args.target_gc )
+            error("-dense does not work with -target_tm or -target_gc.");
+    }
+    if ( dedup_window ) {
+        args.dedup_window = str2int((char*)dedup_window);
+        if ( args.dedup_window < 0 )
+            error("Window of dedup should be a non-negative integer. %s", dedup_window);
+    }
+    if ( args.dedup_global )
+        args.dedup = dedup_init(0);
+    else if ( args.dedup_window )
+        args.dedup = dedup_init(args.dedup_window);
+    if ( max_oligos ) {
+        args.max_oligos = str2int((char*)max_oligos);
+        if ( args.max_oligos < 1 )
+            error("Budget of oligos should be a positive integer. %s", max_oligos);
+    } else if ( args.budget_weight ) {
+        error("-budget_weight only works with -max_oligos.");
+    }
+    if ( args.set_cover ) {
+        if ( args.target_tm || args.target_gc )
+            error("-set_cover does not work with -target_tm or -target_gc.");
+        if ( fragment_size )
+            args.fragment_size = str2int((char*)fragment_size);
+    } else if ( fragment_size ) {
+        error("-fragment_size only works with -set_cover.");
+    }
+    if ( variant_shift || max_variants ) {
+        if ( args.common_variants_fname == 0 )
+            error("-variant_shift and -max_variants require variant sites. Use -variants to specify.");
+        if ( variant_shift )
+            args.variant_shift = str2int((char*)variant_shift);
+        if ( max_variants )
+            args.max_variants = str2int((char*)max_variants);
+    }
+    args.filter = args.common_variants_fname || args.set_cover || args.dense_step || args.score || args.filter_gc || args.max_repeat >= 0 || args.max_homopolymer >= 0 || args.filter_tm;
+    if ( args.filter && (oligo_length_maxmal > PROFILE_MAX_WINDOW || args.oligo_length > PROFILE_MAX_WINDOW) )
+        error("Filtering and scoring only support oligos no longer than %d.", PROFILE_MAX_WINDOW);
+    if ( args.secondary && (oligo_length_maxmal > SS_MAX_LENGTH || args.oligo_length > SS_MAX_LENGTH) )
+        error("Secondary structure screening only supports oligos no longer than %d.", SS_MAX_LENGTH);
+
+    if ( threads ) {
+        args.n_threads = str2int((char*)threads);
+        if ( args.n_threads < 1 )
+            args.n_threads = 1;
+    }
+    if ( args.offtarget_fname ) {
+        args.offtarget = mini_index_load(args.offtarget_fname);
+        if ( args.offtarget == NULL )
+            error("Failed to load minimizer index %s.", args.offtarget_fname);
+        if ( offtarget_diff )
+            args.offtarget_opts.max_diff = str2int((char*)offtarget_diff);
+        if ( offtarget_max_occ )
+            args.offtarget_opts.max_occ = str2int((char*)offtarget_max_occ);
+        if ( max_offtarget )
+            args.max_offtarget = str2int((char*)max_offtarget);
+        if ( quiet_mode == 0 )
+            LOG_print("Screen off-target loci within %d %s.", args.offtarget_opts.max_diff, args.offtarget_opts.use_edit ? "edits" : "mismatches");
+    } else if ( max_offtarget ) {
+        error("-max_offtarget requires a minimizer index. Use -offtarget to specify.");
+    }
+    if ( args.fm_fname ) {
+        args.fm = fm_index_load(args.fm_fname);
+        if ( args.fm == NULL )
+            error("Failed to load FM-index %s.", args.fm_fname);
+        if ( seed_length ) {
+            args.seed_length = str2int((char*)seed_length);
+            if ( args.seed_length < 8 )
+                error("Seed length should be at least 8. %d", args.seed_length);
+        }
+        if ( max_seed_occ )
+            args.max_seed_occ = str2int((char*)max_seed_occ);
+        if ( quiet_mode == 0 )
+            LOG_print("Count occurrences of %db seeds.", args.seed_length);
+    } else if ( max_seed_occ ) {
+        error("-max_seed_occ requires an FM-index. Use -fm_index to specify.");
+    }
+    thermo_opts_init(&args.thermo_opts, na ? atof(na) : 50, mg ? atof(mg) : 0, oligo_conc ? atof(oligo_conc) : 250);
 
     if ( round_size ) {
         args.ROUND_SIZE = str2int(round_size);
         if ( args.ROUND_SIZE < args.min_oligo_length ) warnings("The ROUND SIZE smaller than minimal oligo length! Reset ROUND_SIZE to %d now.", args.min_oligo_length);
     }
              
+    if ( args.vcf_fname ) {
+        args.vcf_fp = hts_open(args.vcf_fname, "r");
+        if ( args.vcf_fp == NULL )
+            error("Failed to open %s : %s.", args.vcf_fname, strerror(errno));
+        args.vcf_hdr = bcf_hdr_read(args.vcf_fp);
+        if ( args.vcf_hdr == NULL )
+            error("Failed to read header of %s.", args.vcf_fname);
+        args.vcf_rec = bcf_init();
+        args.chrom_names = (char**)bcf_hdr_seqnames(args.vcf_hdr, &args.n_chroms);
+        args.depth_cap = args.depth;
+        return 0;
+    }
     args.target_regions = bedaux_init();
 
     // assume input is 0 based bed file.
     set_based_0();
     
+    run_stats_phase(STAGE_BED_PARSE);
     if ( bed_read(args.target_regions, args.input_bed_fname) )
         error("Empty file, %s", args.input_bed_fname);
+    run_stats_phase(STAGE_MERGE);
 
     bed_merge(args.target_regions);
     
@@ -373,6 +1271,7 @@ int parse_args(int argc, char **argv)
     bed_flktrim(bed, flank_region_length, flank_region_length);
     bed_flktrim(bed, trim_region_length, trim_region_length);
 
+    run_stats_phase(STAGE_DB_JOIN);
     if ( args.data_required == 1) {
 	htsFile *fp = hts_open(args.uniq_bed_fname, "r");
 	tbx_t *tbx = tbx_index_load(args.uniq_bed_fname);
@@ -385,6 +1284,7 @@ int parse_args(int argc, char **argv)
     } else {
 	args.design_regions = bed_dup(bed);
     }
+    run_stats_phase(STAGE_MERGE);
 
     // sometimes, uniq regions in database are very small and will break a contine region into several small regions.
     // merge these small regions into one piece if the gap between them is shorter than flank_uniq_length*2.
@@ -393,6 +1293,28 @@ int parse_args(int argc, char **argv)
     bed_flktrim(args.design_regions, trim_uniq_length, trim_uniq_length);
 
     bed_destroy(bed);
+    // design and export in the order of reference contigs
+    load_reference();
+    int n_seqs = faidx_nseq(args.fai);
+    const char **seq_names = (const char**)malloc(n_seqs * sizeof(char*));
+    for ( i = 0; i < n_seqs; ++i )
+        seq_names[i] = faidx_iseq(args.fai, i);
+    bed_reorder(args.design_regions, seq_names, n_seqs);
+    free(seq_names);
+    run_stats_phase(STAGE_SETUP);
+    args.chrom_names = args.design_regions->names;
+    args.n_chroms = args.design_regions->l_names;
+    args.depth_cap = args.last_depth = args.depth;
+    if ( args.max_oligos )
+        plan_budget();
+    // load variant sites of design regions and their flanks, which are fetched in design
+    if ( args.common_variants_fname ) {
+        args.variants = variant_sites_load(args.common_variants_fname, args.design_regions, oligo_length_maxmal);
+        if ( args.variants == NULL )
+            error("Failed to load variant sites from %s.", args.common_variants_fname);
+        if ( quiet_mode == 0 )
+            LOG_print("Load %"PRIu64" common variant sites.", args.variants->n_sites);
+    }
     return 0;
 }
 float calculate_GC(const char *seq, int length)
@@ -436,13 +1358,550 @@ float repeat_ratio(char *seq, int length)
     }
     return (float)j/length;
 }
+// max occurrences of seeds, seeds are non-overlapped and the last one is aligned to the end of oligo
+static int64_t count_seeds(const char *seq, int length)
+{
+    int64_t max = 0;
+    int i, l = args.seed_length < length ? args.seed_length : length;
+    for ( i = 0; ; i += l ) {
+        if ( i + l > length )
+            i = length - l;
+        int64_t n = fm_index_count(args.fm, seq + i, l);
+        if ( n > max ) {
+            max = n;
+            // no need to go further
+            if ( args.max_seed_occ && max > args.max_seed_occ )
+                break;
+        }
+        if ( i + l == length )
+            break;
+    }
+    return max;
+}
+// kinds of spans of the timeline, see trace.h
+static const struct trace_kind trace_fetch = { "fetch", "reference", "chrom", { "start", "end", "bases" } };
+static const struct trace_kind trace_titling = {
+    "titling_design", "design", "chrom", { "start", "end", "oligo_length", "parts", "part", "offset" }
+};
+static const struct trace_kind trace_bubble = {
+    "bubble_design", "design", "chrom",
+    { "last_start", "last_end", "start", "end", "oligo_length", "parts", "part", "offset" }
+};
+static const struct trace_kind trace_cover_region = {
+    "cover_region", "design", "chrom", { "start", "end", "candidates" }
+};
+static const struct trace_kind trace_cover_select = {
+    "cover_select", "design", "chrom", { "targets", "candidates", "uncovered" }
+};
+static const struct trace_kind trace_screen = { "screen", "score", NULL, { "oligos" } };
+static const struct trace_kind trace_compress = { "compress_block", "compress", NULL, { "bytes" } };
+static void *screen_oligos(void *data)
+{
+    struct screen_job *job = (struct screen_job*)data;
+    struct oligo_batch *batch = &args.batch;
+    // time of the main thread is counted by its stage already
+    double cpu = args.n_threads > 1 ? run_stats_thread_cpu() : 0;
+    TRACE_BEGIN(t);
+    int i;
+    for ( i = job->beg; i < job->end; ++i ) {
+        struct oligo *o = &batch->a[i];
+        const char *seq = batch->seq.s + o->seq_offset;
+        if ( args.fm ) {
+            o->seed_occ = count_seeds(seq, o->length);
+            if ( args.max_seed_occ && o->seed_occ > args.max_seed_occ ) {
+                o->rejected = REJECT_SEED;
+                continue;
+            }
+        }
+        if ( args.secondary ) {
+            struct ss_seq ss;
+            ss_seq_init(&ss, seq, o->length);
+            if ( ss_screen(&ss, args.max_hairpin, args.max_dimer, &o->hairpin, &o->dimer) ) {
+                o->rejected = args.max_hairpin >= 0 && o->hairpin > args.max_hairpin ? REJECT_HAIRPIN : REJECT_DIMER;
+                continue;
+            }
+        }
+        if ( args.offtarget == NULL )
+            continue;
+        int id = args.offtarget_ids[o->cid];
+        if ( id < 0 )
+            continue;
+        // the locus of bubble oligo is not continuous in the genome, so no self locus for it
+        uint64_t self_pos = o->n_block == 1 ? args.offtarget->offsets[id] + o->start : UINT64_MAX;
+        o->off_target = mini_index_count(args.offtarget, seq, o->length, self_pos, &args.offtarget_opts, &job->buf);
+        if ( args.max_offtarget >= 0 && o->off_target > args.max_offtarget )
+            o->rejected = REJECT_OFFTARGET;
+    }
+    if ( args.n_threads > 1 )
+        run_stats_add_cpu(STAGE_SCORE, run_stats_thread_cpu() - cpu);
+    TRACE_SPAN(&trace_screen, t, NULL, job->end - job->beg);
+    return NULL;
+}
+// count seeds and off-target loci of oligos in batch, split the batch into slices for each thread
+static void screen_batch(struct oligo_batch *batch)
+{
+    int i;
+    if ( args.offtarget && args.offtarget_ids == NULL ) {
+        args.offtarget_ids = (int*)malloc(args.n_chroms * sizeof(int));
+        for ( i = 0; i < args.n_chroms; ++i )
+            args.offtarget_ids[i] = -2;
+    }
+    // resolve sequence ids here, workers only read them
+    for ( i = 0; args.offtarget && i < batch->n; ++i ) {
+        int cid = batch->a[i].cid;
+        if ( args.offtarget_ids[cid] != -2 )
+            continue;
+        args.offtarget_ids[cid] = mini_index_name2id(args.offtarget, args.chrom_names[cid]);
+        if ( args.offtarget_ids[cid] == -1 )
+            warnings("Chromosome %s is not found in the minimizer index.", args.chrom_names[cid]);
+    }
+    if ( args.jobs == NULL )
+        args.jobs = (struct screen_job*)calloc(args.n_threads, sizeof(struct screen_job));
+    if ( args.n_threads == 1 ) {
+        args.jobs[0].beg = 0;
+        args.jobs[0].end = batch->n;
+        screen_oligos(&args.jobs[0]);
+        return;
+    }
+    if ( args.pool == NULL ) {
+        args.pool = t_pool_init(args.n_threads * 2, args.n_threads);
+        args.results = t_results_queue_init();
+    }
+    int step = (batch->n + args.n_threads - 1) / args.n_threads;
+    int n_jobs = 0;
+    run_stats_wait(1);
+    for ( i = 0; i < args.n_threads && i * step < batch->n; ++i ) {
+        struct screen_job *job = &args.jobs[i];
+        job->beg = i * step;
+        job->end = job->beg + step > batch->n ? batch->n : job->beg + step;
+        t_pool_dispatch(args.pool, args.results, screen_oligos, job);
+        n_jobs++;
+    }
+    for ( i = 0; i < n_jobs; ++i )
+        t_pool_delete_result(t_pool_next_result_wait(args.results), 0);
+    run_stats_wait(0);
+}
+// optional columns after rank, each one starts with a tab, buf keeps the allele tag
+static void format_extra(struct oligo *o, const char *buf, kstring_t *str)
+{
+    if ( args.offtarget ) {
+        kputc('\t', str);
+        if ( o->off_target < 0 )
+            kputc('.', str);
+        else
+            kput_int32(o->off_target, str);
+    }
+    if ( args.fm ) {
+        kputc('\t', str);
+        if ( o->seed_occ < 0 )
+            kputc('.', str);
+        else
+            kputl(o->seed_occ, str);
+    }
+    if ( args.tm ) {
+        kputc('\t', str);
+        kput_fixed(o->tm, 1, str);
+        kputc('\t', str);
+        kput_fixed(o->dg, 2, str);
+    }
+    if ( args.secondary ) {
+        kputc('\t', str);
+        kput_int32(o->hairpin, str);
+        kputc('\t', str);
+        kput_int32(o->dimer, str);
+    }
+    if ( args.score ) {
+        kputc('\t', str);
+        kput_fixed(o->score, 1, str);
+    }
+    if ( args.vcf_fname ) {
+        kputc('\t', str);
+        kputs(o->tag_offset < 0 ? "." : buf + o->tag_offset, str);
+    }
+}
+static void oligo_record(struct oligo *o, const char *buf, struct probe_record *r)
+{
+    r->cid = o->cid;
+    r->start = o->start;
+    r->end = o->end;
+    r->length = o->length;
+    r->n_block = o->n_block;
+    r->starts[0] = o->starts[0];
+    r->starts[1] = o->starts[1];
+    r->ends[0] = o->ends[0];
+    r->ends[1] = o->ends[1];
+    r->repeat = probe_fixed(o->repeat);
+    r->gc = probe_fixed(o->gc);
+    r->rank = o->rank;
+    r->seq = buf + o->seq_offset;
+    r->extra = NULL;
+    r->l_extra = 0;
+}
+// the line is formatted in place, without printf or temporary strings
+static void format_oligo(struct oligo *o, const char *buf, kstring_t *str)
+{
+    struct probe_record r;
+    oligo_record(o, buf, &r);
+    if ( args.no_sequence )
+        r.seq = NULL;
+    probe_format_record(&args.format, &r, str);
+    format_extra(o, buf, str);
+    kputc('\n', str);
+}
+static void write_binary_oligo(struct oligo *o, const char *buf)
+{
+    struct probe_record r;
+    oligo_record(o, buf, &r);
+    args.string.l = 0;
+    format_extra(o, buf, &args.string);
+    // skip the leading tab
+    r.extra = args.string.l ? args.string.s + 1 : NULL;
+    r.l_extra = args.string.l ? args.string.l - 1 : 0;
+    if ( probe_writer_push(args.probe_writer, &r) )
+        error("Failed to export oligo at %s:%d.", args.chrom_names[o->cid], o->start);
+    args.string.l = 0;
+}
+// composite score in [0, 100], penalties of GC distance to the center of GC range (or 0.5) in percent, repeat ratio in
+// percent, 10 for each homopolymer base longer than 3, Tm distance to the center of Tm range (if calculated), and 10 for
+// each off-target locus (if screened)
+static float oligo_score(const struct oligo *o)
+{
+    const float *w = args.score_weights;
+    float gc_center = args.filter_gc ? (args.gc_limit[0] + args.gc_limit[1]) / 2 : 0.5;
+    float score = 100;
+    score -= w[0] * fabs(o->gc - gc_center) * 100;
+    score -= w[1] * o->repeat * 100;
+    if ( o->homopolymer > 3 )
+        score -= w[2] * (o->homopolymer - 3) * 10;
+    if ( args.filter_tm )
+        score -= w[3] * fabs(o->tm - (args.tm_limit[0] + args.tm_limit[1]) / 2);
+    else if ( args.target_tm )
+        score -= w[3] * fabs(o->tm - (args.tm_range[0] + args.tm_range[1]) / 2);
+    if ( o->off_target > 0 )
+        score -= w[4] * o->off_target * 10;
+    // sites in the central half count twice
+    if ( args.variants )
+        score -= w[5] * (o->variants + o->central_variants) * 10;
+    return score < 0 ? 0 : score;
+}
+// copy oligo and its sequence and tag to the pending buffer
+static void pending_push(struct oligo *o, const char *buf)
+{
+    struct oligo_batch *pending = &args.pending;
+    if ( pending->n == pending->m ) {
+        pending->m = pending->m == 0 ? OLIGO_BATCH_SIZE : pending->m << 1;
+        pending->a = (struct oligo*)realloc(pending->a, pending->m * sizeof(struct oligo));
+    }
+    struct oligo *p = &pending->a[pending->n++];
+    *p = *o;
+    p->seq_offset = pending->seq.l;
+    kputsn(buf + o->seq_offset, o->length, &pending->seq);
+    kputc('\0', &pending->seq);
+    if ( o->tag_offset >= 0 ) {
+        p->tag_offset = pending->seq.l;
+        kputs(buf + o->tag_offset, &pending->seq);
+        kputc('\0', &pending->seq);
+    }
+}
+// oligos pushed after this call start at or after pos of chromosome cid, minus a margin of clamped and shifted oligos
+static inline void set_frontier(int cid, int pos)
+{
+    int margin = 2 * oligo_length_maxmal;
+    args.frontier_cid = cid;
+    args.frontier_pos = pos < INT_MIN + margin ? INT_MIN : pos - margin;
+}
+#define oligo_lt(a, b) ((a).cid < (b).cid || ((a).cid == (b).cid && (a).start < (b).start))
+KSORT_INIT(oligo, struct oligo, oligo_lt)
+
+// format all the oligos first and then compress the lines, so both stages are timed once for the batch
+static void write_oligos(struct oligo *a, int n, const char *buf)
+{
+    int i, start;
+    if ( args.probe_writer ) {
+        for ( i = 0; i < n; ++i )
+            write_binary_oligo(&a[i], buf);
+        return;
+    }
+    if ( n > args.m_line_ends ) {
+        args.m_line_ends = n;
+        args.line_ends = (int*)realloc(args.line_ends, n * sizeof(int));
+    }
+    args.string.l = 0;
+    for ( i = 0; i < n; ++i ) {
+        format_oligo(&a[i], buf, &args.string);
+        args.line_ends[i] = args.string.l;
+    }
+    args.formatted_bytes += args.string.l;
+    int stage = run_stats_switch(STAGE_COMPRESS);
+    for ( i = 0, start = 0; i < n; start = args.line_ends[i++] ) {
+        struct oligo *o = &a[i];
+        const char *line = args.string.s + start;
+        int l = args.line_ends[i] - start;
+        if ( args.shards ) {
+            probe_shards_push(args.shards, o->cid, o->start, o->end, line, l);
+            continue;
+        }
+        // a block is compressed by the write which fills it
+        TRACE_BEGIN(t);
+        int64_t block = args.fp->block_address;
+        if ( bgzf_write(args.fp, line, l) != l )
+            error("Write error : %d.", args.fp->errcode);
+        if ( trace_enabled && args.fp->block_address != block )
+            TRACE_SPAN(&trace_compress, t, NULL, (int)(args.fp->block_address - block));
+        if ( args.idx && hts_idx_push(args.idx, o->cid, o->start, o->end, bgzf_tell(args.fp), 1) < 0 ) {
+            warnings("Probes are not sorted at %s:%d, index is not built.", args.chrom_names[o->cid], o->start);
+            hts_idx_destroy(args.idx);
+            args.idx = NULL;
+        }
+    }
+    args.string.l = 0;
+    run_stats_switch(stage);
+}
+// export pending oligos before the frontier in coordinate order, or all of them at the end
+static void export_oligos(int all)
+{
+    struct oligo_batch *pending = &args.pending;
+    if ( pending->n == 0 )
+        return;
+    int stage = run_stats_switch(STAGE_FORMAT);
+    // stable, oligos of the same start keep the design order
+    ks_mergesort(oligo, pending->n, pending->a, 0);
+    int i, j;
+    for ( i = 0; i < pending->n; ++i ) {
+        struct oligo *o = &pending->a[i];
+        if ( all == 0 && (o->cid > args.frontier_cid || (o->cid == args.frontier_cid && o->start >= args.frontier_pos)) )
+            break;
+    }
+    for ( j = 0; j < i; j += OLIGO_BATCH_SIZE )
+        write_oligos(pending->a + j, i - j < OLIGO_BATCH_SIZE ? i - j : OLIGO_BATCH_SIZE, pending->seq.s);
+    run_stats_switch(stage);
+    if ( i == pending->n ) {
+        pending->n = 0;
+        pending->seq.l = 0;
+        return;
+    }
+    // keep the remains, and their sequences at the head of buffer
+    kstring_t *seq = &args.batch.seq;
+    assert(seq->l == 0);
+    for ( j = 0; i < pending->n; ++i, ++j ) {
+        struct oligo *o = &pending->a[i];
+        pending->a[j] = *o;
+        pending->a[j].seq_offset = seq->l;
+        kputsn(pending->seq.s + o->seq_offset, o->length, seq);
+        kputc('\0', seq);
+        if ( o->tag_offset >= 0 ) {
+            pending->a[j].tag_offset = seq->l;
+            kputs(pending->seq.s + o->tag_offset, seq);
+            kputc('\0', seq);
+        }
+    }
+    pending->n = j;
+    // swap buffers, the batch buffer is empty after flush
+    kstring_t tmp = pending->seq;
+    pending->seq = *seq;
+    *seq = tmp;
+    seq->l = 0;
+}
+// screen oligos in the batch and export them to the output cache
+void flush_oligos(void)
+{
+    struct oligo_batch *batch = &args.batch;
+    if ( batch->n == 0 )
+        return;
+    if ( args.offtarget || args.fm || args.secondary )
+        screen_batch(batch);
+    int i;
+    for ( i = 0; i < batch->n; ++i ) {
+        struct oligo *o = &batch->a[i];
+        if ( o->rejected ) {
+            int k;
+            for ( k = 0; k < REJECT_TYPES; ++k )
+                if ( o->rejected == 1 << k )
+                    args.rejected_number[k]++;
+            continue;
+        }
+        if ( args.score ) {
+            o->score = oligo_score(o);
+            // oligos clamped in short regions keep rank 0
+            if ( o->rank )
+                o->rank = o->score >= 80 ? 1 : o->score >= 50 ? 2 : 3;
+        }
+        pending_push(o, batch->seq.s);
+        args.probes_number++;
+        if ( args.variants && o->variants )
+            args.variant_number++;
+        if ( o->length <= oligo_length_maxmal ) args.length_hist[o->length]++;
+    }
+    batch->n = 0;
+    batch->seq.l = 0;
+    export_oligos(0);
+}
+static void push_oligo(struct oligo *o, const char *seq)
+{
+    // duplicates are dropped before screening and formatting
+    if ( args.dedup && dedup_check(args.dedup, seq, o->length) )
+        return;
+    struct oligo_batch *batch = &args.batch;
+    if ( batch->n == batch->m ) {
+        batch->m = batch->m == 0 ? OLIGO_BATCH_SIZE : batch->m << 1;
+        batch->a = (struct oligo*)realloc(batch->a, batch->m * sizeof(struct oligo));
+    }
+    o->off_target = -1;
+    o->seed_occ = -1;
+    o->hairpin = -1;
+    o->dimer = -1;
+    o->rejected = 0;
+    o->seq_offset = batch->seq.l;
+    kputsn(seq, o->length, &batch->seq);
+    kputc('\0', &batch->seq);
+    o->tag_offset = -1;
+    if ( args.tag ) {
+        o->tag_offset = batch->seq.l;
+        kputs(args.tag, &batch->seq);
+        kputc('\0', &batch->seq);
+    }
+    batch->a[batch->n++] = *o;
+    if ( batch->n == OLIGO_BATCH_SIZE )
+        flush_oligos();
+}
+// Tm is required by export, target or filter
+static inline int thermo_required(void)
+{
+    return args.tm || args.target_tm || args.target_gc || args.filter;
+}
+// mark variant sites of bases [beg, beg+len) of region profile, start is the genome position of base beg
+static void mark_variants(int cid, int beg, int len, int start)
+{
+    int n = 0;
+    const uint32_t *sites = variant_sites_range(args.variants, cid, start, start + len, &n);
+    region_profile_variants(&args.region, beg, len, sites, n, start);
+}
+// bases [start, end] of the reference, counted in the fetch stage
+static char *fetch_seq(const char *name, int start, int end, int *l)
+{
+    int stage = run_stats_switch(STAGE_FETCH);
+    TRACE_BEGIN(t);
+    char *seq = faidx_fetch_seq(args.fai, name, start, end, l);
+    if ( seq )
+        args.fetched_bytes += *l;
+    TRACE_SPAN(&trace_fetch, t, name, start, end, seq ? *l : 0);
+    run_stats_switch(stage);
+    return seq;
+}
+#define REF_CHUNK_SIZE (1<<20)
+// append bases [start, end] of chromosome cid to str, positions are clamped to the chromosome like faidx_fetch_seq().
+// Bases are copied from a chunk of at least REF_CHUNK_SIZE, so sorted regions fetch the reference once per chunk and
+// the design loop does not allocate for each region. Return the number of bases, -1 if failed.
+static int fetch_region(int cid, int start, int end, kstring_t *str)
+{
+    const char *name = args.design_regions->names[cid];
+    int stage = run_stats_switch(STAGE_FETCH);
+    if ( cid != args.ref_chunk_cid ) {
+        args.ref_chunk_cid = cid;
+        args.ref_chunk_len = faidx_seq_len(args.fai, name);
+        args.ref_chunk_l = 0;
+    }
+    int len = args.ref_chunk_len;
+    if ( end < start ) start = end;
+    if ( start < 0 ) start = 0;
+    else if ( start >= len ) start = len - 1;
+    if ( end < 0 ) end = 0;
+    else if ( end >= len ) end = len - 1;
+    if ( start < args.ref_chunk_start || end >= args.ref_chunk_start + args.ref_chunk_l ) {
+        free(args.ref_chunk);
+        args.ref_chunks++;
+        args.ref_chunk_start = start;
+        int chunk_end = end - start >= REF_CHUNK_SIZE ? end : start + REF_CHUNK_SIZE - 1;
+        args.ref_chunk = fetch_seq(name, start, chunk_end, &args.ref_chunk_l);
+        if ( args.ref_chunk == NULL ) {
+            args.ref_chunk_l = 0;
+            run_stats_switch(stage);
+            return -1;
+        }
+    }
+    int l = end - start + 1;
+    if ( start + l > args.ref_chunk_start + args.ref_chunk_l )
+        l = args.ref_chunk_start + args.ref_chunk_l - start;
+    kputsn(args.ref_chunk + start - args.ref_chunk_start, l, str);
+    run_stats_switch(stage);
+    return l;
+}
+static void build_profiles(const char *region, int l, int cid, int region_start)
+{
+    if ( thermo_required() )
+        thermo_profile_build(&args.profile, region, l);
+    if ( args.filter )
+        region_profile_build(&args.region, region, l);
+    if ( args.variants )
+        mark_variants(cid, 0, l, region_start);
+}
+// check window [beg, beg+o->length) of region and push it to the batch. With filter stage, the window is checked by the
+// profiles of region and out-of-spec candidates are dropped before copying.
+static int window_in_spec(struct oligo *o, int beg)
+{
+    int length = o->length;
+    if ( region_amb(&args.region, beg, length) )
+        return 0;
+    if ( args.variants ) {
+        o->variants = region_variants(&args.region, beg, length);
+        o->central_variants = region_variants(&args.region, beg + length / 4, length / 2);
+        if ( args.max_variants >= 0 && o->variants > args.max_variants )
+            return 0;
+    }
+    o->repeat = region_repeat(&args.region, beg, length);
+    o->gc = thermo_window_gc(&args.profile, beg, length);
+    o->homopolymer = region_homopolymer(&args.region, beg, length);
+    o->tm = thermo_window(&args.profile, &args.thermo_opts, beg, length, &o->dg);
+    if ( (args.max_repeat >= 0 && o->repeat > args.max_repeat)
+         || (args.filter_gc && (o->gc < args.gc_limit[0] || o->gc > args.gc_limit[1]))
+         || (args.max_homopolymer >= 0 && o->homopolymer > args.max_homopolymer)
+         || (args.filter_tm && (o->tm < args.tm_limit[0] || o->tm > args.tm_limit[1])) )
+        return 0;
+    return 1;
+}
+static void push_window(struct oligo *o, const char *region, int beg, kstring_t *string)
+{
+    int length = o->length;
+    string->l = 0;
+    args.candidates_number++;
+    if ( args.filter ) {
+        if ( window_in_spec(o, beg) == 0 ) {
+            args.filtered_number++;
+            if ( region_amb(&args.region, beg, length) )
+                args.dropped_n++;
+            return;
+        }
+        ks_resize(string, length + 1);
+        int i;
+        for ( i = 0; i < length; ++i )
+            string->s[i] = toupper(region[beg+i]);
+        string->s[length] = 0;
+        string->l = length;
+    } else {
+        kputsn(region + beg, length, string);
+        o->repeat = repeat_ratio(string->s, length);
+        if ( o->repeat < 0 ) {
+            args.dropped_n++;
+            return;
+        }
+        o->gc = calculate_GC(string->s, length);
+        o->homopolymer = 0;
+        if ( thermo_required() )
+            o->tm = thermo_window(&args.profile, &args.thermo_opts, beg, length, &o->dg);
+    }
+    push_oligo(o, string->s);
+}
 // for much design regions, usually very short, try to use short oligos for better oligos
 void must_design(int cid, int start, int end)
 {
     if (args.must_design == 1) {	
 	// expand the small regions into longer one, the size of new region should consider of length of oligo and depth.
 	// the algrithm here to generate oligos based on depth is by set oligo start from the 1/n part of previous oligos
+        // last region may be planned with a different depth
+        float depth = args.depth;
+        args.depth = args.last_depth;
 	titling_design(cid, start, end);
+        args.depth = depth;
     }
 }
 // bubble design is one oligo cover two regions within a tolerant gap. There will be some fork sequence in the gap to make
@@ -469,16 +1928,26 @@ int bubble_design(int cid, int last_start, int last_end, int start, int end)
     int tail_length = end - start;
     // only works when head length smaller than oligo length, for longer region use titling_design() instead.
     assert(oligo_length > head_length);
-    if ( args.debug_mode ) {
-        debug_print("last empty: %d\tlast: %d-%d\t%s:%d-%d\t%d\tn_part: %f\tpart: %d\toffset: %d\thead length: %d\ttail length: %d",
-                    args.last_is_empty, args.last_start, args.last_end,
-                    args.design_regions->names[cid], start, end, oligo_length, n_parts, part, offset, head_length, tail_length);
-    }
 
     // if length of regions shorter than oligo length, skip the tail.
     if ( head_length + tail_length  < oligo_length )
         return 1;
-    kstring_t string = KSTRING_INIT;    
+    TRACE_BEGIN(t);
+    // fetch both regions once, the concatenated sequence contains every oligo of this bubble as a window
+    kstring_t *region = &args.region_seq;
+    region->l = 0;
+    fetch_region(cid, last_start, last_end-1, region);
+    if ( region->l != head_length ) {
+        args.dropped_length++;
+        TRACE_SPAN(&trace_bubble, t, args.design_regions->names[cid], last_start, last_end, start, end, oligo_length, 0,
+                   part, offset);
+        return 1;
+    }
+    args.bubbles_number++;
+    fetch_region(cid, start, end-1, region);
+    build_profiles(region->s, region->l, cid, last_start);
+    if ( args.variants )
+        mark_variants(cid, head_length, region->l - head_length, start);
     for (i = 0; i < n_parts; ++i ) {
         int rank = 1;
         int offset_l = i * part;
@@ -493,61 +1962,460 @@ int bubble_design(int cid, int last_start, int last_end, int start, int end)
             end_pos = end;
             start_pos = end_pos - oligo_length >= start ? end_pos - oligo_length : last_end - (oligo_length - (end_pos - start));
         }
-        int l = 0;
+        struct oligo o;
+        o.cid = cid;
+        o.start = start_pos;
+        o.end = end_pos;
+        o.length = oligo_length;
+        o.rank = rank;
         //debug_print("%d\t%d\t%d\t%d\t%d\t%d\n", start_pos, end_pos, last_start, last_end, start, end);
         if ( start_pos < start) {
-            char *head = faidx_fetch_seq(args.fai, args.design_regions->names[cid], start_pos+1, last_end, &l);
-            char *tail = faidx_fetch_seq(args.fai, args.design_regions->names[cid], start+1, end_pos, &l);            
-            kputs(head, &string);                
-            kputs(tail, &string);
-            free(head);
-            free(tail);
-            float repeat = repeat_ratio(string.s, string.l);
-            if ( repeat < 0 ) continue;
-                //error("%s, %d, %d", args.design_regions->names[cid], start_pos, end_pos);
-            
-            float gc = calculate_GC(string.s, string.l);
-            ksprintf(&args.string, "%s\t%d\t%d\t%d\t%s\t%d\t%d,%d,\t%d,%d,\t%.2f\t%.2f\t%d\n", args.design_regions->names[cid], start_pos, end_pos, oligo_length, string.s, 2, start_pos, start, last_end, end_pos, repeat, gc, rank);
-        
+            o.n_block = 2;
+            o.starts[0] = start_pos;
+            o.starts[1] = start;
+            o.ends[0] = last_end;
+            o.ends[1] = end_pos;
         } else {
-            char *seq = faidx_fetch_seq(args.fai, args.design_regions->names[cid], start_pos+1, end_pos, &l);
-            kputs(seq, &string);
-            free(seq);
-            float repeat = repeat_ratio(string.s, string.l);
-            if ( repeat < 0 ) continue;
-            
-            float gc = calculate_GC(string.s, string.l);
-            ksprintf(&args.string, "%s\t%d\t%d\t%d\t%s\t%d\t%d,\t%d,\t%.2f\t%.2f\t%d\n", args.design_regions->names[cid], start_pos, end_pos, oligo_length, string.s, 1, start_pos, end_pos, repeat, gc, rank);
-        }
-
-        if (string.l != oligo_length) {
-            fprintf(stderr, "Failed to design %s\t%d\t%d\t%d\t%s\t%d\t%d,%d,\t%d,%d,\n", args.design_regions->names[cid], start_pos, end_pos, oligo_length, string.s, 1, start_pos, start, last_end, end_pos);
+            o.n_block = 1;
+            o.starts[0] = start_pos;
+            o.ends[0] = end_pos;
+        }
+        int beg = start_pos < start ? start_pos - last_start : head_length + start_pos - start;
+        if ( beg < 0 || beg + oligo_length > region->l ) {
+            args.dropped_length++;
+            fprintf(stderr, "Failed to design %s\t%d\t%d\t%d\t%d\t%d,%d,\t%d,%d,\n", args.design_regions->names[cid], start_pos, end_pos, oligo_length, 1, start_pos, start, last_end, end_pos);
             continue;
         }
-        
-        if ( oligo_length == args.min_oligo_length ) args.n_min++;
-        else if ( oligo_length == args.max_oligo_length ) args.n_max++;
-        args.probes_number ++;
-        string.l = 0;
+        push_window(&o, region->s, beg, &args.window);
     }
-    free(string.s);
+    TRACE_SPAN(&trace_bubble, t, args.design_regions->names[cid], last_start, last_end, start, end, oligo_length,
+               (int)ceilf(n_parts), part, offset);
     return 0;
 }
-// rough design, not consider of common variants
-void titling_design(int cid, int start, int end)
+// distance of value to the target window, 0 if inside
+static inline float range_dist(float v, const float *range)
 {
-    int length = end - start;
-    int oligo_length = args.oligo_length == 0 ?
-        length < SMALL_REGION ? oligo_length_minimal : oligo_length_maxmal
-        : args.oligo_length;
-    float n_parts = (float)length/oligo_length < 1 ? args.depth : (float)length/oligo_length * args.depth;
-    int part = length/n_parts;
-    int offset =  part > oligo_length ? 0 : (oligo_length - part)/2;
-    float mid = (float)n_parts/2;
-    if ( args.debug_mode ) {
-        debug_print("last empty:%d\tlast:%d-%d\t%s:%d-%d\t%d\tn_parts: %f\tpart: %d\toffset: %d",
-                    args.last_is_empty, args.last_start, args.last_end,args.design_regions->names[cid], start, end, oligo_length, n_parts, part, offset);
+    return v < range[0] ? range[0] - v : v > range[1] ? v - range[1] : 0;
+}
+// distance of window [beg, beg+length) of the profile to target Tm and GC, distance of GC is in percent. The
+// distance to the center of windows is kept for tie-breaking.
+static float target_dist(int beg, int length, float *center_dist)
+{
+    float d = 0, c = 0;
+    if ( args.target_tm ) {
+        float tm = thermo_window(&args.profile, &args.thermo_opts, beg, length, NULL);
+        d += range_dist(tm, args.tm_range);
+        c += fabs(tm - (args.tm_range[0] + args.tm_range[1]) / 2);
+    }
+    if ( args.target_gc ) {
+        float gc = thermo_window_gc(&args.profile, beg, length);
+        d += range_dist(gc, args.gc_range) * 100;
+        c += fabs(gc - (args.gc_range[0] + args.gc_range[1]) / 2) * 100;
+    }
+    *center_dist = c;
+    return d;
+}
+// tiling with length of each oligo picked from [oligo_length_minimal, oligo_length_maxmal] to get closest to the target
+// Tm and GC windows, the next oligo starts at 1/depth of current length. All lengths at a position are evaluated in O(1)
+// each by the profile of region.
+static void targeted_design(int cid, int start, int end, const char *region, int region_start, int l, kstring_t *string)
+{
+    int pos = start;
+    for ( ;; ) {
+        int length, best_length = 0, best_start = 0;
+        float best_dist = 0, best_center = 0;
+        for ( length = oligo_length_minimal; length <= oligo_length_maxmal; ++length ) {
+            int start_pos = pos + length > end ? end - length : pos;
+            if ( start_pos < start )
+                start_pos = start;
+            int beg = start_pos - region_start;
+            if ( beg < 0 || beg + length > l )
+                continue;
+            float center;
+            float dist = target_dist(beg, length, &center);
+            if ( best_length == 0 || dist < best_dist || (dist == best_dist && center < best_center) ) {
+                best_length = length;
+                best_start = start_pos;
+                best_dist = dist;
+                best_center = center;
+            }
+        }
+        if ( best_length == 0 )
+            break;
+        struct oligo o;
+        o.cid = cid;
+        o.start = best_start;
+        o.end = best_start + best_length;
+        o.length = best_length;
+        o.n_block = 1;
+        o.starts[0] = o.start;
+        o.ends[0] = o.end;
+        // region is shorter than oligo
+        o.rank = o.end > end ? 0 : 1;
+        push_window(&o, region, best_start - region_start, string);
+        if ( o.end >= end )
+            break;
+        int step = best_length / args.depth;
+        pos = best_start + (step > 0 ? step : 1);
+    }
+}
+static inline int tile_better(const struct tile_state *a, const struct tile_state *b)
+{
+    if ( a->uncovered != b->uncovered ) return a->uncovered < b->uncovered;
+    if ( a->count != b->count ) return a->count < b->count;
+    return a->score > b->score;
+}
+// score candidates at every dense_step bases, and select a chain of tiles with adjacent starts no more than length/depth
+// apart, so each base between two tiles is covered at the depth. The first and the last bases are covered at the
+// depth as well, so the chain starts at least (depth-1)*gap before start, and ends at least that far after the last
+// tile covering end. Candidates out of spec may break the chain, the chain with the fewest uncovered bases, then the
+// fewest tiles, then the best total score is picked. The best chain ending
+// at each candidate comes from a sliding window of previous candidates, kept in a monotonic deque, or from the best
+// broken chain so far, so it is linear in region length.
+static void dense_design(int cid, int start, int end, int oligo_length, const char *region, int region_start, int l, kstring_t *string)
+{
+    int gap = oligo_length / args.depth;
+    if ( gap < 1 )
+        gap = 1;
+    // a step over gap leaves no candidate in the window of a tile
+    int step = args.dense_step < gap ? args.dense_step : gap;
+    int lead = (args.depth - 1) * gap;
+    if ( lead > oligo_length - gap )
+        lead = oligo_length - gap;
+    // the first tile starts in gap bases before start - lead, and the last one after end - oligo_length + lead
+    int first = start - lead - gap + 1;
+    if ( first < region_start )
+        first = region_start;
+    int last = end - oligo_length + lead + gap - 1;
+    if ( last + oligo_length > region_start + l )
+        last = region_start + l - oligo_length;
+    if ( last < first )
+        return;
+    int n = (last - first) / step + 1;
+    if ( n > args.m_tiles ) {
+        args.m_tiles = n;
+        args.tiles = (struct tile_state*)realloc(args.tiles, n * sizeof(struct tile_state));
+        args.deque = (int*)realloc(args.deque, n * sizeof(int));
+    }
+    struct tile_state *t = args.tiles;
+    int *dq = args.deque, head = 0, tail = 0;
+    int i, j, window = gap / step;
+    struct oligo o;
+    memset(&o, 0, sizeof(o));
+    o.length = oligo_length;
+    o.off_target = -1;
+    // best chain to break among candidates out of window, uncovered bases are counted relative to the start of the
+    // last tile; the chain starts from a virtual tile at start - lead - gap
+    struct tile_state broken = { gap + lead - start, 0, 0, -1, 1, 0 };
+    for ( j = 0; j < n; ++j ) {
+        int pos = first + j * step;
+        t[j].valid = window_in_spec(&o, pos - region_start);
+        t[j].window_score = t[j].valid ? oligo_score(&o) : 0;
+        args.scored_windows++;
+        // drop candidates out of window
+        while ( head < tail && dq[head] < j - window )
+            head++;
+        i = j - window - 1;
+        if ( i >= 0 && t[i].valid ) {
+            struct tile_state s = t[i];
+            s.uncovered -= first + i * step;
+            s.prev = i;
+            if ( tile_better(&s, &broken) )
+                broken = s;
+        }
+        if ( t[j].valid == 0 )
+            continue;
+        struct tile_state s;
+        if ( pos <= start - lead ) {
+            s.uncovered = 0;
+            s.count = 0;
+            s.score = 0;
+            s.prev = -1;
+        } else {
+            s = broken;
+            s.uncovered += pos - gap;
+        }
+        if ( head < tail && !tile_better(&s, &t[dq[head]]) ) {
+            s = t[dq[head]];
+            s.prev = dq[head];
+        }
+        t[j].uncovered = s.uncovered;
+        t[j].count = s.count + 1;
+        t[j].score = s.score + t[j].window_score;
+        t[j].prev = s.prev;
+        while ( head < tail && !tile_better(&t[dq[tail-1]], &t[j]) )
+            tail--;
+        dq[tail++] = j;
+    }
+    // the chain should reach end - oligo_length + lead, or leave the tail short of the depth
+    int best = -1;
+    struct tile_state best_state = { 0, 0, 0, 0, 0, 0 };
+    for ( j = 0; j < n; ++j ) {
+        if ( t[j].valid == 0 )
+            continue;
+        struct tile_state s = t[j];
+        int pos = first + j * step;
+        if ( pos < end - oligo_length + lead )
+            s.uncovered += end - oligo_length + lead - pos;
+        if ( best == -1 || tile_better(&s, &best_state) ) {
+            best = j;
+            best_state = s;
+        }
+    }
+    // reverse the chain by prev links, and export tiles in order
+    int n_chain = 0;
+    for ( j = best; j != -1; j = t[j].prev )
+        dq[n_chain++] = j;
+    for ( i = n_chain - 1; i >= 0; --i ) {
+        int pos = first + dq[i] * step;
+        o.cid = cid;
+        o.start = pos;
+        o.end = pos + oligo_length;
+        o.n_block = 1;
+        o.starts[0] = pos;
+        o.ends[0] = pos + oligo_length;
+        o.rank = 1;
+        push_window(&o, region, pos - region_start, string);
+    }
+}
+static inline int cover_oligo_length(void)
+{
+    return args.oligo_length == 0 ? oligo_length_maxmal : args.oligo_length;
+}
+// add a design region to set cover, windows overlapped with the region by at least half oligo length (or contain the
+// region, if shorter than oligo) and in spec are candidates
+static void cover_add_region(int cid, int start, int end)
+{
+    TRACE_BEGIN(t);
+    int oligo_length = cover_oligo_length();
+    int step = args.dense_step ? args.dense_step : 1;
+    int extend = args.fragment_size > oligo_length ? (args.fragment_size - oligo_length) / 2 : 0;
+    int target = set_cover_add_target(&args.cover, start, end, (int)(args.depth + 0.5));
+    if ( target == -1 )
+        return;
+    start = args.cover.targets[target].start;
+    int lo = start - oligo_length / 2, hi = end - oligo_length / 2;
+    if ( end - start < oligo_length ) {
+        lo = end - oligo_length;
+        hi = start;
+    }
+    if ( lo < 0 )
+        lo = 0;
+    // windows of last region are not added again
+    if ( lo <= args.cover_last )
+        lo = args.cover_last + step;
+    if ( lo > hi )
+        return;
+    args.region_seq.l = 0;
+    if ( fetch_region(cid, lo, hi + oligo_length - 1, &args.region_seq) < 0 )
+        return;
+    int l = args.region_seq.l;
+    build_profiles(args.region_seq.s, l, cid, lo);
+    if ( args.n_cover_regions == args.m_cover_regions ) {
+        args.m_cover_regions = args.m_cover_regions == 0 ? 64 : args.m_cover_regions << 1;
+        args.cover_regions = (struct cover_region*)realloc(args.cover_regions, args.m_cover_regions * sizeof(struct cover_region));
+    }
+    struct cover_region *r = &args.cover_regions[args.n_cover_regions++];
+    r->start = lo;
+    r->end = lo + l;
+    r->first = args.cover.n_cands;
+    struct oligo o;
+    memset(&o, 0, sizeof(o));
+    o.length = oligo_length;
+    int pos;
+    for ( pos = lo; pos <= hi && pos - lo + oligo_length <= l; pos += step ) {
+        args.cover_last = pos;
+        args.scored_windows++;
+        if ( window_in_spec(&o, pos - lo) )
+            set_cover_add_candidate(&args.cover, pos - extend, pos + oligo_length + extend);
+    }
+    r->last = args.cover.n_cands;
+    TRACE_SPAN(&trace_cover_region, t, args.design_regions->names[cid], start, end, r->last - r->first);
+}
+// select candidates of current chromosome and push them in order
+static void cover_flush(void)
+{
+    if ( args.cover.n_targets == 0 )
+        return;
+    int oligo_length = cover_oligo_length();
+    int extend = args.fragment_size > oligo_length ? (args.fragment_size - oligo_length) / 2 : 0;
+    // oligos of the chromosome are selected together
+    set_frontier(args.cover_cid, 0);
+    TRACE_BEGIN(t);
+    set_cover_select(&args.cover);
+    TRACE_SPAN(&trace_cover_select, t, args.design_regions->names[args.cover_cid], args.cover.n_targets, args.cover.n_cands,
+               (int)args.cover.uncovered);
+    args.cover_candidates += args.cover.n_cands;
+    args.uncovered_bases += args.cover.uncovered;
+    int i, j;
+    for ( i = 0; i < args.n_cover_regions; ++i ) {
+        struct cover_region *r = &args.cover_regions[i];
+        for ( j = r->first; j < r->last && args.cover.cands[j].selected == 0; ++j );
+        if ( j == r->last )
+            continue;
+        args.region_seq.l = 0;
+        if ( fetch_region(args.cover_cid, r->start, r->end - 1, &args.region_seq) < 0 )
+            continue;
+        build_profiles(args.region_seq.s, args.region_seq.l, args.cover_cid, r->start);
+        for ( ; j < r->last; ++j ) {
+            if ( args.cover.cands[j].selected == 0 )
+                continue;
+            int pos = args.cover.cands[j].start + extend;
+            struct oligo o;
+            o.cid = args.cover_cid;
+            o.start = pos;
+            o.end = pos + oligo_length;
+            o.length = oligo_length;
+            o.n_block = 1;
+            o.starts[0] = pos;
+            o.ends[0] = pos + oligo_length;
+            o.rank = 1;
+            push_window(&o, args.region_seq.s, pos - r->start, &args.window);
+        }
+    }
+    set_cover_clear(&args.cover);
+    args.n_cover_regions = 0;
+    args.cover_last = INT_MIN;
+}
+// set cover mode, design regions are collected for each chromosome, and selected before next chromosome
+static int cover_design_core(void)
+{
+    struct bed_line *line = &args.line;
+    if ( bed_getline(args.design_regions, line) ) {
+        cover_flush();
+        return 1;
+    }
+    args.regions_number++;
+    if ( args.cover_cid != line->chrom_id ) {
+        cover_flush();
+        args.cover_cid = line->chrom_id;
     }
+    if ( args.region_depth )
+        args.depth = args.region_depth[args.i_region++];
+    cover_add_region(line->chrom_id, line->start, line->end);
+    return 0;
+}
+// variant penalty of window, sites in the central half count twice
+static inline int window_variants(int beg, int len)
+{
+    return region_variants(&args.region, beg, len) + region_variants(&args.region, beg + len / 4, len / 2);
+}
+// shift window by up to max_shift bases to the nearest place with the fewest variant sites
+static int shift_window(int beg, int len, int l, int max_shift)
+{
+    int best = beg, best_penalty = window_variants(beg, len);
+    int d;
+    for ( d = 1; d <= max_shift && best_penalty; ++d ) {
+        if ( beg - d >= 0 && window_variants(beg - d, len) < best_penalty ) {
+            best = beg - d;
+            best_penalty = window_variants(best, len);
+        }
+        if ( beg + d + len <= l && window_variants(beg + d, len) < best_penalty ) {
+            best = beg + d;
+            best_penalty = window_variants(best, len);
+        }
+    }
+    if ( best != beg )
+        args.shifted_number++;
+    return best;
+}
+#define VCF_CHUNK_SIZE (1<<20)
+// reference and alternate allele oligos of one site in target VCF. Sites are read in coordinate order, and the reference
+// is fetched in chunks of VCF_CHUNK_SIZE, so each part of reference is fetched only once. Each allele is put in the
+// middle of its oligo, and the flanks are copied from the chunk.
+static int vcf_design_core(void)
+{
+    bcf1_t *rec = args.vcf_rec;
+    if ( bcf_read(args.vcf_fp, args.vcf_hdr, rec) != 0 )
+        return 1;
+    bcf_unpack(rec, BCF_UN_STR);
+    args.site_number++;
+    int oligo_length = args.oligo_length == 0 ? oligo_length_maxmal : args.oligo_length;
+    int pos = rec->pos, rlen = rec->rlen;
+    set_frontier(rec->rid, pos);
+    int beg = pos - oligo_length, end = pos + rlen + oligo_length;
+    if ( rlen >= oligo_length || beg < 0 ) {
+        args.skipped_sites++;
+        return 0;
+    }
+    if ( rec->rid != args.vcf_chunk_rid || beg < args.vcf_chunk_start || end > args.vcf_chunk_start + args.vcf_chunk_l ) {
+        if ( rec->rid == args.vcf_chunk_rid && beg < args.vcf_chunk_start )
+            warnings("%s is not sorted at %s:%d.", args.vcf_fname, bcf_seqname(args.vcf_hdr, rec), pos + 1);
+        free(args.vcf_chunk);
+        args.vcf_chunk_rid = rec->rid;
+        args.vcf_chunk_start = beg;
+        int chunk_end = end - beg > VCF_CHUNK_SIZE ? end : beg + VCF_CHUNK_SIZE;
+        args.vcf_chunk = fetch_seq(bcf_seqname(args.vcf_hdr, rec), beg, chunk_end - 1, &args.vcf_chunk_l);
+        if ( args.vcf_chunk == NULL )
+            args.vcf_chunk_l = 0;
+    }
+    // out of chromosome
+    if ( end > args.vcf_chunk_start + args.vcf_chunk_l ) {
+        args.skipped_sites++;
+        return 0;
+    }
+    // site and its flanks in the chunk
+    const char *ref = args.vcf_chunk + beg - args.vcf_chunk_start;
+    pos -= beg;
+    kstring_t *seq = &args.allele_seq, *tag = &args.allele_tag;
+    int i;
+    for ( i = 0; i < rec->n_allele; ++i ) {
+        const char *allele = rec->d.allele[i];
+        int j, alen = strlen(allele);
+        // symbolic, missing and ambiguous alleles are skipped
+        for ( j = 0; j < alen && seq_nt4_table[(unsigned char)allele[j]] < 4; ++j );
+        if ( j < alen || alen >= oligo_length )
+            continue;
+        int left = (oligo_length - alen) / 2, right = oligo_length - alen - left;
+        int start = pos - left;
+        seq->l = 0;
+        kputsn(ref + start, left, seq);
+        // reference allele is copied from the reference, alternate alleles are substituted
+        if ( i == 0 )
+            kputsn(ref + pos, rlen, seq);
+        else
+            kputsn(allele, alen, seq);
+        kputsn(ref + pos + rlen, right, seq);
+        tag->l = 0;
+        if ( rec->d.id[0] == '.' && rec->d.id[1] == 0 )
+            ksprintf(tag, "%s:%d", bcf_seqname(args.vcf_hdr, rec), rec->pos + 1);
+        else
+            kputs(rec->d.id, tag);
+        kputc(':', tag);
+        kputs(allele, tag);
+        struct oligo o;
+        o.cid = rec->rid;
+        o.length = seq->l;
+        o.rank = 1;
+        o.start = beg + start;
+        o.end = beg + pos + rlen + right;
+        if ( i == 0 || alen == rlen ) {
+            o.n_block = 1;
+            o.starts[0] = o.start;
+            o.ends[0] = o.end;
+        } else {
+            // the padding base shared by both alleles stays in the first block
+            int shared = 0;
+            while ( shared < alen && shared < rlen && toupper(allele[shared]) == toupper(rec->d.allele[0][shared]) )
+                shared++;
+            o.n_block = 2;
+            o.starts[0] = o.start;
+            o.ends[0] = beg + pos + shared;
+            o.starts[1] = beg + pos + rlen;
+            o.ends[1] = o.end;
+        }
+        build_profiles(seq->s, seq->l, -1, 0);
+        args.tag = tag->s;
+        push_window(&o, seq->s, 0, &args.window);
+        args.tag = 0;
+    }
+    return 0;
+}
+// oligos at fixed tiling positions of the region, oligos are shifted to avoid common variants if specified
+static void tiling_parts(int cid, int start, int end, int oligo_length, float n_parts, int part, int offset,
+                         const char *region, int region_start, int l)
+{
+    float mid = (float)n_parts/2;
     int i;
     for (i = 0; i < n_parts; ++i) {
 	int rank = 1;
@@ -561,36 +2429,79 @@ void titling_design(int cid, int start, int end)
 	    start_pos = end - oligo_length;
 	    if (start_pos < start) rank = 0; 
 	}
-	int l = 0;
-	char *seq = faidx_fetch_seq(args.fai, args.design_regions->names[cid], start_pos+1, start_pos+oligo_length, &l);
-	if (l < oligo_length) {
-	    if (seq) free(seq);
+	int beg = start_pos - region_start;
+	if (beg < 0 || beg + oligo_length > l)
 	    continue;
-	}
-	float repeat = repeat_ratio(seq, oligo_length);
-        if ( repeat < 0 ) continue;
-	float gc = calculate_GC(seq, oligo_length);
-	ksprintf(&args.string, "%s\t%d\t%d\t%d\t%s\t%d\t%d,\t%d,\t%.2f\t%.2f\t%d\n", args.design_regions->names[cid], start_pos, start_pos + oligo_length, oligo_length, seq, 1, start_pos, start_pos+oligo_length, repeat, gc, rank);
-	args.probes_number ++;
-
-        if ( oligo_length == args.min_oligo_length ) args.n_min++;
-        else if ( oligo_length == args.max_oligo_length ) args.n_max++;
-
-
-        free(seq);
+        if ( args.variants && region_variants(&args.region, beg, oligo_length) ) {
+            beg = shift_window(beg, oligo_length, l, args.variant_shift >= 0 ? args.variant_shift : part / 4);
+            start_pos = beg + region_start;
+        }
+	struct oligo o;
+	o.cid = cid;
+	o.start = start_pos;
+	o.end = start_pos + oligo_length;
+	o.length = oligo_length;
+	o.n_block = 1;
+	o.starts[0] = start_pos;
+	o.ends[0] = start_pos + oligo_length;
+	o.rank = rank;
+	push_window(&o, region, beg, &args.window);
     }
 }
+// tiling design of a region, with the flanks fetched once
+void titling_design(int cid, int start, int end)
+{
+    TRACE_BEGIN(t);
+    int length = end - start;
+    int oligo_length = args.oligo_length == 0 ?
+        length < SMALL_REGION ? oligo_length_minimal : oligo_length_maxmal
+        : args.oligo_length;
+    float n_parts = (float)length/oligo_length < 1 ? args.depth : (float)length/oligo_length * args.depth;
+    int part = length/n_parts;
+    int offset =  part > oligo_length ? 0 : (oligo_length - part)/2;
+    // fetch the region with flanks once, all oligos are windows of it
+    int l = 0;
+    int flank = args.oligo_length == 0 ? oligo_length_maxmal : oligo_length;
+    int region_start = start > flank ? start - flank : 0;
+    args.region_seq.l = 0;
+    if ( fetch_region(cid, region_start, end+flank-1, &args.region_seq) < 0 )
+        return;
+    const char *region = args.region_seq.s;
+    l = args.region_seq.l;
+    build_profiles(region, l, cid, region_start);
+    if ( args.target_tm || args.target_gc )
+        targeted_design(cid, start, end, region, region_start, l, &args.window);
+    // short regions keep the clamped tiling
+    else if ( args.dense_step && length >= oligo_length )
+        dense_design(cid, start, end, oligo_length, region, region_start, l, &args.window);
+    else
+        tiling_parts(cid, start, end, oligo_length, n_parts, part, offset, region, region_start, l);
+    TRACE_SPAN(&trace_titling, t, args.design_regions->names[cid], start, end, oligo_length, (int)ceilf(n_parts), part, offset);
+}
 // format of oligos file.
 // chr, start(0-based), end, seq_length, sequences, n_blocks, blocks(seperated by commas, sometime the sequences are consist of different parts from reference sequences), gc percent, type, rank, score
 int generate_oligos_core()
 {
+    if ( args.vcf_fname )
+        return vcf_design_core();
+    if ( args.set_cover )
+        return cover_design_core();
     struct bed_line *line = &args.line;
     if ( bed_getline(args.design_regions, line) ) {
         if (args.last_is_empty == 1) {
+            set_frontier(args.last_chrom_id, args.last_start);
             must_design( args.last_chrom_id, args.last_start, args.last_end);
         }
 	return 1;
     }
+    args.regions_number++;
+    // the last short region is designed with this one
+    if ( args.last_is_empty == 1 )
+        set_frontier(args.last_chrom_id, args.last_start);
+    else
+        set_frontier(line->chrom_id, line->start);
+    if ( args.region_depth )
+        args.depth = args.region_depth[args.i_region++];
     // if databases is not merged properly    
     if ( args.last_chrom_id == line->chrom_id )  {
         // totally overlapped
@@ -653,17 +2564,52 @@ int generate_oligos_core()
     args.last_chrom_id = line->chrom_id;
     args.last_start = line->start;
     args.last_end = line->end;
+    args.last_depth = args.depth;
 
     return 0;
 }
-void generate_oligos()
+// tabix meta of probe file, same as bed files : 0-based start in column 2, end in column 3 and comments start with '#'
+static void set_index_meta(hts_idx_t *idx)
 {
-    args.fai = fai_load(args.fasta_fname);
-    if (args.fai == NULL ) {
-	if (fai_build(args.fasta_fname) == -1)
-	    error("Failed to build the index of %s.", args.fasta_fname);
-	args.fai = fai_load(args.fasta_fname);
+    int i;
+    uint32_t x[7] = { TBX_UCSC, 1, 2, 3, '#', 0, 0 };
+    kstring_t meta = KSTRING_INIT;
+    for ( i = 0; i < args.n_chroms; ++i )
+        x[6] += strlen(args.chrom_names[i]) + 1;
+    kputsn((char*)x, sizeof(x), &meta);
+    for ( i = 0; i < args.n_chroms; ++i )
+        kputsn(args.chrom_names[i], strlen(args.chrom_names[i]) + 1, &meta);
+    hts_idx_set_meta(idx, meta.l, (uint8_t*)meta.s, 0);
+}
+// sequences are elided, keep the checksum of each contig so materialize can check the reference
+static void reference_header(kstring_t *str)
+{
+    int i, len;
+    char hex[33];
+    kputs("##sequence=none\n", str);
+    ksprintf(str, "##reference=%s\n", args.fasta_fname);
+    for ( i = 0; i < args.n_chroms; ++i ) {
+        char *seq = fetch_seq(args.chrom_names[i], 0, INT_MAX, &len);
+        if ( seq == NULL )
+            error("Failed to fetch %s from %s.", args.chrom_names[i], args.fasta_fname);
+        seq_md5_hex(seq, len, hex);
+        ksprintf(str, "##contig=<ID=%s,length=%d,M5=%s>\n", args.chrom_names[i], len, hex);
+        free(seq);
+    }
+}
+// contigs of the reference in order, so merge_oligos orders probe files designed on the same reference without -r
+static void contig_header(kstring_t *str)
+{
+    int i;
+    for ( i = 0; i < faidx_nseq(args.fai); ++i ) {
+        const char *name = faidx_iseq(args.fai, i);
+        ksprintf(str, "##contig=<ID=%s,length=%d>\n", name, faidx_seq_len(args.fai, name));
     }
+}
+void generate_oligos()
+{
+    load_reference();
+    probe_format_init(&args.format, args.chrom_names, args.n_chroms);
     // struct bed_line line = BED_LINE_INIT;
     
     // create probe file in the out directary
@@ -672,11 +2618,18 @@ void generate_oligos()
 	kputs(args.output_dir, &probe_path);
     if (probe_path.l && probe_path.s[probe_path.l-1] != '/')
 	kputc('/', &probe_path);
-    kputs("probes.txt.gz", &probe_path);    
-    BGZF *fp = bgzf_open(probe_path.s, "w");
-    free(probe_path.s);    
-    if (fp == NULL)
-	error("Failed to write %s : %s.", probe_path.s, strerror(errno));
+    kputs(args.binary ? "probes.bin" : "probes.txt.gz", &probe_path);
+    BGZF *fp = NULL;
+    if ( args.binary ) {
+        args.probe_writer = probe_writer_open(probe_path.s);
+        if ( args.probe_writer == NULL )
+            error("Failed to write %s.", probe_path.s);
+    } else if ( args.n_threads == 1 ) {
+        fp = bgzf_open(probe_path.s, "w");
+        if (fp == NULL)
+            error("Failed to write %s : %s.", probe_path.s, strerror(errno));
+        args.fp = fp;
+    }
 
     int oligo_length = args.oligo_length == 0 ? oligo_length_maxmal : args.oligo_length;
     // write header to probe file
@@ -687,21 +2640,138 @@ void generate_oligos()
     ksprintf(&header, "##max_length=%d\n", oligo_length);
     // ksprintf(&header, "##oligo_number=%u\n", args.probes_number); // should always be 0
     ksprintf(&header, "##Command=%s\n", args.commands.s);    
-    kputs("#chrom\tstart\tend\tseq_length\tsequence\tn_block\tstarts\tends\trepeat_ratio\tGC_content\trank\n", &header);
-    if ( bgzf_write(fp, header.s, header.l) != header.l )
-        error ( "Write error : %d.", fp->errcode);
+    if ( args.no_sequence )
+        reference_header(&header);
+    else
+        contig_header(&header);
+    kputs("#chrom\tstart\tend\tseq_length\tsequence\tn_block\tstarts\tends\trepeat_ratio\tGC_content\trank", &header);
+    if ( args.offtarget )
+        kputs("\toff_target", &header);
+    if ( args.fm )
+        kputs("\tseed_occ", &header);
+    if ( args.tm )
+        kputs("\tTm\tdG", &header);
+    if ( args.secondary )
+        kputs("\thairpin\tself_dimer", &header);
+    if ( args.score )
+        kputs("\tscore", &header);
+    if ( args.vcf_fname )
+        kputs("\tvariant", &header);
+    kputc('\n', &header);
+    if ( args.probe_writer ) {
+        int i;
+        for ( i = 0; i < args.n_chroms; ++i )
+            probe_writer_add_name(args.probe_writer, args.chrom_names[i]);
+        probe_writer_set_header(args.probe_writer, header.s, header.l);
+    }
+    else {
+        uint64_t offset0;
+        if ( fp ) {
+            if ( bgzf_write(fp, header.s, header.l) != header.l )
+                error ( "Write error : %d.", fp->errcode);
+            if ( bgzf_flush(fp) != 0 )
+                error("Write error : %d.", fp->errcode);
+            offset0 = bgzf_tell(fp);
+        }
+        else {
+            // probes are compressed in shards by the thread pool, and concatenated after the header
+            if ( args.pool == NULL ) {
+                args.pool = t_pool_init(args.n_threads * 2, args.n_threads);
+                args.results = t_results_queue_init();
+            }
+            args.shards = probe_shards_open(probe_path.s, header.s, header.l, args.pool, args.n_threads);
+            if ( args.shards == NULL )
+                error("Failed to write %s : %s.", probe_path.s, strerror(errno));
+            offset0 = probe_shards_tell(args.shards);
+        }
+        // contigs longer than 2^29 are out of the range of tabix index
+        int i, bits = 0;
+        for ( i = 0; i < args.n_chroms; ++i ) {
+            int len = faidx_seq_len(args.fai, args.chrom_names[i]);
+            while ( bits < 31 && len > 1 << bits ) bits++;
+        }
+        args.idx_fmt = bits > 29 ? HTS_FMT_CSI : HTS_FMT_TBI;
+        if ( args.idx_fmt == HTS_FMT_CSI )
+            args.idx = hts_idx_init(args.n_chroms, HTS_FMT_CSI, offset0, 14, (bits - 14 + 2) / 3);
+        else
+            args.idx = hts_idx_init(args.n_chroms, HTS_FMT_TBI, offset0, 14, 5);
+        if ( args.shards )
+            probe_shards_set_index(args.shards, args.idx);
+    }
     free(header.s);
     
+    // stages of each region are switched in the design loop
+    run_stats_phase(STAGE_SCORE);
     while (1) {	
-	if ( generate_oligos_core() ) break;	
-	if ( args.string.l ) {
-	    if ( bgzf_write(fp , args.string.s, args.string.l) != args.string.l)
-                error("Writer error : %d.", fp->errcode);
-	    args.string.l = 0;
-	}	
+	int ret = generate_oligos_core();
+	// export the remain oligos at the end
+	if ( ret ) {
+            flush_oligos();
+            export_oligos(1);
+            break;
+        }
     }    
+    run_stats_phase(STAGE_COMPRESS);
 
-    bgzf_close(fp);
+    if ( args.probe_writer ) {
+        if ( probe_writer_close(args.probe_writer) )
+            error("Failed to close binary probe file : %s.", strerror(errno));
+        args.probe_writer = NULL;
+    }
+    else if ( args.shards ) {
+        if ( probe_shards_close(args.shards, &args.idx) )
+            error("Failed to close %s : %s.", probe_path.s, strerror(errno));
+        args.shards = NULL;
+        if ( args.idx )
+            set_index_meta(args.idx);
+    }
+    else {
+        if ( args.idx ) {
+            hts_idx_finish(args.idx, bgzf_tell(fp));
+            set_index_meta(args.idx);
+        }
+        bgzf_close(fp);
+        args.fp = NULL;
+    }
+    if ( args.binary == 0 ) {
+        if ( args.idx && hts_idx_save(args.idx, probe_path.s, args.idx_fmt) != 0 )
+            warnings("Failed to save the index of %s.", probe_path.s);
+        hts_idx_destroy(args.idx);
+        args.idx = NULL;
+    }
+    struct stat st;
+    if ( stat(probe_path.s, &st) == 0 )
+        args.written_bytes = st.st_size;
+    free(probe_path.s);
+}
+// counters of the run, called before memory is cleaned
+static void set_stats_counts(void)
+{
+    if ( args.vcf_fname ) {
+        run_stats_set("sites", args.site_number);
+        run_stats_set("skipped_sites", args.skipped_sites);
+    } else {
+        run_stats_set("target_regions", args.target_regions->regions);
+        run_stats_set("design_regions", args.design_regions->regions);
+        run_stats_set("regions", args.regions_number);
+        run_stats_set("reference_chunks", args.ref_chunks);
+    }
+    run_stats_set("candidates", args.candidates_number);
+    if ( args.dense_step || args.set_cover )
+        run_stats_set("scored_windows", args.scored_windows);
+    run_stats_set("emitted", args.probes_number);
+    run_stats_set("dropped_by_n", args.dropped_n);
+    run_stats_set("dropped_by_length_mismatch", args.dropped_length);
+    run_stats_set("filtered", args.filtered_number);
+    run_stats_set("rejected", args.rejected_number[0] + args.rejected_number[1] + args.rejected_number[2] + args.rejected_number[3]);
+    run_stats_set("duplicates", args.dedup ? args.dedup->duplicates : 0);
+    run_stats_set("bubbles", args.bubbles_number);
+    run_stats_set("threads", args.n_threads);
+    // the target file, and bases fetched from the reference
+    struct stat st;
+    run_stats_set("bytes_read", args.fetched_bytes + (args.input_bed_fname && stat(args.input_bed_fname, &st) == 0 ? st.st_size : 0));
+    run_stats_set("bytes_formatted", args.formatted_bytes);
+    run_stats_set("bytes_written", args.written_bytes);
 }
 void export_summary_reports()
 {
@@ -723,17 +2793,51 @@ void export_summary_reports()
     kputs("predict_regions.bed", &path);
     bed_save(args.predict_regions, path.s);
 
-    fprintf(stdout, "Target regions : %u\n", args.target_regions->regions);
-    fprintf(stdout, "Target sizes : %"PRIu64"\n", args.target_regions->length);
-    fprintf(stdout, "Designed regions : %u\n", args.design_regions->regions);
-    fprintf(stdout, "Designed sizes : %"PRIu64"\n", args.design_regions->length);
-    fprintf(stdout, "Designed coverage : %.2fx\n", args.depth);
+    if ( args.vcf_fname ) {
+        fprintf(stdout, "Target variant sites : %u\n", args.site_number);
+        fprintf(stdout, "Skipped sites (long allele or out of chromosome) : %u\n", args.skipped_sites);
+    } else {
+        fprintf(stdout, "Target regions : %u\n", args.target_regions->regions);
+        fprintf(stdout, "Target sizes : %"PRIu64"\n", args.target_regions->length);
+        fprintf(stdout, "Designed regions : %u\n", args.design_regions->regions);
+        fprintf(stdout, "Designed sizes : %"PRIu64"\n", args.design_regions->length);
+    }
+    fprintf(stdout, "Designed coverage : %.2fx\n", args.depth_cap);
+    if ( args.max_oligos )
+        fprintf(stdout, "Oligo budget : %d (planned %.0f, depth %.2f ~ %.2fx)\n", args.max_oligos, args.planned_oligos, args.planned_depth[0], args.planned_depth[1]);
     //fprintf(stdout, "Coverage of target regions :  %.3f\n", );
     fprintf(stdout, "Total number of oligos : %u\n", args.probes_number);
-    if ( args.oligo_length == 0 )
-        fprintf(stdout, "Oligo length : %d (%"PRIu64"), %d (%"PRIu64")\n", args.min_oligo_length, args.n_min, args.max_oligo_length, args.n_max);
-    else 
+    if ( args.max_seed_occ )
+        fprintf(stdout, "Rejected oligos (seed occurrences > %"PRId64") : %u\n", args.max_seed_occ, args.rejected_number[0]);
+    if ( args.max_hairpin >= 0 )
+        fprintf(stdout, "Rejected oligos (hairpin stem > %d) : %u\n", args.max_hairpin, args.rejected_number[1]);
+    if ( args.max_dimer >= 0 )
+        fprintf(stdout, "Rejected oligos (self-dimer stretch > %d) : %u\n", args.max_dimer, args.rejected_number[2]);
+    if ( args.max_offtarget >= 0 )
+        fprintf(stdout, "Rejected oligos (off-target loci > %d) : %u\n", args.max_offtarget, args.rejected_number[3]);
+    if ( args.filter )
+        fprintf(stdout, "Filtered candidates (out of spec) : %u\n", args.filtered_number);
+    if ( args.variants ) {
+        fprintf(stdout, "Common variant sites : %"PRIu64"\n", args.variants->n_sites);
+        fprintf(stdout, "Oligos shifted to avoid variants : %u\n", args.shifted_number);
+        fprintf(stdout, "Oligos overlapping variants : %u\n", args.variant_number);
+    }
+    if ( args.dedup )
+        fprintf(stdout, "Duplicated oligos (dropped) : %"PRIu64"\n", args.dedup->duplicates);
+    if ( args.set_cover ) {
+        fprintf(stdout, "Set cover candidates : %"PRIu64"\n", args.cover_candidates);
+        fprintf(stdout, "Set cover unmet coverage (base x depth) : %"PRIu64"\n", args.uncovered_bases);
+    }
+    if ( args.oligo_length == 0 ) {
+        int i;
+        fprintf(stdout, "Oligo length (number) :");
+        for ( i = 0; i <= oligo_length_maxmal; ++i )
+            if ( args.length_hist[i] )
+                fprintf(stdout, " %d (%"PRIu64")", i, args.length_hist[i]);
+        fprintf(stdout, "\n");
+    } else {
         fprintf(stdout, "Oligo length : %d \n", args.oligo_length);
+    }
     free(path.s);
 }
 void clean_memory(void)
@@ -743,19 +2847,71 @@ void clean_memory(void)
     bed_destroy(args.predict_regions);    
     fai_destroy(args.fai);
     free(args.string.s);
+    free(args.batch.a);
+    free(args.batch.seq.s);
+    free(args.pending.a);
+    free(args.pending.seq.s);
+    free(args.line_ends);
+    free(args.ref_chunk);
+    free(args.region_seq.s);
+    free(args.window.s);
+    free(args.trace_path.s);
+    probe_format_destroy(&args.format);
+    if ( args.pool ) {
+        t_pool_flush(args.pool);
+        t_pool_destroy(args.pool, 0);
+        t_results_queue_destroy(args.results);
+    }
+    if ( args.jobs ) {
+        int i;
+        for ( i = 0; i < args.n_threads; ++i )
+            mini_query_buf_destroy(&args.jobs[i].buf);
+        free(args.jobs);
+    }
+    free(args.offtarget_ids);
+    mini_index_destroy(args.offtarget);
+    fm_index_destroy(args.fm);
+    thermo_profile_destroy(&args.profile);
+    free(args.length_hist);
+    region_profile_destroy(&args.region);
+    free(args.tiles);
+    free(args.deque);
+    set_cover_destroy(&args.cover);
+    free(args.cover_regions);
+    free(args.region_depth);
+    dedup_destroy(args.dedup);
+    variant_sites_destroy(args.variants);
+    if ( args.vcf_fp ) {
+        free(args.chrom_names);
+        bcf_destroy(args.vcf_rec);
+        bcf_hdr_destroy(args.vcf_hdr);
+        hts_close(args.vcf_fp);
+        free(args.vcf_chunk);
+        free(args.allele_seq.s);
+        free(args.allele_tag.s);
+    }
 }
 int main(int argc, char **argv)
 {
     if (argc == 0)
 	return usage();
     
+    run_stats_start();
     if ( parse_args(--argc, ++argv) != 0 ) 
 	return 1;
     
     generate_oligos();
     
+    run_stats_phase(STAGE_SUMMARY);
     export_summary_reports();
     
+    if ( args.stats_fname ) {
+        set_stats_counts();
+        if ( run_stats_write(args.stats_fname, "generate_oligos", OLIGOS_VERSION) )
+            warnings("Failed to write %s : %s.", args.stats_fname, strerror(errno));
+    }
+    if ( args.trace_fname && trace_write(args.trace_fname, "generate_oligos", OLIGOS_VERSION) )
+        warnings("Failed to write %s : %s.", args.trace_fname, strerror(errno));
     clean_memory();
     LOG_print("%u oligos were generated. See probe.txt.gz for details.", args.probes_number);
     LOG_print("Sucess.");
@@ -0,0 +1,450 @@
+// materialize.c - fill the sequences of a coordinate-only probe file (generate_oligos -no_sequence) back from the
+// reference genome.
+//
+// The probe file is sorted in the order of contigs, so the reference is read in one sequential pass : each contig is
+// fetched once when the first probe of it comes, and checked against the length and MD5 recorded in the header of
+// probe file. Lines are grouped in batches of the same contig and filled by the worker threads, batches are written in
+// the input order, so the output is the same as the probe file exported with sequences.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include "utils.h"
+#include "number.h"
+#include "seq_utils.h"
+#include "htslib/kstring.h"
+#include "htslib/khash.h"
+#include "htslib/faidx.h"
+#include "htslib/bgzf.h"
+#include "htslib/tbx.h"
+#include "cram/thread_pool.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+#define BATCH_LINES 8192
+
+KHASH_MAP_INIT_STR(name, int)
+
+// contig recorded in the header of probe file
+struct contig {
+    char *name;
+    int length;
+    char md5[33];
+    // fetched sequence, shared by batches of the contig
+    char *seq;
+    int refs;
+};
+
+struct batch {
+    struct contig *contig;
+    int n;
+    // first line of the batch in the probe file
+    uint64_t line;
+    kstring_t in;
+    kstring_t out;
+    // line failed to fill, 0 for none
+    uint64_t bad_line;
+};
+
+struct args {
+    const char *fasta_fname;
+    const char *input_fname;
+    const char *output_fname;
+    int n_threads;
+    faidx_t *fai;
+    int n_contigs;
+    int m_contigs;
+    struct contig *contigs;
+    khash_t(name) *names;
+    BGZF *in;
+    BGZF *out;
+    t_pool *pool;
+    t_results_queue *results;
+    // batches dispatched and not written yet
+    int n_pending;
+    uint64_t n_lines;
+} args = {
+    .fasta_fname = 0,
+    .input_fname = 0,
+    .output_fname = 0,
+    .n_threads = 1,
+    .fai = 0,
+    .n_contigs = 0,
+    .m_contigs = 0,
+    .contigs = 0,
+    .names = 0,
+    .in = 0,
+    .out = 0,
+    .pool = 0,
+    .results = 0,
+    .n_pending = 0,
+    .n_lines = 0,
+};
+
+static int quiet_mode = 0;
+
+int usage()
+{
+    fprintf(stderr,
+	    "materialize - fill sequences of a coordinate-only probe file from the reference genome.\n"
+	    "Usage: \n"
+	    "materialize -r hg19.fa -i probes.txt.gz -o probes.full.txt.gz\n"
+	    "Options:\n"
+	    "  -r, -fasta [fasta file]\n"
+	    "            reference genome sequences, the same as generate_oligos -no_sequence used.\n"
+	    "  -i [file]\n"
+	    "            coordinate-only probe file, \"-\" for stdin.\n"
+	    "  -o [file]\n"
+	    "            output probe file, bgzipped and tabix indexed.\n"
+	    "  -t, -threads [1]\n"
+	    "            threads used to fill and compress sequences.\n"
+	    "  -quiet\n"
+	    "            quiet mode.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int parse_args(int argc, char **argv)
+{
+    int i;
+    const char *threads = 0;
+    for (i = 0; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	if ( strcmp(a, "-quiet") == 0 ) {
+	    quiet_mode = 1;
+	    continue;
+	}
+	const char **var = 0;
+	if ( (strcmp(a, "-r") == 0 || strcmp(a, "-fasta") == 0) && args.fasta_fname == 0 )
+	    var = &args.fasta_fname;
+	else if ( strcmp(a, "-i") == 0 && args.input_fname == 0 )
+	    var = &args.input_fname;
+	else if ( strcmp(a, "-o") == 0 && args.output_fname == 0 )
+	    var = &args.output_fname;
+	else if ( (strcmp(a, "-t") == 0 || strcmp(a, "-threads") == 0) && threads == 0 )
+	    var = &threads;
+
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return -2;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( args.fasta_fname == 0 )
+	error("Required a reference genome sequence. Use -r or -fasta to specify.");
+    if ( args.input_fname == 0 )
+	error("Required a probe file. Use -i to specify.");
+    if ( args.output_fname == 0 )
+	error("Required an output file. Use -o to specify.");
+    if ( threads ) {
+	args.n_threads = str2int((char*)threads);
+	if ( args.n_threads < 1 ) args.n_threads = 1;
+    }
+    args.fai = fai_load(args.fasta_fname);
+    if ( args.fai == NULL )
+	error("Failed to load index of %s.", args.fasta_fname);
+    args.in = bgzf_open(args.input_fname, "r");
+    if ( args.in == NULL )
+	error("Failed to open %s : %s.", args.input_fname, strerror(errno));
+    args.out = bgzf_open(args.output_fname, "w");
+    if ( args.out == NULL )
+	error("Failed to write %s : %s.", args.output_fname, strerror(errno));
+    if ( args.n_threads > 1 ) {
+	bgzf_mt(args.out, args.n_threads, 256);
+	args.pool = t_pool_init(args.n_threads * 2, args.n_threads);
+	args.results = t_results_queue_init();
+    }
+    args.names = kh_init(name);
+    return 0;
+}
+
+// ##contig=<ID=chr1,length=249250621,M5=1b22b98cdeb4a9304cb5d48026a85128>
+static void parse_contig(const char *line)
+{
+    const char *id = strstr(line, "ID=");
+    const char *length = strstr(line, ",length=");
+    const char *md5 = strstr(line, ",M5=");
+    if ( id == NULL || length == NULL || md5 == NULL || length < id || strlen(md5) < 4 + 32 )
+	error("Bad contig line : %s", line);
+    if ( args.n_contigs == args.m_contigs ) {
+	args.m_contigs = args.m_contigs ? args.m_contigs * 2 : 64;
+	args.contigs = (struct contig*)realloc(args.contigs, args.m_contigs * sizeof(struct contig));
+    }
+    struct contig *c = &args.contigs[args.n_contigs];
+    memset(c, 0, sizeof(*c));
+    c->name = strndup(id + 3, length - id - 3);
+    c->length = atoi(length + 8);
+    memcpy(c->md5, md5 + 4, 32);
+    c->md5[32] = '\0';
+    int ret;
+    khiter_t k = kh_put(name, args.names, c->name, &ret);
+    if ( ret == 0 )
+	error("Duplicated contig %s in header.", c->name);
+    kh_val(args.names, k) = args.n_contigs++;
+}
+
+// copy header lines to output, return the first record in str, or 0 at the end
+static int read_header(kstring_t *str)
+{
+    int coordinate_only = 0;
+    kstring_t header = KSTRING_INIT;
+    int ret;
+    while ( (ret = bgzf_getline(args.in, '\n', str)) >= 0 ) {
+	if ( str->l == 0 || str->s[0] != '#' )
+	    break;
+	if ( strcmp(str->s, "##sequence=none") == 0 ) {
+	    coordinate_only = 1;
+	    continue;
+	}
+	// contigs of a coordinate-only file come after ##sequence=none, with checksums
+	if ( coordinate_only && strncmp(str->s, "##contig=<", 10) == 0 )
+	    parse_contig(str->s);
+	kputsn(str->s, str->l, &header);
+	kputc('\n', &header);
+    }
+    if ( coordinate_only == 0 )
+	error("%s is not a coordinate-only probe file, exported by generate_oligos -no_sequence.", args.input_fname);
+    if ( header.l && bgzf_write(args.out, header.s, header.l) != header.l )
+	error("Write error : %d.", args.out->errcode);
+    // start tabix index from a new block after header
+    if ( bgzf_flush(args.out) != 0 )
+	error("Write error : %d.", args.out->errcode);
+    free(header.s);
+    return ret >= 0;
+}
+
+// fetch the contig and check it with the header
+static void load_contig(struct contig *c)
+{
+    int len;
+    char md5[33];
+    c->seq = faidx_fetch_seq(args.fai, c->name, 0, INT_MAX, &len);
+    if ( c->seq == NULL )
+	error("Failed to fetch %s from %s.", c->name, args.fasta_fname);
+    if ( len != c->length )
+	error("Length of %s is %d in %s, but %d in the probe file.", c->name, len, args.fasta_fname, c->length);
+    seq_md5_hex(c->seq, len, md5);
+    if ( strcmp(md5, c->md5) != 0 )
+	error("MD5 of %s is %s in %s, but %s in the probe file.", c->name, md5, args.fasta_fname, c->md5);
+}
+
+static void release_contig(struct contig *c)
+{
+    if ( --c->refs == 0 ) {
+	free(c->seq);
+	c->seq = NULL;
+    }
+}
+
+static int parse_blocks(char *s, int *a)
+{
+    int n = 0;
+    while ( *s && *s != '\t' && n < 2 ) {
+	a[n++] = strtol(s, &s, 10);
+	if ( *s == ',' ) s++;
+    }
+    return n;
+}
+
+// fill the sequence column of each line, the sequence is the concatenation of blocks
+static void *fill_batch(void *_b)
+{
+    struct batch *b = (struct batch*)_b;
+    const struct contig *c = b->contig;
+    char *p = b->in.s, *end = b->in.s + b->in.l;
+    uint64_t line = b->line;
+    b->out.l = 0;
+    for ( ; p < end; ++line ) {
+	char *eol = strchr(p, '\n');
+	// chrom, start, end, seq_length, sequence, n_block, starts, ends and the rest
+	char *fields[9];
+	int i, n = 0;
+	fields[n++] = p;
+	for ( ; p < eol && n < 9; ++p ) {
+	    if ( *p == '\t' )
+		fields[n++] = p + 1;
+	}
+	int starts[2], ends[2], n_block;
+	if ( n < 9 || fields[4][0] != '.' || fields[4][1] != '\t' || (n_block = atoi(fields[5])) < 1 || n_block > 2 ||
+	     parse_blocks(fields[6], starts) != n_block || parse_blocks(fields[7], ends) != n_block ) {
+	    b->bad_line = line;
+	    return b;
+	}
+	int length = atoi(fields[3]), l = 0;
+	kputsn(fields[0], fields[4] - fields[0], &b->out);
+	ks_resize(&b->out, b->out.l + length + 1);
+	for ( i = 0; i < n_block; ++i ) {
+	    if ( starts[i] < 0 || ends[i] > c->length || ends[i] < starts[i] || l + ends[i] - starts[i] > length ) {
+		b->bad_line = line;
+		return b;
+	    }
+	    // generate_oligos exports bases in upper case, soft-masked bases of the reference included
+	    char *s = b->out.s + b->out.l;
+	    int j;
+	    for ( j = starts[i]; j < ends[i]; ++j )
+		*s++ = toupper(c->seq[j]);
+	    b->out.l += ends[i] - starts[i];
+	    l += ends[i] - starts[i];
+	}
+	if ( l != length ) {
+	    b->bad_line = line;
+	    return b;
+	}
+	kputsn(fields[5] - 1, eol - fields[5] + 2, &b->out);
+	p = eol + 1;
+    }
+    return b;
+}
+
+static void write_batch(struct batch *b)
+{
+    if ( b->bad_line )
+	error("Failed to fill the sequence at line %"PRIu64" of %s.", b->bad_line, args.input_fname);
+    if ( b->out.l && bgzf_write(args.out, b->out.s, b->out.l) != b->out.l )
+	error("Write error : %d.", args.out->errcode);
+    release_contig(b->contig);
+    free(b->in.s);
+    free(b->out.s);
+    free(b);
+}
+
+static void collect_batches(int all)
+{
+    int wait = all || args.n_pending >= args.n_threads * 2;
+    while ( args.n_pending > 0 ) {
+	t_pool_result *r = wait ? t_pool_next_result_wait(args.results) : t_pool_next_result(args.results);
+	if ( r == NULL )
+	    break;
+	write_batch((struct batch*)r->data);
+	t_pool_delete_result(r, 0);
+	args.n_pending--;
+	// keep memory bounded, at most two batches for each thread in the queue
+	wait = all || args.n_pending >= args.n_threads * 2;
+    }
+}
+
+static void push_batch(struct batch *b)
+{
+    if ( b == NULL || b->n == 0 )
+	return;
+    if ( args.pool == NULL ) {
+	write_batch((struct batch*)fill_batch(b));
+	return;
+    }
+    t_pool_dispatch(args.pool, args.results, fill_batch, b);
+    args.n_pending++;
+    collect_batches(0);
+}
+
+static void materialize()
+{
+    kstring_t str = KSTRING_INIT;
+    struct batch *b = NULL;
+    struct contig *last = NULL;
+    int last_id = -1;
+    uint64_t line = 0;
+    int ret = read_header(&str);
+    for ( ; ret; ret = bgzf_getline(args.in, '\n', &str) >= 0 ) {
+	line++;
+	if ( str.l == 0 )
+	    continue;
+	char *tab = strchr(str.s, '\t');
+	if ( tab == NULL )
+	    error("Bad format at line %"PRIu64" of %s.", line, args.input_fname);
+	if ( last == NULL || tab - str.s != strlen(last->name) || memcmp(str.s, last->name, tab - str.s) != 0 ) {
+	    *tab = '\0';
+	    khiter_t k = kh_get(name, args.names, str.s);
+	    if ( k == kh_end(args.names) )
+		error("Contig %s is not found in the header of %s.", str.s, args.input_fname);
+	    *tab = '\t';
+	    // contigs in header are in the order of reference, so each contig is fetched once
+	    if ( kh_val(args.names, k) <= last_id )
+		error("%s is not sorted at line %"PRIu64".", args.input_fname, line);
+	    last_id = kh_val(args.names, k);
+	    struct contig *c = &args.contigs[last_id];
+	    push_batch(b);
+	    b = NULL;
+	    if ( last )
+		release_contig(last);
+	    load_contig(c);
+	    c->refs = 1;
+	    last = c;
+	}
+	if ( b == NULL ) {
+	    b = (struct batch*)calloc(1, sizeof(struct batch));
+	    b->contig = last;
+	    b->line = line;
+	    last->refs++;
+	}
+	kputsn(str.s, str.l, &b->in);
+	kputc('\n', &b->in);
+	if ( ++b->n == BATCH_LINES ) {
+	    push_batch(b);
+	    b = NULL;
+	}
+	args.n_lines++;
+    }
+    push_batch(b);
+    collect_batches(1);
+    if ( last )
+	release_contig(last);
+    free(str.s);
+}
+
+// same index of generate_oligos, CSI for contigs longer than 2^29
+static void build_index()
+{
+    int i, bits = 0;
+    for ( i = 0; i < args.n_contigs; ++i )
+	while ( bits < 31 && args.contigs[i].length > 1 << bits ) bits++;
+    if ( tbx_index_build(args.output_fname, bits > 29 ? 14 : 0, &tbx_conf_bed) )
+	warnings("Failed to build the index of %s.", args.output_fname);
+}
+
+static void clean_memory()
+{
+    int i;
+    if ( args.pool ) {
+	t_pool_flush(args.pool);
+	t_pool_destroy(args.pool, 0);
+	t_results_queue_destroy(args.results);
+    }
+    for ( i = 0; i < args.n_contigs; ++i ) {
+	free(args.contigs[i].name);
+	free(args.contigs[i].seq);
+    }
+    free(args.contigs);
+    kh_destroy(name, args.names);
+    fai_destroy(args.fai);
+}
+
+int main(int argc, char **argv)
+{
+    if ( argc == 1 )
+	return usage();
+    if ( parse_args(--argc, ++argv) )
+	return 1;
+    materialize();
+    bgzf_close(args.in);
+    if ( bgzf_close(args.out) != 0 )
+	error("Failed to close %s.", args.output_fname);
+    if ( strcmp(args.output_fname, "-") != 0 )
+	build_index();
+    if ( quiet_mode == 0 )
+	LOG_print("%"PRIu64" oligos materialized.", args.n_lines);
+    clean_memory();
+    return 0;
+}
@@ -1,95 +1,528 @@
+// merge_oligos.c - merge probe files into one, in the order of contigs and coordinates.
+//
+// Inputs are read once, so pipes and process substitutions work. Headers of all inputs are read first, then the
+// bodies are merged by a heap of inputs keyed by (contig, start, end), only the current record of each input is kept
+// in memory. The order of contigs is taken from the reference (-r), or merged from the orders of contigs of all inputs
+// by a topological sort. generate_oligos lists the contigs of reference in ##contig header lines, and the tabix index
+// of an input without them lists its contigs in the order of records. Contigs of neither follow in the order they are
+// seen. Records of an input going back to a contig it has left are not sorted, while going to a contig of smaller id
+// means the inputs disagree on the order of contigs, which needs -r.
+//
+// Exact duplicates (same sequence) of overlapped projects are dropped in a window of records, as generate_oligos does.
+// With -max_depth, the depth of each base covered by blocks of kept records is tracked by a difference array sliding
+// with the merge, a record is dropped if any base of its blocks is covered -max_depth times already.
+//
+// With -t, each input is read ahead by the thread pool in chunks of lines, so the blocks of all inputs are decompressed
+// in parallel while the heap is merged, and the output is compressed by the same number of threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
 #include "utils.h"
 #include "htslib/kstring.h"
 #include "htslib/bgzf.h"
-#include "zlib.h"
-#include "htslib/kseq.h"
+#include "htslib/faidx.h"
+#include "htslib/khash.h"
+#include "htslib/ksort.h"
+#include "htslib/tbx.h"
+#include "cram/thread_pool.h"
+#include "dedup.h"
+#include "probe_shard.h"
 
 #define KSTRING_INIT {0, 0, 0}
+// memory of read-ahead chunks for all inputs, two chunks for each input
+#define PREFETCH_MEMORY (256<<20)
+#define PREFETCH_CHUNK_MIN (64<<10)
+#define PREFETCH_CHUNK_MAX (4<<20)
+#define WRITE_BUFFER (1<<20)
+
+KHASH_MAP_INIT_STR(name, int)
 
 int usage()
 {
-    fprintf(stderr, 
-"- Details: Merge probes files into one.\n"
-"- Usage: merge_probes  probes1.txt.gz probes2.txt.gz [ probes3.txt.gz ... ]\n"
+    fprintf(stderr,
+"- Details: Merge probes files into one, sorted by contigs and coordinates.\n"
+"- Usage: merge_oligos [options] probes1.txt.gz probes2.txt.gz [ probes3.txt.gz ... ]\n"
+"- Options:\n"
+"    -r [fasta]   order of contigs in the reference, default is merged from the ##contig lines or the indexes of\n"
+"                 inputs, then the order seen in the inputs.\n"
+"    -o [file]    write bgzipped and tabix indexed file, default is stdout in plain text.\n"
+"    -t, -threads [1]\n"
+"                 threads to read inputs ahead and compress output.\n"
+"    -no_index    do not build the index of -o.\n"
+"    -dedup_window [4096]\n"
+"                 drop exact duplicate oligos within last INT records, set 0 to keep duplicates.\n"
+"    -dedup_global\n"
+"                 drop exact duplicate oligos of the whole merged file.\n"
+"    -max_depth [0]\n"
+"                 drop oligos covering any base already covered INT times, 0 for no limit.\n"
+"    -h           export header only.\n"
+"    -H           export body only.\n"
+"    \"-\" reads a probe file from stdin.\n"
 "- Author: Shi Quan (shiquan@genomics.cn)\n"
 );
     return 1;
 }
+
+// an input file and its current record
+struct input {
+    const char *fname;
+    BGZF *fp;
+    kstring_t header;
+    kstring_t line;
+    // current record, in line or chunk
+    char *rec;
+    int l_rec;
+    // lines read ahead by the thread pool, next chunk is filled by a worker while chunk is merged
+    kstring_t chunk;
+    char *p;
+    kstring_t next;
+    kstring_t fetch;
+    int ret;
+    int pending;
+    t_results_queue *q;
+    int cid;
+    int start;
+    int end;
+    // contigs of ##contig header lines, in order
+    int n_contigs;
+    char **contigs;
+    // contigs seen in records, indexed by contig id
+    int m_seen;
+    uint8_t *seen;
+    // order of inputs, to keep records with the same coordinates in the order of arguments
+    int idx;
+};
+
+typedef struct input *input_point;
+
+// heap top is the smallest record
+#define input_gt(a, b) ((a)->cid > (b)->cid || ((a)->cid == (b)->cid && ((a)->start > (b)->start || ((a)->start == (b)->start && ((a)->end > (b)->end || ((a)->end == (b)->end && (a)->idx > (b)->idx))))))
+KSORT_INIT(input, input_point, input_gt)
+// heap top is the contig first seen in headers
+#define contig_gt(a, b) ((a) > (b))
+KSORT_INIT(contig, int, contig_gt)
+
 struct args {
     int n_files;
     int m_files;
-    BGZF **fp;
+    struct input *inputs;
+    const char *fasta_fname;
+    const char *output_fname;
+    BGZF *out;
+    // threaded output with index, compressed in shards
+    struct probe_shards *shards;
+    // index built while writing, contigs are numbered in the order written
+    int index;
+    hts_idx_t *idx;
+    int idx_fmt;
+    int idx_cid;
+    int idx_tid;
+    // names of indexed contigs, each ends with '\0'
+    kstring_t idx_names;
+    // an end over 2^29 is found with TBI index, CSI is built after the output is closed
+    int idx_rebuild;
+    kstring_t line;
     kstring_t command;
     int oligo_length;
     // 0 on default, 1 on header only, 2 on no header
     int header_flag;
+    // contig id of names, from the reference or in the order seen
+    khash_t(name) *names;
+    int n_names;
+    int fixed_names;
+    int max_length;
+    int n_threads;
+    t_pool *pool;
+    int chunk_size;
+    int no_index;
+    int dedup_window;
+    int dedup_global;
+    struct dedup *dedup;
+    // block columns of kept coordinate-only records at the last position, "starts\tends\n"
+    kstring_t kept_blocks;
+    int max_depth;
+    uint64_t collapsed;
 } args = {
     .n_files = 0,
     .m_files = 0,
-    .fp = NULL,
+    .inputs = NULL,
+    .fasta_fname = NULL,
+    .output_fname = NULL,
+    .out = NULL,
+    .shards = NULL,
+    .index = 0,
+    .idx = NULL,
+    .idx_fmt = HTS_FMT_TBI,
+    .idx_cid = -1,
+    .idx_tid = -1,
+    .idx_names = KSTRING_INIT,
+    .idx_rebuild = 0,
+    .line = KSTRING_INIT,
     .command = KSTRING_INIT,
     .oligo_length = 0,
     .header_flag = 0,
+    .names = NULL,
+    .n_names = 0,
+    .fixed_names = 0,
+    .max_length = 0,
+    .n_threads = 1,
+    .pool = NULL,
+    .chunk_size = 0,
+    .no_index = 0,
+    .dedup_window = 4096,
+    .dedup_global = 0,
+    .dedup = NULL,
+    .kept_blocks = KSTRING_INIT,
+    .max_depth = 0,
+    .collapsed = 0,
 };
 
-int read_comment_line(BGZF *fp, kstring_t *string)
+// depth of bases, diff[x & (m-1)] is the change of depth at x, for x from pos to pos + m
+struct depth_track {
+    int cid;
+    int pos;
+    // depth at pos - 1
+    int depth;
+    int m;
+    int *diff;
+} depth = { -1, 0, 0, 0, NULL };
+
+static int contig_id(char *name)
 {
-    for ( ;; ) {
-        if ( bgzf_getline(fp, '\n', string) < 0 )
-            return 1;
-        if ( string->l == 0 )
-            continue;
-        if ( string->s[0] == '#')
+    khiter_t k = kh_get(name, args.names, name);
+    if ( k != kh_end(args.names) )
+        return kh_val(args.names, k);
+    if ( args.fixed_names )
+        error("Contig %s is not found in %s.", name, args.fasta_fname);
+    int ret;
+    k = kh_put(name, args.names, strdup(name), &ret);
+    kh_val(args.names, k) = args.n_names;
+    return args.n_names++;
+}
+
+static void load_contigs(const char *fname)
+{
+    faidx_t *fai = fai_load(fname);
+    if ( fai == NULL )
+        error("Failed to load index of %s.", fname);
+    int i;
+    for ( i = 0; i < faidx_nseq(fai); ++i ) {
+        contig_id((char*)faidx_iseq(fai, i));
+        int length = faidx_seq_len(fai, faidx_iseq(fai, i));
+        if ( length > args.max_length )
+            args.max_length = length;
+    }
+    fai_destroy(fai);
+    args.fixed_names = 1;
+}
+
+// parse coordinates of the current record, records of each input should be sorted
+static void parse_record(struct input *in)
+{
+    char *p = strchr(in->rec, '\t');
+    if ( p == NULL )
+        error("Bad format in %s : %s", in->fname, in->rec);
+    *p = '\0';
+    int cid = contig_id(in->rec);
+    *p++ = '\t';
+    int start = strtol(p, &p, 10);
+    int end = *p == '\t' ? strtol(p + 1, &p, 10) : -1;
+    if ( end < 0 )
+        error("Bad format in %s : %s", in->fname, in->rec);
+    if ( cid != in->cid ) {
+        if ( cid < in->m_seen && in->seen[cid] )
+            error("%s is not sorted at %s.", in->fname, in->rec);
+        if ( cid < in->cid ) {
+            if ( args.fixed_names )
+                error("%s is not sorted in the contig order of %s at %s.", in->fname, args.fasta_fname, in->rec);
+            error("Contigs of %s are in a different order from other inputs at %s, use -r to set the order of reference.",
+                  in->fname, in->rec);
+        }
+        if ( cid >= in->m_seen ) {
+            int m = in->m_seen ? in->m_seen : 64;
+            while ( cid >= m )
+                m <<= 1;
+            in->seen = (uint8_t*)realloc(in->seen, m);
+            memset(in->seen + in->m_seen, 0, m - in->m_seen);
+            in->m_seen = m;
+        }
+        in->seen[cid] = 1;
+    }
+    else if ( start < in->start || (start == in->start && end < in->end) ) {
+        error("%s is not sorted at %s.", in->fname, in->rec);
+    }
+    in->cid = cid;
+    in->start = start;
+    in->end = end;
+}
+
+// fill next chunk of input, run by the workers
+static void *prefetch(void *_in)
+{
+    struct input *in = (struct input*)_in;
+    in->next.l = 0;
+    in->ret = 0;
+    while ( in->next.l < args.chunk_size ) {
+        if ( (in->ret = bgzf_getline(in->fp, '\n', &in->fetch)) < 0 )
             break;
-        return 1;
+        kputsn(in->fetch.s, in->fetch.l, &in->next);
+        kputc('\n', &in->next);
+    }
+    return in;
+}
+
+static void prefetch_start(struct input *in)
+{
+    if ( in->q == NULL )
+        in->q = t_results_queue_init();
+    t_pool_dispatch(args.pool, in->q, prefetch, in);
+    in->pending = 1;
+}
+
+// next line of input, from the read-ahead chunks or the file, return 1 at the end
+static int next_line(struct input *in)
+{
+    if ( args.pool == NULL ) {
+        if ( bgzf_getline(in->fp, '\n', &in->line) < 0 )
+            return 1;
+        in->rec = in->line.s;
+        in->l_rec = in->line.l;
+        return 0;
     }
+    while ( in->p == NULL || in->p == in->chunk.s + in->chunk.l ) {
+        if ( in->pending == 0 )
+            return 1;
+        t_pool_delete_result(t_pool_next_result_wait(in->q), 0);
+        in->pending = 0;
+        if ( in->ret < -1 )
+            error("Failed to read %s.", in->fname);
+        kstring_t tmp = in->chunk;
+        in->chunk = in->next;
+        in->next = tmp;
+        in->p = in->chunk.s;
+        if ( in->ret >= 0 )
+            prefetch_start(in);
+        if ( in->chunk.l == 0 )
+            in->p = NULL;
+    }
+    char *e = (char*)memchr(in->p, '\n', in->chunk.s + in->chunk.l - in->p);
+    *e = '\0';
+    in->rec = in->p;
+    in->l_rec = e - in->p;
+    in->p = e + 1;
     return 0;
 }
-int read_line(BGZF *fp, kstring_t *string)
+
+// read next record of input, return 1 at the end
+static int read_record(struct input *in)
 {
     for ( ;; ) {
-        if ( bgzf_getline(fp, '\n', string) < 0 )
+        if ( next_line(in) )
             return 1;
-        if ( string->l == 0 )
+        if ( in->l_rec == 0 )
             continue;
-        if ( string->s[0] == '#' || string->s[0] == '/')
+        if ( in->rec[0] == '#' || in->rec[0] == '/')
             continue;
         break;
     }
+    parse_record(in);
     return 0;
 }
-void release_memory()
+
+static void add_contig(struct input *in, const char *name, int l)
 {
-    int i;
-    for ( i = 0; i < args.n_files; ++i )
-        bgzf_close(args.fp[i]);
-    free(args.fp);
-    if ( args.command.l )
-        free(args.command.s);
-    
+    if ( (in->n_contigs & 63) == 0 )
+        in->contigs = (char**)realloc(in->contigs, (in->n_contigs + 64) * sizeof(char*));
+    in->contigs[in->n_contigs] = (char*)malloc(l + 1);
+    memcpy(in->contigs[in->n_contigs], name, l);
+    in->contigs[in->n_contigs++][l] = '\0';
 }
-int parse_length(BGZF *fp)
+
+// contigs of the tabix index, numbered in the order of records
+static void index_contigs(struct input *in)
 {
-    kstring_t string = KSTRING_INIT;
-    int length = 0;
-    if ( bgzf_seek(fp, 0, SEEK_SET) < 0 )
-        return 0;
-    
+    if ( strcmp(in->fname, "-") == 0 )
+        return;
+    tbx_t *tbx = tbx_index_load(in->fname);
+    if ( tbx == NULL )
+        return;
+    int i, n;
+    const char **names = tbx_seqnames(tbx, &n);
+    for ( i = 0; i < n; ++i )
+        add_contig(in, names[i], strlen(names[i]));
+    free(names);
+    tbx_destroy(tbx);
+}
+
+// keep header lines and contigs of ##contig lines, or of the index if no ##contig line, and read the first line of
+// records, return 1 if no record. lines starting with '/' are skipped here, before the input is read ahead by threads
+static int read_header(struct input *in)
+{
+    in->cid = -1;
     for ( ;; ) {
-        if ( read_comment_line(fp, &string) )
-            return length;
-        if ( strncmp(string.s, "##max_length=", 13) == 0 ) {
-            sscanf(string.s+13, "%d", &length);
-            return length;
+        if ( bgzf_getline(in->fp, '\n', &in->line) < 0 )
+            return 1;
+        if ( in->line.l == 0 || in->line.s[0] == '/' )
+            continue;
+        if ( in->line.s[0] != '#' )
+            break;
+        if ( strncmp(in->line.s, "##max_length=", 13) == 0 ) {
+            int length = atoi(in->line.s + 13);
+            if ( length > args.oligo_length )
+                args.oligo_length = length;
+        }
+        else if ( strncmp(in->line.s, "##contig=<ID=", 13) == 0 ) {
+            char *name = in->line.s + 13;
+            int l = strcspn(name, ",>");
+            add_contig(in, name, l);
+            char *length = strstr(name + l, ",length=");
+            if ( length && atoi(length + 8) > args.max_length )
+                args.max_length = atoi(length + 8);
         }
+        kputsn(in->line.s, in->line.l, &in->header);
+        kputc('\n', &in->header);
     }
+    if ( in->n_contigs == 0 )
+        index_contigs(in);
     return 0;
 }
 
+// parse the first record after the header
+static void first_record(struct input *in)
+{
+    in->rec = in->line.s;
+    in->l_rec = in->line.l;
+    parse_record(in);
+}
+
+// contig ids from ##contig lines or indexes of all inputs. Each input lists its contigs in order, so a contig goes after the one
+// listed before it in any input. Contigs are sorted topologically, ties in the order first listed.
+static void order_contigs(void)
+{
+    khash_t(name) *nodes = kh_init(name);
+    char **names = NULL;
+    int n = 0, i, j, ret;
+    // edges from each contig to the next one of each input, in pairs of node ids
+    int n_edges = 0, *edges = NULL;
+    for ( i = 0; i < args.n_files; ++i ) {
+        struct input *in = &args.inputs[i];
+        int last = -1;
+        for ( j = 0; j < in->n_contigs; ++j ) {
+            khiter_t k = kh_put(name, nodes, in->contigs[j], &ret);
+            if ( ret ) {
+                names = (char**)realloc(names, (n + 1) * sizeof(char*));
+                names[n] = in->contigs[j];
+                kh_val(nodes, k) = n++;
+            }
+            int id = kh_val(nodes, k);
+            if ( last >= 0 ) {
+                edges = (int*)realloc(edges, (n_edges + 1) * 2 * sizeof(int));
+                edges[n_edges*2] = last;
+                edges[n_edges*2+1] = id;
+                n_edges++;
+            }
+            last = id;
+        }
+    }
+    kh_destroy(name, nodes);
+    if ( n == 0 )
+        return;
+    // adjacency of nodes, by offsets of edges of each node
+    int *in_degree = (int*)calloc(n, sizeof(int));
+    int *offsets = (int*)calloc(n + 1, sizeof(int));
+    int *next = (int*)malloc((n_edges + 1) * sizeof(int));
+    for ( i = 0; i < n_edges; ++i ) {
+        offsets[edges[i*2] + 1]++;
+        in_degree[edges[i*2+1]]++;
+    }
+    for ( i = 0; i < n; ++i )
+        offsets[i+1] += offsets[i];
+    int *fill = (int*)malloc((n + 1) * sizeof(int));
+    memcpy(fill, offsets, n * sizeof(int));
+    for ( i = 0; i < n_edges; ++i )
+        next[fill[edges[i*2]]++] = edges[i*2+1];
+    int *heap = fill, n_heap = 0, n_ordered = 0;
+    for ( i = 0; i < n; ++i ) {
+        if ( in_degree[i] == 0 )
+            heap[n_heap++] = i;
+    }
+    ks_heapmake(contig, n_heap, heap);
+    while ( n_heap ) {
+        int id = heap[0];
+        heap[0] = heap[--n_heap];
+        ks_heapadjust(contig, 0, n_heap, heap);
+        contig_id(names[id]);
+        n_ordered++;
+        for ( i = offsets[id]; i < offsets[id+1]; ++i ) {
+            if ( --in_degree[next[i]] )
+                continue;
+            // push and sift up
+            int x = n_heap++;
+            while ( x && heap[(x-1)/2] > next[i] ) {
+                heap[x] = heap[(x-1)/2];
+                x = (x-1)/2;
+            }
+            heap[x] = next[i];
+        }
+    }
+    free(in_degree);
+    free(offsets);
+    free(next);
+    free(fill);
+    free(edges);
+    free(names);
+    if ( n_ordered < n )
+        error("Contigs are in different orders in ##contig lines of inputs, use -r to set the order of reference.");
+}
+
+void release_memory()
+{
+    int i;
+    if ( args.pool ) {
+        t_pool_flush(args.pool);
+        t_pool_destroy(args.pool, 0);
+    }
+    for ( i = 0; i < args.n_files; ++i ) {
+        struct input *in = &args.inputs[i];
+        bgzf_close(in->fp);
+        free(in->header.s);
+        free(in->line.s);
+        free(in->chunk.s);
+        free(in->next.s);
+        free(in->fetch.s);
+        int j;
+        for ( j = 0; j < in->n_contigs; ++j )
+            free(in->contigs[j]);
+        free(in->contigs);
+        free(in->seen);
+        if ( in->q )
+            t_results_queue_destroy(in->q);
+    }
+    free(args.inputs);
+    if ( args.command.l )
+        free(args.command.s);
+    free(args.idx_names.s);
+    free(args.line.s);
+    khiter_t k;
+    for ( k = kh_begin(args.names); k != kh_end(args.names); ++k )
+        if ( kh_exist(args.names, k) )
+            free((char*)kh_key(args.names, k));
+    kh_destroy(name, args.names);
+    dedup_destroy(args.dedup);
+    free(args.kept_blocks.s);
+    free(depth.diff);
+}
+
 int parse_args(int argc, char **argv)
 {
-    
-    int i;    
+
+    int i;
+    const char *threads = 0;
+    const char *dedup_window = 0;
+    const char *max_depth = 0;
 
     for ( i = 0; i < argc; ++i ) {
         if ( i )
@@ -98,8 +531,9 @@ int parse_args(int argc, char **argv)
     }
     if ( argc == 0 )
         return usage();
-    
-    for ( i = 0; i < argc; ) {    
+
+    args.names = kh_init(name);
+    for ( i = 0; i < argc; ) {
         const char *a = argv[i++];
         if ( strcmp(a, "-h") == 0 ) {
             args.header_flag = 1;
@@ -107,74 +541,416 @@ int parse_args(int argc, char **argv)
         } else if ( strcmp(a, "-H") == 0 ) {
             args.header_flag = 2;
             continue;
+        } else if ( strcmp(a, "-no_index") == 0 ) {
+            args.no_index = 1;
+            continue;
+        } else if ( strcmp(a, "-dedup_global") == 0 ) {
+            args.dedup_global = 1;
+            continue;
+        }
+        const char **var = 0;
+        if ( (strcmp(a, "-t") == 0 || strcmp(a, "-threads") == 0) && threads == 0 )
+            var = &threads;
+        else if ( strcmp(a, "-dedup_window") == 0 && dedup_window == 0 )
+            var = &dedup_window;
+        else if ( strcmp(a, "-max_depth") == 0 && max_depth == 0 )
+            var = &max_depth;
+        else if ( strcmp(a, "-r") == 0 && args.fasta_fname == 0 )
+            var = &args.fasta_fname;
+        else if ( strcmp(a, "-o") == 0 && args.output_fname == 0 )
+            var = &args.output_fname;
+        if ( var != 0 ) {
+            if ( i == argc )
+                error("Miss an argument after %s.", a);
+            *var = argv[i++];
+            continue;
         }
         if ( args.m_files == args.n_files ) {
             args.m_files += 2;
-            args.fp = (BGZF**)realloc(args.fp, args.m_files * sizeof(BGZF*));
+            args.inputs = (struct input*)realloc(args.inputs, args.m_files * sizeof(struct input));
         }
-        args.fp[args.n_files] = bgzf_open(a, "r");
-        if ( args.fp[args.n_files] == NULL ) {
+        struct input *in = &args.inputs[args.n_files];
+        memset(in, 0, sizeof(*in));
+        in->fp = bgzf_open(a, "r");
+        if ( in->fp == NULL ) {
             warnings("%s : %s", a, strerror(errno));
             continue;
         }
-        args.n_files++;
+        in->fname = a;
+        in->idx = args.n_files++;
     }
     if ( args.n_files < 2)
         error("Must merge at least two probes files. %d", args.n_files);
-
-    for ( i = 0; i < args.n_files; ++i ) {
-        int length = 0;
-        length = parse_length(args.fp[i]);
-        if (length > args.oligo_length )
-            args.oligo_length = length;
+    if ( args.fasta_fname )
+        load_contigs(args.fasta_fname);
+    args.index = args.output_fname && args.header_flag != 1 && args.no_index == 0;
+    if ( dedup_window ) {
+        args.dedup_window = atoi(dedup_window);
+        if ( args.dedup_window < 0 )
+            error("Window of dedup should be a non-negative integer. %s", dedup_window);
+    }
+    if ( args.dedup_global )
+        args.dedup = dedup_init(0);
+    else if ( args.dedup_window )
+        args.dedup = dedup_init(args.dedup_window);
+    if ( max_depth ) {
+        args.max_depth = atoi(max_depth);
+        if ( args.max_depth < 0 )
+            error("-max_depth should be a non-negative integer. %s", max_depth);
+    }
+    if ( threads ) {
+        args.n_threads = atoi(threads);
+        if ( args.n_threads < 1 )
+            args.n_threads = 1;
+    }
+    if ( args.n_threads > 1 ) {
+        args.pool = t_pool_init(args.n_threads * 2, args.n_threads);
+        args.chunk_size = PREFETCH_MEMORY / 2 / args.n_files;
+        if ( args.chunk_size < PREFETCH_CHUNK_MIN )
+            args.chunk_size = PREFETCH_CHUNK_MIN;
+        if ( args.chunk_size > PREFETCH_CHUNK_MAX )
+            args.chunk_size = PREFETCH_CHUNK_MAX;
+    }
+    // threaded output with index is compressed in shards, opened after the header is merged
+    if ( args.index == 0 || args.pool == NULL ) {
+        args.out = bgzf_open(args.output_fname ? args.output_fname : "-", args.output_fname ? "w" : "wu");
+        if ( args.out == NULL )
+            error("Failed to write %s : %s.", args.output_fname ? args.output_fname : "stdout", strerror(errno));
+        // virtual offsets are not kept by threaded BGZF, so it is only used without index
+        if ( args.output_fname && args.pool && args.index == 0 )
+            bgzf_mt(args.out, args.n_threads, 256);
     }
-    
     return 0;
 }
-void merge_probes()
+
+static void write_string(kstring_t *str)
+{
+    if ( str->l && bgzf_write(args.out, str->s, str->l) != str->l )
+        error("Write error : %d.", args.out->errcode);
+    str->l = 0;
+}
+
+// header lines of the first file, commands of the others, and the column names
+static void merge_header(kstring_t *str)
 {
+    kstring_t string = *str;
+    const char *columns = NULL;
     int i;
-    kstring_t string = KSTRING_INIT;
-    // Generate header.
     for ( i = 0; i < args.n_files; ++i ) {
-        if ( bgzf_seek(args.fp[i], 0, SEEK_SET) < 0 )
-            continue;
-        for ( ;; ) {
-            if ( read_comment_line(args.fp[i], &string) )
-                break;
+        char *p, *line = args.inputs[i].header.s;
+        for ( ; line && *line; line = p + 1 ) {
+            p = strchr(line, '\n');
+            if ( line[1] != '#' ) {
+                if ( columns == NULL )
+                    columns = line;
+                else if ( strncmp(columns, line, p - line + 1) != 0 )
+                    warnings("Columns of %s are different from the first file.", args.inputs[i].fname);
+                continue;
+            }
             if ( i == 0 ) {
-                if ( string.s[1] == '#') {
-                    kputc('\n', &string);
-                    printf("%s", string.s);
-                }
-            } else if ( strncmp(string.s, "##Command=", 10 ) == 0 ) {
-                kputc('\n', &string);
-                printf("%s", string.s);
-            } else if ( i == args.n_files-1 && string.s[1] != '#') {
-                printf("##Merge command=%s\n", args.command.s);
-                kputc('\n', &string);
-                printf("%s", string.s);
+                if ( strncmp(line, "##max_length=", 13) == 0 )
+                    ksprintf(&string, "##max_length=%d\n", args.oligo_length);
+                else
+                    kputsn(line, p - line + 1, &string);
+            }
+            else if ( strncmp(line, "##Command=", 10) == 0 ) {
+                kputsn(line, p - line + 1, &string);
             }
-        }        
+        }
+    }
+    ksprintf(&string, "##Merge command=%s\n", args.command.s);
+    if ( columns )
+        kputsn(columns, strchr(columns, '\n') - columns + 1, &string);
+    *str = string;
+}
+
+// index is built while writing, contigs longer than 2^29 need CSI
+static void index_init(uint64_t offset0)
+{
+    int bits = 0;
+    while ( bits < 31 && args.max_length > 1 << bits ) bits++;
+    args.idx_fmt = bits > 29 ? HTS_FMT_CSI : HTS_FMT_TBI;
+    if ( args.idx_fmt == HTS_FMT_CSI )
+        args.idx = hts_idx_init(0, HTS_FMT_CSI, offset0, 14, (bits - 14 + 2) / 3);
+    else
+        args.idx = hts_idx_init(0, HTS_FMT_TBI, offset0, 14, 5);
+    if ( args.shards )
+        probe_shards_set_index(args.shards, args.idx);
+}
+
+static void index_drop(void)
+{
+    if ( args.shards )
+        probe_shards_set_index(args.shards, NULL);
+    hts_idx_destroy(args.idx);
+    args.idx = NULL;
+}
+
+// tabix meta of the output, same as bed files, names of contigs in the order written
+static void set_index_meta(hts_idx_t *idx)
+{
+    uint32_t x[7] = { TBX_UCSC, 1, 2, 3, '#', 0, 0 };
+    kstring_t meta = KSTRING_INIT;
+    x[6] = args.idx_names.l;
+    kputsn((char*)x, sizeof(x), &meta);
+    kputsn(args.idx_names.s, args.idx_names.l, &meta);
+    hts_idx_set_meta(idx, meta.l, (uint8_t*)meta.s, 0);
+}
+
+// write a record and push it to the index, contigs of the index are numbered in the order written
+static void write_indexed(struct input *in)
+{
+    if ( in->cid != args.idx_cid ) {
+        args.idx_cid = in->cid;
+        args.idx_tid++;
+        kputsn(in->rec, strchr(in->rec, '\t') - in->rec, &args.idx_names);
+        kputc('\0', &args.idx_names);
+    }
+    // no CSI levels decided for this end, keep the output and build the index again after close
+    if ( args.idx && args.idx_fmt == HTS_FMT_TBI && in->end > 1 << 29 ) {
+        index_drop();
+        args.idx_rebuild = 1;
+    }
+    args.line.l = 0;
+    kputsn(in->rec, in->l_rec, &args.line);
+    kputc('\n', &args.line);
+    if ( args.shards ) {
+        probe_shards_push(args.shards, args.idx_tid, in->start, in->end, args.line.s, args.line.l);
+        return;
+    }
+    if ( bgzf_write(args.out, args.line.s, args.line.l) != args.line.l )
+        error("Write error : %d.", args.out->errcode);
+    if ( args.idx && hts_idx_push(args.idx, args.idx_tid, in->start, in->end, bgzf_tell(args.out), 1) < 0 ) {
+        warnings("Failed to index %s at %s, index is not built.", args.output_fname, in->rec);
+        index_drop();
+    }
+}
+
+// parse "start1,start2," of block columns, return the number of blocks
+static int parse_blocks(const char *s, int *a)
+{
+    int n = 0;
+    char *p = (char*)s;
+    while ( *p && *p != '\t' && n < 2 ) {
+        a[n++] = strtol(p, &p, 10);
+        if ( *p == ',' ) p++;
+    }
+    return n;
+}
+
+// return 1 if the record is an exact duplicate of a kept one
+static int is_duplicate(struct input *in, char **fields, int new_pos)
+{
+    if ( args.dedup == NULL )
+        return 0;
+    const char *seq = fields[4];
+    int l_seq = fields[5] - fields[4] - 1;
+    if ( l_seq != 1 || seq[0] != '.' )
+        return dedup_check(args.dedup, seq, l_seq);
+    // coordinate-only records, duplicates have the same blocks at the same position
+    if ( new_pos )
+        args.kept_blocks.l = 0;
+    int l = fields[8] - fields[6];
+    char *p = args.kept_blocks.s, *end = p + args.kept_blocks.l;
+    for ( ; p < end; p = strchr(p, '\n') + 1 ) {
+        if ( strncmp(p, fields[6], l) == 0 && p[l-1] == '\t' && p[l] == '\n' ) {
+            args.dedup->duplicates++;
+            return 1;
+        }
+    }
+    kputsn(fields[6], l, &args.kept_blocks);
+    kputc('\n', &args.kept_blocks);
+    return 0;
+}
+
+// make room in the difference array for x
+static void depth_reserve(int x)
+{
+    if ( x - depth.pos < depth.m )
+        return;
+    int m = depth.m ? depth.m : 1024, i;
+    while ( x - depth.pos >= m )
+        m <<= 1;
+    int *diff = (int*)calloc(m, sizeof(int));
+    for ( i = 0; i < depth.m; ++i )
+        diff[(depth.pos + i) & (m - 1)] = depth.diff[(depth.pos + i) & (depth.m - 1)];
+    free(depth.diff);
+    depth.diff = diff;
+    depth.m = m;
+}
+
+// return 1 if any base of the blocks is covered max_depth times already, otherwise count the blocks in
+static int depth_full(int cid, int n_block, const int *starts, const int *ends)
+{
+    int i, x;
+    if ( cid != depth.cid ) {
+        if ( depth.diff )
+            memset(depth.diff, 0, depth.m * sizeof(int));
+        depth.cid = cid;
+        depth.pos = starts[0];
+        depth.depth = 0;
+    }
+    // slide to the start, records come in the order of start
+    int n = starts[0] - depth.pos < depth.m ? starts[0] - depth.pos : depth.m;
+    for ( i = 0; i < n; ++i ) {
+        int *d = &depth.diff[(depth.pos + i) & (depth.m - 1)];
+        depth.depth += *d;
+        *d = 0;
+    }
+    if ( starts[0] > depth.pos )
+        depth.pos = starts[0];
+    depth_reserve(ends[n_block-1]);
+    int d = depth.depth, b = 0;
+    for ( x = depth.pos; x < ends[n_block-1]; ++x ) {
+        d += depth.diff[x & (depth.m - 1)];
+        while ( b < n_block && x >= ends[b] )
+            b++;
+        if ( x >= starts[b] && d >= args.max_depth )
+            return 1;
+    }
+    for ( i = 0; i < n_block; ++i ) {
+        depth.diff[starts[i] & (depth.m - 1)]++;
+        depth.diff[ends[i] & (depth.m - 1)]--;
+    }
+    return 0;
+}
+
+// return 1 if the record should be dropped
+static int collapse_record(struct input *in, int new_pos)
+{
+    char *fields[9];
+    int n = 0;
+    char *p = in->rec;
+    fields[n++] = p;
+    for ( ; *p && n < 9; ++p ) {
+        if ( *p == '\t' )
+            fields[n++] = p + 1;
+    }
+    if ( n < 9 )
+        error("Bad format in %s : %s", in->fname, in->rec);
+    if ( is_duplicate(in, fields, new_pos) )
+        return 1;
+    if ( args.max_depth == 0 )
+        return 0;
+    int starts[2], ends[2];
+    int n_block = parse_blocks(fields[6], starts);
+    if ( n_block == 0 || parse_blocks(fields[7], ends) != n_block )
+        error("Bad format in %s : %s", in->fname, in->rec);
+    if ( depth_full(in->cid, n_block, starts, ends) ) {
+        args.collapsed++;
+        return 1;
     }
-    // Generate body.
+    return 0;
+}
+
+void merge_probes()
+{
+    input_point *heap = (input_point*)malloc(args.n_files * sizeof(input_point));
+    int i, n = 0;
+    int *has_record = (int*)malloc(args.n_files * sizeof(int));
+    for ( i = 0; i < args.n_files; ++i )
+        has_record[i] = read_header(&args.inputs[i]) == 0;
+    if ( args.fixed_names == 0 )
+        order_contigs();
     for ( i = 0; i < args.n_files; ++i ) {
-        if ( bgzf_seek(args.fp[i], 0, SEEK_SET) < 0 )
+        if ( has_record[i] == 0 )
             continue;
-        for ( ;; ) {
-            if ( read_line(args.fp[i], &string) )
-                break;
-            kputc('\n', &string);
-            printf("%s", string.s);
+        first_record(&args.inputs[i]);
+        heap[n++] = &args.inputs[i];
+    }
+    free(has_record);
+    kstring_t string = KSTRING_INIT;
+    if ( args.header_flag != 2 )
+        merge_header(&string);
+    if ( args.header_flag == 1 ) {
+        write_string(&string);
+        free(string.s);
+        free(heap);
+        return;
+    }
+    if ( args.index && args.out == NULL ) {
+        args.shards = probe_shards_open(args.output_fname, string.s, string.l, args.pool, args.n_threads);
+        if ( args.shards == NULL )
+            error("Failed to write %s : %s.", args.output_fname, strerror(errno));
+        string.l = 0;
+        index_init(probe_shards_tell(args.shards));
+    }
+    else {
+        write_string(&string);
+        // flush header, so records start at a new block for the index
+        if ( bgzf_flush(args.out) != 0 )
+            error("Write error : %d.", args.out->errcode);
+        if ( args.index )
+            index_init(bgzf_tell(args.out));
+    }
+    if ( args.pool ) {
+        for ( i = 0; i < n; ++i )
+            prefetch_start(heap[i]);
+    }
+
+    ks_heapmake(input, n, heap);
+    int last_cid = -1, last_start = -1, last_end = -1;
+    uint64_t records = 0;
+    while ( n ) {
+        struct input *in = heap[0];
+        // contigs seen in different order by inputs
+        if ( in->cid < last_cid || (in->cid == last_cid && in->start < last_start) )
+            error("Contigs are in different orders in inputs, use -r to set the order of reference.");
+        int new_pos = in->cid != last_cid || in->start != last_start || in->end != last_end;
+        last_cid = in->cid;
+        last_start = in->start;
+        last_end = in->end;
+        records++;
+        if ( (args.dedup == NULL && args.max_depth == 0) || collapse_record(in, new_pos) == 0 ) {
+            if ( args.index ) {
+                write_indexed(in);
+            }
+            else {
+                kputsn(in->rec, in->l_rec, &string);
+                kputc('\n', &string);
+                if ( string.l >= WRITE_BUFFER )
+                    write_string(&string);
+            }
         }
-    }    
+        if ( read_record(in) )
+            heap[0] = heap[--n];
+        ks_heapadjust(input, 0, n, heap);
+    }
+    write_string(&string);
+    free(string.s);
+    free(heap);
+    uint64_t duplicates = args.dedup ? args.dedup->duplicates : 0;
+    LOG_print("%"PRIu64" records merged, %"PRIu64" duplicates and %"PRIu64" oligos over depth dropped.", records,
+              duplicates, args.collapsed);
 }
+
 int main(int argc, char **argv)
 {
     if ( parse_args(--argc, ++argv) )
         return 1;
 
     merge_probes();
+    if ( args.shards ) {
+        if ( probe_shards_close(args.shards, &args.idx) )
+            error("Failed to close %s : %s.", args.output_fname, strerror(errno));
+        args.shards = NULL;
+    }
+    else {
+        if ( args.idx )
+            hts_idx_finish(args.idx, bgzf_tell(args.out));
+        if ( bgzf_close(args.out) != 0 )
+            error("Failed to close %s.", args.output_fname ? args.output_fname : "stdout");
+    }
+    if ( args.idx ) {
+        set_index_meta(args.idx);
+        if ( hts_idx_save(args.idx, args.output_fname, args.idx_fmt) != 0 )
+            warnings("Failed to save the index of %s.", args.output_fname);
+        hts_idx_destroy(args.idx);
+        args.idx = NULL;
+    }
+    else if ( args.idx_rebuild && tbx_index_build(args.output_fname, 14, &tbx_conf_bed) ) {
+        warnings("Failed to build the index of %s.", args.output_fname);
+    }
     release_memory();
     return 0;
 }
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "htslib/faidx.h"
+#include "htslib/khash.h"
+#include "htslib/ksort.h"
+#include "utils.h"
+#include "seq_utils.h"
+#include "mini_index.h"
+
+#define mini_entry_lt(a, b) ((a).hash < (b).hash || ((a).hash == (b).hash && (a).pos < (b).pos))
+KSORT_INIT(mini, struct mini_entry, mini_entry_lt)
+KSORT_INIT(pos, uint64_t, ks_lt_generic)
+
+KHASH_MAP_INIT_STR(name, int)
+
+// max window size of minimizers
+#define MINI_WINDOW_MAX 256
+
+struct mini_index_header {
+    char magic[8];
+    int32_t k, w, b, n_seqs;
+    uint64_t genome_length;
+    uint64_t n_entries;
+    // length of names block, padded to 8 bytes
+    uint64_t l_names;
+};
+
+#define pad8(x) (((x) + 7) & ~(uint64_t)7)
+
+static inline void mini_push(struct mini_vec *v, struct mini_entry *e)
+{
+    if ( v->n == v->m ) {
+	v->m = v->m == 0 ? 256 : v->m << 1;
+	v->a = (struct mini_entry*)realloc(v->a, v->m * sizeof(struct mini_entry));
+    }
+    v->a[v->n++] = *e;
+}
+
+void mini_sketch(const char *seq, int len, int k, int w, uint64_t base, struct mini_vec *v)
+{
+    assert(w > 0 && w < MINI_WINDOW_MAX && k > 0 && k <= 32);
+    struct mini_entry buf[MINI_WINDOW_MAX];
+    uint64_t shift = 2 * (k - 1);
+    uint64_t mask = k == 32 ? ~0ULL : (1ULL << 2*k) - 1;
+    uint64_t kmer[2] = { 0, 0 };
+    uint64_t last = UINT64_MAX;
+    int i, l = 0, buf_pos = 0, min_pos = 0;
+    memset(buf, 0xff, w * sizeof(struct mini_entry));
+    for ( i = 0; i < len; ++i ) {
+	int c = seq_nt4_table[(unsigned char)seq[i]];
+	struct mini_entry info = { UINT64_MAX, UINT64_MAX };
+	if ( c > 3 ) {
+	    l = 0;
+	    memset(buf, 0xff, w * sizeof(struct mini_entry));
+	    continue;
+	}
+	kmer[0] = (kmer[0] << 2 | c) & mask;
+	kmer[1] = kmer[1] >> 2 | (uint64_t)(3 - c) << shift;
+	// skip symmetric k-mers, the strand is undetermined
+	if ( ++l >= k && kmer[0] != kmer[1] ) {
+	    int z = kmer[0] < kmer[1] ? 0 : 1;
+	    info.hash = hash64(kmer[z], mask);
+	    info.pos = (base + i - k + 1) << 1 | z;
+	}
+	buf[buf_pos] = info;
+	if ( min_pos == buf_pos ) {
+	    // the old minimizer is out of window, rescan it from the oldest
+	    int j;
+	    min_pos = (buf_pos + 1) % w;
+	    for ( j = 1; j <= w; ++j ) {
+		int p = (buf_pos + j) % w;
+		if ( buf[p].hash < buf[min_pos].hash )
+		    min_pos = p;
+	    }
+	} else if ( info.hash < buf[min_pos].hash ) {
+	    min_pos = buf_pos;
+	}
+	if ( l >= w + k - 1 && buf[min_pos].hash != UINT64_MAX && buf[min_pos].pos != last ) {
+	    mini_push(v, &buf[min_pos]);
+	    last = buf[min_pos].pos;
+	}
+	buf_pos = buf_pos + 1 == w ? 0 : buf_pos + 1;
+    }
+}
+
+static const char zeros[8] = { 0 };
+
+static void write_block(FILE *fp, const void *data, uint64_t size, const char *fname)
+{
+    if ( size && fwrite(data, 1, size, fp) != size )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    if ( pad8(size) > size && fwrite(zeros, 1, pad8(size) - size, fp) != pad8(size) - size )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+}
+
+int mini_index_build(const char *fasta_fname, int k, int w, const char *fname)
+{
+    faidx_t *fai = fai_load(fasta_fname);
+    if ( fai == NULL ) {
+	if ( fai_build(fasta_fname) == -1 )
+	    error("Failed to build the index of %s.", fasta_fname);
+	fai = fai_load(fasta_fname);
+    }
+    struct mini_index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MINI_INDEX_MAGIC, sizeof(MINI_INDEX_MAGIC));
+    h.k = k;
+    h.w = w;
+    h.n_seqs = faidx_nseq(fai);
+
+    int i;
+    uint64_t *offsets = (uint64_t*)malloc((h.n_seqs + 1) * sizeof(uint64_t));
+    offsets[0] = 0;
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	offsets[i+1] = offsets[i] + faidx_seq_len(fai, name);
+	h.l_names += strlen(name) + 1;
+    }
+    h.genome_length = offsets[h.n_seqs];
+    uint64_t l_seq = (h.genome_length + 3) / 4;
+    uint64_t l_amb = (h.genome_length + 7) / 8;
+    uint8_t *packed = (uint8_t*)calloc(l_seq, 1);
+    uint8_t *amb = (uint8_t*)calloc(l_amb, 1);
+    check_mem(packed);
+    check_mem(amb);
+    struct mini_vec v = { 0, 0, 0 };
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	int j, l = 0;
+	char *seq = faidx_fetch_seq(fai, name, 0, offsets[i+1] - offsets[i] - 1, &l);
+	if ( seq == NULL || l != offsets[i+1] - offsets[i] )
+	    error("Failed to fetch %s.", name);
+	for ( j = 0; j < l; ++j ) {
+	    uint64_t p = offsets[i] + j;
+	    int c = seq_nt4_table[(unsigned char)seq[j]];
+	    if ( c > 3 )
+		amb[p>>3] |= 1 << (p & 7);
+	    else
+		packed[p>>2] |= c << ((p & 3) << 1);
+	}
+	mini_sketch(seq, l, k, w, offsets[i], &v);
+	free(seq);
+    }
+    ks_introsort(mini, v.n, v.a);
+    h.n_entries = v.n;
+    // about four entries per bucket
+    for ( h.b = 8; h.b < 2*k && h.b < 30 && (1ULL << h.b) < h.n_entries / 4; ++h.b );
+    if ( h.b > 2*k ) h.b = 2*k;
+    uint64_t n_buckets = 1ULL << h.b;
+    uint64_t *buckets = (uint64_t*)calloc(n_buckets + 1, sizeof(uint64_t));
+    uint64_t j;
+    for ( j = 0; j < h.n_entries; ++j )
+	buckets[(v.a[j].hash >> (2*k - h.b)) + 1]++;
+    for ( j = 0; j < n_buckets; ++j )
+	buckets[j+1] += buckets[j];
+
+    FILE *fp = fopen(fname, "wb");
+    if ( fp == NULL )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    h.l_names = pad8(h.l_names);
+    write_block(fp, &h, sizeof(h), fname);
+    uint64_t l_names = 0;
+    for ( i = 0; i < h.n_seqs; ++i ) {
+	const char *name = faidx_iseq(fai, i);
+	if ( fwrite(name, 1, strlen(name) + 1, fp) != strlen(name) + 1 )
+	    error("Failed to write %s : %s.", fname, strerror(errno));
+	l_names += strlen(name) + 1;
+    }
+    if ( h.l_names > l_names && fwrite(zeros, 1, h.l_names - l_names, fp) != h.l_names - l_names )
+	error("Failed to write %s : %s.", fname, strerror(errno));
+    write_block(fp, offsets, (h.n_seqs + 1) * sizeof(uint64_t), fname);
+    write_block(fp, packed, l_seq, fname);
+    write_block(fp, amb, l_amb, fname);
+    write_block(fp, buckets, (n_buckets + 1) * sizeof(uint64_t), fname);
+    write_block(fp, v.a, h.n_entries * sizeof(struct mini_entry), fname);
+    fclose(fp);
+
+    free(v.a);
+    free(buckets);
+    free(packed);
+    free(amb);
+    free(offsets);
+    fai_destroy(fai);
+    return 0;
+}
+
+struct mini_index *mini_index_load(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if ( fd == -1 ) {
+	error_print("Failed to open %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    struct stat s;
+    if ( fstat(fd, &s) != 0 || s.st_size < sizeof(struct mini_index_header) ) {
+	error_print("Failed to load index %s.", fname);
+	close(fd);
+	return NULL;
+    }
+    void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+	error_print("Failed to map %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    const struct mini_index_header *h = (const struct mini_index_header*)map;
+    if ( memcmp(h->magic, MINI_INDEX_MAGIC, sizeof(MINI_INDEX_MAGIC)) != 0 ) {
+	error_print("%s is not a minimizer index.", fname);
+	munmap(map, s.st_size);
+	return NULL;
+    }
+    struct mini_index *idx = (struct mini_index*)calloc(1, sizeof(struct mini_index));
+    idx->map = map;
+    idx->map_size = s.st_size;
+    idx->k = h->k;
+    idx->w = h->w;
+    idx->b = h->b;
+    idx->n_seqs = h->n_seqs;
+    idx->genome_length = h->genome_length;
+    idx->n_entries = h->n_entries;
+
+    const uint8_t *p = (const uint8_t*)map + pad8(sizeof(*h));
+    const char *names = (const char*)p;
+    p += h->l_names;
+    idx->offsets = (const uint64_t*)p;
+    p += pad8((h->n_seqs + 1) * sizeof(uint64_t));
+    idx->seq = p;
+    p += pad8((h->genome_length + 3) / 4);
+    idx->amb = p;
+    p += pad8((h->genome_length + 7) / 8);
+    idx->buckets = (const uint64_t*)p;
+    p += pad8(((1ULL << h->b) + 1) * sizeof(uint64_t));
+    idx->entries = (const struct mini_entry*)p;
+    if ( (const uint8_t*)(idx->entries + idx->n_entries) > (const uint8_t*)map + s.st_size )
+	error("Truncated index %s.", fname);
+
+    idx->names = (const char**)malloc(idx->n_seqs * sizeof(char*));
+    khash_t(name) *hash = kh_init(name);
+    int i;
+    for ( i = 0; i < idx->n_seqs; ++i ) {
+	int ret;
+	idx->names[i] = names;
+	khint_t k = kh_put(name, hash, names, &ret);
+	kh_val(hash, k) = i;
+	names += strlen(names) + 1;
+    }
+    idx->hash = hash;
+    return idx;
+}
+
+void mini_index_destroy(struct mini_index *idx)
+{
+    if ( idx == NULL )
+	return;
+    kh_destroy(name, (khash_t(name)*)idx->hash);
+    free(idx->names);
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+int mini_index_name2id(struct mini_index *idx, const char *name)
+{
+    khash_t(name) *hash = (khash_t(name)*)idx->hash;
+    khint_t k = kh_get(name, hash, name);
+    return k == kh_end(hash) ? -1 : kh_val(hash, k);
+}
+
+void mini_query_buf_destroy(struct mini_query_buf *buf)
+{
+    free(buf->mini.a);
+    free(buf->a);
+    free(buf->q);
+    free(buf->dp);
+    memset(buf, 0, sizeof(*buf));
+}
+
+// reference base in 2-bit code, 4 for ambiguous bases
+static inline int ref_base(const struct mini_index *idx, uint64_t p)
+{
+    if ( idx->amb[p>>3] >> (p & 7) & 1 )
+	return 4;
+    return idx->seq[p>>2] >> ((p & 3) << 1) & 3;
+}
+
+static int hamming_dist(const struct mini_index *idx, const uint8_t *q, int len, uint64_t s, int max_diff)
+{
+    int i, diff = 0;
+    for ( i = 0; i < len; ++i ) {
+	if ( q[i] != ref_base(idx, s + i) && ++diff > max_diff )
+	    break;
+    }
+    return diff;
+}
+
+// banded edit distance of the query against reference, the alignment may start anywhere in [s-d, s+d]
+static int edit_dist(const struct mini_index *idx, const uint8_t *q, int len, int64_t s, int64_t beg, int64_t end,
+                     int max_diff, struct mini_query_buf *buf)
+{
+    int d = max_diff;
+    int width = 2 * d + 1;
+    if ( buf->m_dp < 2 * width ) {
+	buf->m_dp = 2 * width;
+	buf->dp = (int*)realloc(buf->dp, buf->m_dp * sizeof(int));
+    }
+    int *prev = buf->dp, *cur = buf->dp + width;
+    int i, t;
+    int64_t r0 = s - d;
+    for ( t = 0; t < width; ++t )
+	prev[t] = 0;
+    for ( i = 1; i <= len; ++i ) {
+	int row_min = max_diff + 1;
+	for ( t = 0; t < width; ++t ) {
+	    // ref column of this cell is r0 + i + t
+	    int64_t r = r0 + i + t - 1;
+	    int c = r < beg || r >= end ? 4 : ref_base(idx, r);
+	    int x = prev[t] + (c != q[i-1]);
+	    if ( t + 1 < width && prev[t+1] + 1 < x )
+		x = prev[t+1] + 1;
+	    if ( t > 0 && cur[t-1] + 1 < x )
+		x = cur[t-1] + 1;
+	    cur[t] = x;
+	    if ( x < row_min )
+		row_min = x;
+	}
+	if ( row_min > max_diff )
+	    return row_min;
+	int *tmp = prev; prev = cur; cur = tmp;
+    }
+    int best = max_diff + 1;
+    for ( t = 0; t < width; ++t )
+	if ( prev[t] < best )
+	    best = prev[t];
+    return best;
+}
+
+int mini_index_count(const struct mini_index *idx, const char *seq, int len, uint64_t self_pos,
+                     const struct mini_query_opts *opts, struct mini_query_buf *buf)
+{
+    int i, k = idx->k;
+    int saturated = 0;
+    buf->mini.n = 0;
+    buf->n = 0;
+    mini_sketch(seq, len, k, idx->w, 0, &buf->mini);
+    for ( i = 0; i < buf->mini.n; ++i ) {
+	uint64_t h = buf->mini.a[i].hash;
+	int64_t qpos = buf->mini.a[i].pos >> 1;
+	int qstrand = buf->mini.a[i].pos & 1;
+	uint64_t bucket = h >> (2*k - idx->b);
+	uint64_t lo = idx->buckets[bucket], hi = idx->buckets[bucket+1];
+	// lower bound of hash in this bucket
+	while ( lo < hi ) {
+	    uint64_t mid = (lo + hi) / 2;
+	    if ( idx->entries[mid].hash < h ) lo = mid + 1;
+	    else hi = mid;
+	}
+	for ( hi = lo; hi < idx->buckets[bucket+1] && idx->entries[hi].hash == h; ++hi );
+	if ( hi - lo > opts->max_occ ) {
+	    saturated = 1;
+	    continue;
+	}
+	for ( ; lo < hi; ++lo ) {
+	    int64_t rpos = idx->entries[lo].pos >> 1;
+	    int rstrand = idx->entries[lo].pos & 1;
+	    int64_t s = rstrand == qstrand ? rpos - qpos : rpos - (len - qpos - k);
+	    if ( s < 0 )
+		continue;
+	    if ( buf->n == buf->m ) {
+		buf->m = buf->m == 0 ? 64 : buf->m << 1;
+		buf->a = (uint64_t*)realloc(buf->a, buf->m * sizeof(uint64_t));
+	    }
+	    buf->a[buf->n++] = (uint64_t)s << 1 | (rstrand != qstrand);
+	}
+    }
+    if ( buf->n == 0 )
+	return saturated ? opts->max_occ : 0;
+
+    // query in reference orientation, forward and reverse complement
+    if ( buf->m_q < 2 * len ) {
+	buf->m_q = 2 * len;
+	buf->q = (uint8_t*)realloc(buf->q, buf->m_q);
+    }
+    for ( i = 0; i < len; ++i ) {
+	int c = seq_nt4_table[(unsigned char)seq[i]];
+	buf->q[i] = c > 3 ? 5 : c;
+	buf->q[2*len-1-i] = c > 3 ? 5 : 3 - c;
+    }
+
+    ks_introsort(pos, buf->n, buf->a);
+    int count = 0, id = 0;
+    int64_t last[2] = { INT64_MIN / 2, INT64_MIN / 2 };
+    for ( i = 0; i < buf->n; ++i ) {
+	if ( i && buf->a[i] == buf->a[i-1] )
+	    continue;
+	int64_t s = buf->a[i] >> 1;
+	int strand = buf->a[i] & 1;
+	if ( s >= idx->genome_length )
+	    continue;
+	if ( s < idx->offsets[id] )
+	    id = 0;
+	while ( s >= idx->offsets[id+1] )
+	    id++;
+	int64_t beg = idx->offsets[id], end = idx->offsets[id+1];
+	const uint8_t *q = buf->q + strand * len;
+	int diff;
+	if ( opts->use_edit ) {
+	    if ( s - last[strand] <= opts->max_diff )
+		continue;
+	    diff = edit_dist(idx, q, len, s, beg, end, opts->max_diff, buf);
+	} else {
+	    if ( s + len > end )
+		continue;
+	    diff = hamming_dist(idx, q, len, s, opts->max_diff);
+	}
+	if ( diff > opts->max_diff )
+	    continue;
+	last[strand] = s;
+	if ( strand == 0 && (s == self_pos || (opts->use_edit && s - (int64_t)self_pos <= opts->max_diff && (int64_t)self_pos - s <= opts->max_diff)) )
+	    continue;
+	count++;
+    }
+    if ( saturated && count < opts->max_occ )
+	count = opts->max_occ;
+    return count;
+}
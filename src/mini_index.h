@@ -0,0 +1,83 @@
+// mini_index.h - minimizer index of reference genome, used to screen off-target loci of oligos.
+//
+// The index is built once by build_mini_index and mapped into memory by mini_index_load(). Every (w,k)-minimizer of
+// the reference is kept in a hash sorted array, the 2-bit packed reference is kept in the same file to verify the
+// candidate loci of queries.
+
+#ifndef MINI_INDEX_HEADER
+#define MINI_INDEX_HEADER
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MINI_INDEX_MAGIC "MIDX\1"
+
+struct mini_entry {
+    uint64_t hash;
+    // genome offset << 1 | strand
+    uint64_t pos;
+};
+
+struct mini_vec {
+    uint64_t n, m;
+    struct mini_entry *a;
+};
+
+struct mini_index {
+    int k;
+    int w;
+    // bits of bucket
+    int b;
+    int n_seqs;
+    const char **names;
+    const uint64_t *offsets;
+    uint64_t genome_length;
+    // 2-bit packed reference
+    const uint8_t *seq;
+    // bits of ambiguous bases
+    const uint8_t *amb;
+    const uint64_t *buckets;
+    uint64_t n_entries;
+    const struct mini_entry *entries;
+    void *hash;
+    void *map;
+    size_t map_size;
+};
+
+// scratch buffers of one query thread, reused between queries to avoid allocation
+struct mini_query_buf {
+    struct mini_vec mini;
+    int n, m;
+    uint64_t *a;
+    // query in 2-bit code, forward and reverse complement
+    int m_q;
+    uint8_t *q;
+    int m_dp;
+    int *dp;
+};
+
+struct mini_query_opts {
+    // max mismatches or edits of a off-target locus
+    int max_diff;
+    // use edit distance instead of hamming distance
+    int use_edit;
+    // skip minimizers occur more than max_occ times in the genome
+    int max_occ;
+};
+
+// collect (w,k)-minimizers of seq, base is the genome offset of seq[0]
+extern void mini_sketch(const char *seq, int len, int k, int w, uint64_t base, struct mini_vec *v);
+
+extern int mini_index_build(const char *fasta_fname, int k, int w, const char *fname);
+extern struct mini_index *mini_index_load(const char *fname);
+extern void mini_index_destroy(struct mini_index *idx);
+// return -1 if name is not found
+extern int mini_index_name2id(struct mini_index *idx, const char *name);
+
+// count genome loci (both strands) matching seq within max_diff, the locus at self_pos (genome offset, strand +) is
+// not counted. If some minimizers of seq are too repetitive, the count is at least max_occ.
+extern int mini_index_count(const struct mini_index *idx, const char *seq, int len, uint64_t self_pos,
+                            const struct mini_query_opts *opts, struct mini_query_buf *buf);
+extern void mini_query_buf_destroy(struct mini_query_buf *buf);
+
+#endif
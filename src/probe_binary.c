@@ -0,0 +1,664 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "htslib/khash.h"
+#include "utils.h"
+#include "seq_utils.h"
+#include "probe_binary.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+
+KHASH_MAP_INIT_STR(probe_name, int)
+
+struct probe_chunk_header {
+    uint32_t n;
+    uint32_t flags;
+    int32_t cid;
+    int32_t start;
+    uint64_t n_bases;
+    uint32_t n_stored;
+    uint32_t n_others;
+    uint64_t l_extra;
+};
+
+struct probe_file_footer {
+    uint64_t n_records;
+    uint64_t n_chunks;
+    uint64_t index_offset;
+    uint64_t names_offset;
+    uint64_t n_names;
+    uint64_t header_offset;
+    uint64_t l_header;
+    char magic[8];
+};
+
+#define pad8(x) (((x) + 7) & ~(uint64_t)7)
+
+#define probe_grow(type, a, n, m, need) do {                            \
+        if ( (n) + (need) > (m) ) {                                     \
+            (m) = (n) + (need);                                         \
+            (m) += (m) >> 1;                                            \
+            (a) = (type*)realloc((a), (m) * sizeof(type));              \
+        }                                                               \
+    } while(0)
+
+struct probe_writer {
+    FILE *fp;
+    char *fname;
+    uint64_t offset;
+    uint64_t n_records;
+    // columns of current chunk, cid and start of the first and the last record
+    int n, cid, start;
+    int last_cid, last_start;
+    int32_t *dcid, *dstart;
+    uint32_t *span;
+    uint16_t *length;
+    uint8_t *n_block;
+    uint8_t *rank;
+    uint16_t *gc, *repeat;
+    int n_blocks, m_blocks;
+    int32_t *blocks;
+    uint64_t n_bases, m_seq;
+    uint8_t *seq, *mask;
+    int has_mask;
+    int n_others, m_others;
+    uint32_t *other_pos;
+    char *other_base;
+    uint32_t *extra_offset;
+    kstring_t extra;
+    int has_extra;
+    // chunk index
+    int n_chunks, m_chunks;
+    struct probe_chunk_index *index;
+    int n_names, m_names;
+    char **names;
+    void *hash;
+    kstring_t header;
+};
+
+static const uint8_t zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static void write_block(struct probe_writer *w, const void *data, uint64_t size)
+{
+    if ( size && fwrite(data, 1, size, w->fp) != size )
+	error("Failed to write %s : %s.", w->fname, strerror(errno));
+    if ( pad8(size) > size && fwrite(zeros, 1, pad8(size) - size, w->fp) != pad8(size) - size )
+	error("Failed to write %s : %s.", w->fname, strerror(errno));
+    w->offset += pad8(size);
+}
+
+int probe_fixed(float x)
+{
+    // the float is exact in double, so ties are rounded to even like printf
+    return (int)lrint((double)x * 100);
+}
+
+struct probe_writer *probe_writer_open(const char *fname)
+{
+    FILE *fp = fopen(fname, "wb");
+    if ( fp == NULL ) {
+	error_print("Failed to write %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    struct probe_writer *w = (struct probe_writer*)calloc(1, sizeof(struct probe_writer));
+    w->fp = fp;
+    w->fname = strdup(fname);
+    w->hash = kh_init(probe_name);
+    w->dcid = (int32_t*)malloc(PROBE_CHUNK_SIZE * sizeof(int32_t));
+    w->dstart = (int32_t*)malloc(PROBE_CHUNK_SIZE * sizeof(int32_t));
+    w->span = (uint32_t*)malloc(PROBE_CHUNK_SIZE * sizeof(uint32_t));
+    w->length = (uint16_t*)malloc(PROBE_CHUNK_SIZE * sizeof(uint16_t));
+    w->n_block = (uint8_t*)malloc(PROBE_CHUNK_SIZE);
+    w->rank = (uint8_t*)malloc(PROBE_CHUNK_SIZE);
+    w->gc = (uint16_t*)malloc(PROBE_CHUNK_SIZE * sizeof(uint16_t));
+    w->repeat = (uint16_t*)malloc(PROBE_CHUNK_SIZE * sizeof(uint16_t));
+    w->extra_offset = (uint32_t*)malloc((PROBE_CHUNK_SIZE + 1) * sizeof(uint32_t));
+    char magic[8] = PROBE_BINARY_MAGIC;
+    write_block(w, magic, sizeof(magic));
+    return w;
+}
+
+int probe_writer_add_name(struct probe_writer *w, const char *name)
+{
+    khash_t(probe_name) *hash = (khash_t(probe_name)*)w->hash;
+    khint_t k = kh_get(probe_name, hash, name);
+    if ( k != kh_end(hash) )
+	return kh_val(hash, k);
+    probe_grow(char*, w->names, w->n_names, w->m_names, 1);
+    w->names[w->n_names] = strdup(name);
+    int ret;
+    k = kh_put(probe_name, hash, w->names[w->n_names], &ret);
+    kh_val(hash, k) = w->n_names;
+    return w->n_names++;
+}
+
+void probe_writer_set_header(struct probe_writer *w, const char *header, size_t l)
+{
+    w->header.l = 0;
+    kputsn(header, l, &w->header);
+}
+
+uint64_t probe_writer_records(const struct probe_writer *w)
+{
+    return w->n_records;
+}
+
+static void probe_writer_flush(struct probe_writer *w)
+{
+    if ( w->n == 0 )
+	return;
+    struct probe_chunk_header h;
+    memset(&h, 0, sizeof(h));
+    h.n = w->n;
+    h.flags = (w->has_mask ? PROBE_CHUNK_MASK : 0) | (w->has_extra ? PROBE_CHUNK_EXTRA : 0);
+    h.cid = w->cid;
+    h.start = w->start;
+    h.n_bases = w->n_bases;
+    h.n_stored = w->n_blocks / 4;
+    h.n_others = w->n_others;
+    h.l_extra = w->extra.l;
+
+    probe_grow(struct probe_chunk_index, w->index, w->n_chunks, w->m_chunks, 1);
+    struct probe_chunk_index *idx = &w->index[w->n_chunks++];
+    idx->offset = w->offset;
+    idx->first_record = w->n_records - w->n;
+    idx->cid = w->cid;
+    idx->start = w->start;
+    idx->n = w->n;
+    idx->flags = h.flags;
+
+    write_block(w, &h, sizeof(h));
+    write_block(w, w->dcid, w->n * sizeof(int32_t));
+    write_block(w, w->dstart, w->n * sizeof(int32_t));
+    write_block(w, w->span, w->n * sizeof(uint32_t));
+    write_block(w, w->length, w->n * sizeof(uint16_t));
+    write_block(w, w->n_block, w->n);
+    write_block(w, w->rank, w->n);
+    write_block(w, w->gc, w->n * sizeof(uint16_t));
+    write_block(w, w->repeat, w->n * sizeof(uint16_t));
+    write_block(w, w->blocks, w->n_blocks * sizeof(int32_t));
+    write_block(w, w->seq, (w->n_bases + 3) / 4);
+    if ( w->has_mask )
+	write_block(w, w->mask, (w->n_bases + 7) / 8);
+    write_block(w, w->other_pos, w->n_others * sizeof(uint32_t));
+    write_block(w, w->other_base, w->n_others);
+    if ( w->has_extra ) {
+	write_block(w, w->extra_offset, (w->n + 1) * sizeof(uint32_t));
+	write_block(w, w->extra.s, w->extra.l);
+    }
+    w->n = 0;
+    w->n_blocks = 0;
+    w->n_bases = 0;
+    w->has_mask = 0;
+    w->n_others = 0;
+    w->extra.l = 0;
+    w->has_extra = 0;
+}
+
+int probe_writer_push(struct probe_writer *w, const struct probe_record *r)
+{
+    if ( r->cid < 0 || r->cid >= w->n_names || r->length < 0 || r->length > UINT16_MAX || r->end < r->start ||
+	 r->n_block < 1 || r->n_block > 2 || r->repeat < 0 || r->repeat > UINT16_MAX || r->gc < 0 ||
+	 r->gc > UINT16_MAX || r->rank < 0 || r->rank > UINT8_MAX ) {
+	error_print("Failed to encode oligo at %d of chromosome %d.", r->start, r->cid);
+	return -1;
+    }
+    int i = w->n;
+    if ( i == 0 ) {
+	w->cid = w->last_cid = r->cid;
+	w->start = w->last_start = r->start;
+    }
+    w->dcid[i] = r->cid - w->last_cid;
+    w->dstart[i] = r->start - w->last_start;
+    w->last_cid = r->cid;
+    w->last_start = r->start;
+    w->span[i] = r->end - r->start;
+    w->length[i] = r->length;
+    w->rank[i] = r->rank;
+    w->gc[i] = r->gc;
+    w->repeat[i] = r->repeat;
+    w->n_block[i] = r->n_block;
+    // single block covering the whole region is the common case, other block coordinates are kept aside
+    if ( r->n_block == 2 || r->starts[0] != r->start || r->ends[0] != r->end ) {
+	w->n_block[i] |= PROBE_BLOCK_STORED;
+	probe_grow(int32_t, w->blocks, w->n_blocks, w->m_blocks, 4);
+	w->blocks[w->n_blocks++] = r->starts[0] - r->start;
+	w->blocks[w->n_blocks++] = r->ends[0] - r->start;
+	w->blocks[w->n_blocks++] = r->n_block == 2 ? r->starts[1] - r->start : 0;
+	w->blocks[w->n_blocks++] = r->n_block == 2 ? r->ends[1] - r->start : 0;
+    }
+
+    if ( w->n_bases + r->length > w->m_seq ) {
+	w->m_seq = w->n_bases + r->length;
+	w->m_seq += w->m_seq >> 1;
+	w->m_seq = (w->m_seq + 7) & ~(uint64_t)7;
+	w->seq = (uint8_t*)realloc(w->seq, w->m_seq / 4);
+	w->mask = (uint8_t*)realloc(w->mask, w->m_seq / 8);
+    }
+    int j;
+    for ( j = 0; j < r->length; ++j ) {
+	uint64_t k = w->n_bases + j;
+	unsigned char c = r->seq[j];
+	int code = seq_nt4_table[c];
+	if ( (k & 3) == 0 ) w->seq[k>>2] = 0;
+	if ( (k & 7) == 0 ) w->mask[k>>3] = 0;
+	if ( code > 3 ) {
+	    probe_grow(uint32_t, w->other_pos, w->n_others, w->m_others, 1);
+	    w->other_base = (char*)realloc(w->other_base, w->m_others);
+	    w->other_pos[w->n_others] = k;
+	    w->other_base[w->n_others++] = c;
+	    continue;
+	}
+	w->seq[k>>2] |= code << ((k & 3) << 1);
+	if ( c >= 'a' ) {
+	    w->mask[k>>3] |= 1 << (k & 7);
+	    w->has_mask = 1;
+	}
+    }
+    w->n_bases += r->length;
+
+    w->extra_offset[i] = w->extra.l;
+    if ( r->extra && r->l_extra ) {
+	kputsn(r->extra, r->l_extra, &w->extra);
+	w->has_extra = 1;
+    }
+    w->extra_offset[i+1] = w->extra.l;
+    w->n++;
+    w->n_records++;
+    if ( w->n == PROBE_CHUNK_SIZE || w->extra.l > UINT32_MAX >> 1 )
+	probe_writer_flush(w);
+    return 0;
+}
+
+int probe_writer_close(struct probe_writer *w)
+{
+    int i;
+    probe_writer_flush(w);
+    struct probe_file_footer f;
+    memset(&f, 0, sizeof(f));
+    memcpy(f.magic, PROBE_BINARY_MAGIC, sizeof(PROBE_BINARY_MAGIC));
+    f.n_records = w->n_records;
+    f.n_chunks = w->n_chunks;
+    f.index_offset = w->offset;
+    write_block(w, w->index, w->n_chunks * sizeof(struct probe_chunk_index));
+    f.names_offset = w->offset;
+    f.n_names = w->n_names;
+    kstring_t names = KSTRING_INIT;
+    for ( i = 0; i < w->n_names; ++i )
+	kputsn(w->names[i], strlen(w->names[i]) + 1, &names);
+    write_block(w, names.s, names.l);
+    f.header_offset = w->offset;
+    f.l_header = w->header.l;
+    write_block(w, w->header.s, w->header.l);
+    write_block(w, &f, sizeof(f));
+    int ret = fclose(w->fp) == 0 ? 0 : -1;
+
+    for ( i = 0; i < w->n_names; ++i )
+	free(w->names[i]);
+    free(w->names);
+    free(names.s);
+    kh_destroy(probe_name, (khash_t(probe_name)*)w->hash);
+    free(w->dcid);
+    free(w->dstart);
+    free(w->span);
+    free(w->length);
+    free(w->n_block);
+    free(w->rank);
+    free(w->gc);
+    free(w->repeat);
+    free(w->blocks);
+    free(w->seq);
+    free(w->mask);
+    free(w->other_pos);
+    free(w->other_base);
+    free(w->extra_offset);
+    free(w->extra.s);
+    free(w->index);
+    free(w->header.s);
+    free(w->fname);
+    free(w);
+    return ret;
+}
+
+int probe_file_is_binary(const char *fname)
+{
+    char magic[8];
+    FILE *fp = fopen(fname, "rb");
+    if ( fp == NULL )
+	return 0;
+    int ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+	memcmp(magic, PROBE_BINARY_MAGIC, sizeof(PROBE_BINARY_MAGIC)) == 0;
+    fclose(fp);
+    return ret;
+}
+
+// bytes of a chunk in the layout of probe_file_chunk(), fields of the header are checked by the caller
+static uint64_t chunk_size(const struct probe_chunk_header *h)
+{
+    uint64_t n = h->n;
+    uint64_t l = pad8(sizeof(*h)) + 3 * pad8(n * 4) + 3 * pad8(n * 2) + 2 * pad8(n);
+    l += pad8((uint64_t)h->n_stored * 4 * sizeof(int32_t)) + pad8((h->n_bases + 3) / 4);
+    if ( h->flags & PROBE_CHUNK_MASK )
+	l += pad8((h->n_bases + 7) / 8);
+    l += pad8((uint64_t)h->n_others * sizeof(uint32_t)) + pad8(h->n_others);
+    if ( h->flags & PROBE_CHUNK_EXTRA )
+	l += pad8((n + 1) * sizeof(uint32_t)) + pad8(h->l_extra);
+    return l;
+}
+
+// check the columns of the ith chunk agree with its header and the index before any record is decoded, so a corrupt
+// file is reported instead of read out of the map. return -1 on error
+static int check_chunk(const struct probe_file *pf, int i, uint64_t first_record, uint64_t end)
+{
+    const struct probe_chunk_index *idx = &pf->index[i];
+    if ( idx->first_record != first_record || idx->offset & 7 || idx->offset > end ||
+	 end - idx->offset < pad8(sizeof(struct probe_chunk_header)) )
+	return -1;
+    const struct probe_chunk_header *h = (const struct probe_chunk_header*)((const uint8_t*)pf->map + idx->offset);
+    if ( h->n == 0 || h->n > PROBE_CHUNK_SIZE || h->n != idx->n || h->n_stored > h->n ||
+	 h->n_bases > (uint64_t)h->n * UINT16_MAX || h->n_others > h->n_bases || h->l_extra > end ||
+	 chunk_size(h) > end - idx->offset )
+	return -1;
+    struct probe_chunk c;
+    probe_file_chunk(pf, i, &c);
+    uint64_t bases = 0;
+    uint32_t j, stored = 0;
+    int64_t cid = c.cid;
+    for ( j = 0; j < c.n; ++j ) {
+	cid += c.dcid[j];
+	if ( cid < 0 || cid >= pf->n_names )
+	    return -1;
+	bases += c.length[j];
+	stored += (c.n_block[j] & PROBE_BLOCK_STORED) != 0;
+	if ( c.extra_offset && (c.extra_offset[j+1] < c.extra_offset[j] || c.extra_offset[j+1] > h->l_extra) )
+	    return -1;
+    }
+    if ( bases != h->n_bases || stored != h->n_stored )
+	return -1;
+    for ( j = 0; j < c.n_others; ++j ) {
+	if ( c.other_pos[j] >= h->n_bases || (j && c.other_pos[j] <= c.other_pos[j-1]) )
+	    return -1;
+    }
+    return 0;
+}
+
+struct probe_file *probe_file_open(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if ( fd == -1 ) {
+	error_print("Failed to open %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    struct stat s;
+    if ( fstat(fd, &s) != 0 || s.st_size < 8 + sizeof(struct probe_file_footer) ) {
+	error_print("Failed to load probe file %s.", fname);
+	close(fd);
+	return NULL;
+    }
+    void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+	error_print("Failed to map %s : %s.", fname, strerror(errno));
+	return NULL;
+    }
+    const uint8_t *p = (const uint8_t*)map;
+    const struct probe_file_footer *f = (const struct probe_file_footer*)(p + s.st_size - sizeof(struct probe_file_footer));
+    if ( memcmp(p, PROBE_BINARY_MAGIC, sizeof(PROBE_BINARY_MAGIC)) != 0 ||
+	 memcmp(f->magic, PROBE_BINARY_MAGIC, sizeof(PROBE_BINARY_MAGIC)) != 0 ) {
+	error_print("%s is not a binary probe file or truncated.", fname);
+	munmap(map, s.st_size);
+	return NULL;
+    }
+    // sections before the footer, in the order written
+    uint64_t end = s.st_size - sizeof(struct probe_file_footer);
+    if ( f->index_offset > end || f->n_chunks > (end - f->index_offset) / sizeof(struct probe_chunk_index) ||
+	 f->names_offset < f->index_offset + f->n_chunks * sizeof(struct probe_chunk_index) || f->names_offset > end ||
+	 f->n_names > end - f->names_offset || f->header_offset < f->names_offset || f->header_offset > end ||
+	 f->l_header > end - f->header_offset || f->index_offset & 7 || f->n_chunks > INT32_MAX || f->n_names > INT32_MAX ) {
+	error_print("%s is corrupted or truncated.", fname);
+	munmap(map, s.st_size);
+	return NULL;
+    }
+    struct probe_file *pf = (struct probe_file*)calloc(1, sizeof(struct probe_file));
+    pf->map = map;
+    pf->map_size = s.st_size;
+    pf->n_records = f->n_records;
+    pf->n_chunks = f->n_chunks;
+    pf->index = (const struct probe_chunk_index*)(p + f->index_offset);
+    pf->n_names = f->n_names;
+    pf->names = (const char**)malloc((f->n_names + 1) * sizeof(char*));
+    const char *name = (const char*)(p + f->names_offset);
+    const char *names_end = (const char*)(p + f->header_offset);
+    int i;
+    for ( i = 0; i < pf->n_names; ++i ) {
+	const char *e = (const char*)memchr(name, '\0', names_end - name);
+	if ( e == NULL ) {
+	    error_print("%s is corrupted at names of chromosomes.", fname);
+	    probe_file_close(pf);
+	    return NULL;
+	}
+	pf->names[i] = name;
+	name = e + 1;
+    }
+    pf->header = (const char*)(p + f->header_offset);
+    pf->l_header = f->l_header;
+    // chunks are before the index, and their records add up to the count of footer
+    uint64_t n_records = 0;
+    for ( i = 0; i < pf->n_chunks; ++i ) {
+	if ( check_chunk(pf, i, n_records, f->index_offset) ) {
+	    error_print("%s is corrupted at chunk %d.", fname, i);
+	    probe_file_close(pf);
+	    return NULL;
+	}
+	n_records += pf->index[i].n;
+    }
+    if ( n_records != pf->n_records ) {
+	error_print("%s is corrupted, %"PRIu64" records in chunks but %"PRIu64" in footer.", fname, n_records,
+		    pf->n_records);
+	probe_file_close(pf);
+	return NULL;
+    }
+    return pf;
+}
+
+void probe_file_close(struct probe_file *pf)
+{
+    if ( pf == NULL )
+	return;
+    free(pf->names);
+    munmap(pf->map, pf->map_size);
+    free(pf);
+}
+
+int probe_file_chunk(const struct probe_file *pf, int i, struct probe_chunk *c)
+{
+    if ( i < 0 || i >= pf->n_chunks )
+	return -1;
+    const uint8_t *p = (const uint8_t*)pf->map + pf->index[i].offset;
+    const struct probe_chunk_header *h = (const struct probe_chunk_header*)p;
+    p += pad8(sizeof(*h));
+    c->n = h->n;
+    c->flags = h->flags;
+    c->cid = h->cid;
+    c->start = h->start;
+    c->n_bases = h->n_bases;
+    c->dcid = (const int32_t*)p;
+    p += pad8(h->n * sizeof(int32_t));
+    c->dstart = (const int32_t*)p;
+    p += pad8(h->n * sizeof(int32_t));
+    c->span = (const uint32_t*)p;
+    p += pad8(h->n * sizeof(uint32_t));
+    c->length = (const uint16_t*)p;
+    p += pad8(h->n * sizeof(uint16_t));
+    c->n_block = p;
+    p += pad8(h->n);
+    c->rank = p;
+    p += pad8(h->n);
+    c->gc = (const uint16_t*)p;
+    p += pad8(h->n * sizeof(uint16_t));
+    c->repeat = (const uint16_t*)p;
+    p += pad8(h->n * sizeof(uint16_t));
+    c->blocks = (const int32_t*)p;
+    p += pad8(h->n_stored * 4 * sizeof(int32_t));
+    c->seq = p;
+    p += pad8((h->n_bases + 3) / 4);
+    c->mask = NULL;
+    if ( h->flags & PROBE_CHUNK_MASK ) {
+	c->mask = p;
+	p += pad8((h->n_bases + 7) / 8);
+    }
+    c->n_others = h->n_others;
+    c->other_pos = (const uint32_t*)p;
+    p += pad8(h->n_others * sizeof(uint32_t));
+    c->other_base = (const char*)p;
+    p += pad8(h->n_others);
+    c->extra_offset = NULL;
+    c->extra = NULL;
+    if ( h->flags & PROBE_CHUNK_EXTRA ) {
+	c->extra_offset = (const uint32_t*)p;
+	p += pad8((h->n + 1) * sizeof(uint32_t));
+	c->extra = (const char*)p;
+    }
+    return 0;
+}
+
+void probe_iter_init(struct probe_iter *it, const struct probe_file *pf)
+{
+    memset(it, 0, sizeof(*it));
+    it->pf = pf;
+    it->i_chunk = -1;
+}
+
+static int probe_iter_load(struct probe_iter *it, int i)
+{
+    if ( probe_file_chunk(it->pf, i, &it->chunk) )
+	return -1;
+    it->i_chunk = i;
+    it->i = 0;
+    it->cid = it->chunk.cid;
+    it->start = it->chunk.start;
+    it->i_block = 0;
+    it->base = 0;
+    it->i_other = 0;
+    return 0;
+}
+
+int probe_iter_seek(struct probe_iter *it, uint64_t i)
+{
+    const struct probe_file *pf = it->pf;
+    if ( i >= pf->n_records )
+	return -1;
+    // last chunk starting at or before i
+    int lo = 0, hi = pf->n_chunks;
+    while ( hi - lo > 1 ) {
+	int mid = (lo + hi) >> 1;
+	if ( pf->index[mid].first_record <= i )
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    if ( probe_iter_load(it, lo) )
+	return -1;
+    // skip records before i, only the running columns are decoded
+    const struct probe_chunk *c = &it->chunk;
+    int k, n = i - pf->index[lo].first_record;
+    for ( k = 0; k < n; ++k ) {
+	it->cid += c->dcid[k];
+	it->start += c->dstart[k];
+	if ( c->n_block[k] & PROBE_BLOCK_STORED )
+	    it->i_block += 4;
+	it->base += c->length[k];
+    }
+    while ( it->i_other < c->n_others && c->other_pos[it->i_other] < it->base )
+	it->i_other++;
+    it->i = n;
+    return 0;
+}
+
+int probe_iter_next(struct probe_iter *it, struct probe_record *r)
+{
+    if ( it->i_chunk == -1 || it->i == it->chunk.n ) {
+	if ( probe_iter_load(it, it->i_chunk + 1) )
+	    return -1;
+    }
+    const struct probe_chunk *c = &it->chunk;
+    int i = it->i++;
+    it->cid += c->dcid[i];
+    it->start += c->dstart[i];
+    r->cid = it->cid;
+    r->start = it->start;
+    r->end = it->start + c->span[i];
+    r->length = c->length[i];
+    r->n_block = c->n_block[i] & ~PROBE_BLOCK_STORED;
+    if ( c->n_block[i] & PROBE_BLOCK_STORED ) {
+	const int32_t *b = c->blocks + it->i_block;
+	r->starts[0] = r->start + b[0];
+	r->ends[0] = r->start + b[1];
+	r->starts[1] = r->start + b[2];
+	r->ends[1] = r->start + b[3];
+	it->i_block += 4;
+    }
+    else {
+	r->starts[0] = r->start;
+	r->ends[0] = r->end;
+	r->starts[1] = r->ends[1] = 0;
+    }
+    r->repeat = c->repeat[i];
+    r->gc = c->gc[i];
+    r->rank = c->rank[i];
+
+    int j;
+    it->seq.l = 0;
+    ks_resize(&it->seq, r->length + 1);
+    for ( j = 0; j < r->length; ++j ) {
+	uint64_t k = it->base + j;
+	char b = "ACGT"[c->seq[k>>2] >> ((k & 3) << 1) & 3];
+	if ( c->mask && (c->mask[k>>3] >> (k & 7) & 1) )
+	    b += 'a' - 'A';
+	it->seq.s[j] = b;
+    }
+    while ( it->i_other < c->n_others && c->other_pos[it->i_other] < it->base + r->length ) {
+	it->seq.s[c->other_pos[it->i_other] - it->base] = c->other_base[it->i_other];
+	it->i_other++;
+    }
+    it->seq.s[r->length] = '\0';
+    it->seq.l = r->length;
+    it->base += r->length;
+    r->seq = it->seq.s;
+
+    r->extra = NULL;
+    r->l_extra = 0;
+    if ( c->extra_offset && c->extra_offset[i+1] > c->extra_offset[i] ) {
+	r->extra = c->extra + c->extra_offset[i];
+	r->l_extra = c->extra_offset[i+1] - c->extra_offset[i];
+    }
+    return 0;
+}
+
+void probe_iter_destroy(struct probe_iter *it)
+{
+    free(it->seq.s);
+    memset(it, 0, sizeof(*it));
+}
+
+void probe_record_format(const struct probe_file *pf, const struct probe_record *r, kstring_t *str)
+{
+    ksprintf(str, "%s\t%d\t%d\t%d\t%s\t%d\t", pf->names[r->cid], r->start, r->end, r->length, r->seq, r->n_block);
+    if ( r->n_block == 2 )
+	ksprintf(str, "%d,%d,\t%d,%d,\t", r->starts[0], r->starts[1], r->ends[0], r->ends[1]);
+    else
+	ksprintf(str, "%d,\t%d,\t", r->starts[0], r->ends[0]);
+    ksprintf(str, "%d.%02d\t%d.%02d\t%d", r->repeat / 100, r->repeat % 100, r->gc / 100, r->gc % 100, r->rank);
+    if ( r->l_extra ) {
+	kputc('\t', str);
+	kputsn(r->extra, r->l_extra, str);
+    }
+    kputc('\n', str);
+}
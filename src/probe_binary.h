@@ -0,0 +1,138 @@
+// probe_binary.h - binary columnar format of probe file, an alternative of probes.txt.gz for large panels.
+//
+// Records are grouped in chunks of PROBE_CHUNK_SIZE, each chunk keeps its columns in separate arrays : chromosome id
+// and start are delta encoded, sequences are packed in 2 bits with a soft-mask plane and a short list of other bases,
+// repeat ratio and GC content are kept in fixed point (1/100), optional columns of the text format are kept as raw
+// text. Names of chromosomes, the text header and a chunk index for random access are kept at the end of the file, so
+// the file can be written in one pass and mapped into memory for reading.
+
+#ifndef PROBE_BINARY_HEADER
+#define PROBE_BINARY_HEADER
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/kstring.h"
+
+#define PROBE_BINARY_MAGIC "PRBIN\1"
+#define PROBE_CHUNK_SIZE 65536
+
+// chunk flags
+#define PROBE_CHUNK_MASK  1
+#define PROBE_CHUNK_EXTRA 2
+
+// n_block of records with block coordinates kept in the block array
+#define PROBE_BLOCK_STORED 0x80
+
+struct probe_record {
+    int cid;
+    int start;
+    int end;
+    int length;
+    int n_block;
+    int starts[2];
+    int ends[2];
+    // fixed point, in 1/100
+    int repeat;
+    int gc;
+    int rank;
+    const char *seq;
+    // optional columns after rank, tab separated, NULL for none
+    const char *extra;
+    int l_extra;
+};
+
+struct probe_chunk_index {
+    uint64_t offset;
+    uint64_t first_record;
+    int32_t cid;
+    int32_t start;
+    uint32_t n;
+    uint32_t flags;
+};
+
+// columns of a chunk, pointers to the mapped file
+struct probe_chunk {
+    int n;
+    uint32_t flags;
+    int cid;
+    int start;
+    uint64_t n_bases;
+    const int32_t *dcid;
+    const int32_t *dstart;
+    // end - start
+    const uint32_t *span;
+    const uint16_t *length;
+    const uint8_t *n_block;
+    const uint8_t *rank;
+    const uint16_t *gc;
+    const uint16_t *repeat;
+    // starts[0], ends[0], starts[1], ends[1] relative to start, for records with PROBE_BLOCK_STORED
+    const int32_t *blocks;
+    const uint8_t *seq;
+    // bit set for lower case bases, NULL if no lower case base in the chunk
+    const uint8_t *mask;
+    // bases other than A,C,G,T
+    uint32_t n_others;
+    const uint32_t *other_pos;
+    const char *other_base;
+    // n+1 offsets of optional columns, NULL if no optional column in the chunk
+    const uint32_t *extra_offset;
+    const char *extra;
+};
+
+struct probe_file {
+    void *map;
+    size_t map_size;
+    uint64_t n_records;
+    int n_chunks;
+    const struct probe_chunk_index *index;
+    int n_names;
+    const char **names;
+    // text header, lines start with '#'
+    const char *header;
+    uint64_t l_header;
+};
+
+struct probe_iter {
+    const struct probe_file *pf;
+    int i_chunk;
+    struct probe_chunk chunk;
+    // next record in the chunk
+    int i;
+    int cid;
+    int start;
+    int i_block;
+    uint64_t base;
+    uint32_t i_other;
+    kstring_t seq;
+};
+
+// fixed point of ratio, rounded in the same way as printf("%.2f")
+extern int probe_fixed(float x);
+
+extern struct probe_writer *probe_writer_open(const char *fname);
+// return chromosome id of name, names are added in order of the first call
+extern int probe_writer_add_name(struct probe_writer *w, const char *name);
+extern void probe_writer_set_header(struct probe_writer *w, const char *header, size_t l);
+extern int probe_writer_push(struct probe_writer *w, const struct probe_record *r);
+extern uint64_t probe_writer_records(const struct probe_writer *w);
+// flush the last chunk, write names, header and index, return 0 on success
+extern int probe_writer_close(struct probe_writer *w);
+
+// return 1 if the file starts with the magic string of binary probe file
+extern int probe_file_is_binary(const char *fname);
+extern struct probe_file *probe_file_open(const char *fname);
+extern void probe_file_close(struct probe_file *pf);
+// columns of the ith chunk, return -1 if out of range
+extern int probe_file_chunk(const struct probe_file *pf, int i, struct probe_chunk *c);
+
+extern void probe_iter_init(struct probe_iter *it, const struct probe_file *pf);
+// seek to the ith record by the chunk index, return -1 if out of range
+extern int probe_iter_seek(struct probe_iter *it, uint64_t i);
+// decode next record, r->seq is valid until next call, return -1 at the end
+extern int probe_iter_next(struct probe_iter *it, struct probe_record *r);
+extern void probe_iter_destroy(struct probe_iter *it);
+
+// export a record in text format, with the trailing newline
+extern void probe_record_format(const struct probe_file *pf, const struct probe_record *r, kstring_t *str);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "probe_format.h"
+
+static const char digits2[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// write x at p, return the end
+static inline char *put_uint64(char *p, uint64_t x)
+{
+    char buf[20];
+    int i = 20;
+    while ( x >= 100 ) {
+	int d = (x % 100) * 2;
+	x /= 100;
+	buf[--i] = digits2[d+1];
+	buf[--i] = digits2[d];
+    }
+    if ( x >= 10 ) {
+	buf[--i] = digits2[x*2+1];
+	buf[--i] = digits2[x*2];
+    } else {
+	buf[--i] = '0' + x;
+    }
+    memcpy(p, buf + i, 20 - i);
+    return p + 20 - i;
+}
+
+static inline char *put_int32(char *p, int32_t x)
+{
+    if ( x < 0 ) {
+	*p++ = '-';
+	return put_uint64(p, -(int64_t)x);
+    }
+    return put_uint64(p, x);
+}
+
+// fixed point in 1/100
+static inline char *put_fixed2(char *p, int x)
+{
+    p = put_uint64(p, x / 100);
+    *p++ = '.';
+    *p++ = digits2[(x % 100) * 2];
+    *p++ = digits2[(x % 100) * 2 + 1];
+    return p;
+}
+
+void probe_format_init(struct probe_format *f, char *const *names, int n)
+{
+    int i;
+    f->n = n;
+    f->names.l = 0;
+    f->offset = (int*)realloc(f->offset, (n > 0 ? n : 1) * sizeof(int));
+    f->length = (int*)realloc(f->length, (n > 0 ? n : 1) * sizeof(int));
+    for ( i = 0; i < n; ++i ) {
+	f->offset[i] = f->names.l;
+	kputs(names[i], &f->names);
+	kputc('\t', &f->names);
+	f->length[i] = f->names.l - f->offset[i];
+    }
+}
+
+void probe_format_destroy(struct probe_format *f)
+{
+    free(f->names.s);
+    free(f->offset);
+    free(f->length);
+    memset(f, 0, sizeof(*f));
+}
+
+void probe_format_record(const struct probe_format *f, const struct probe_record *r, kstring_t *s)
+{
+    int l_name = f->length[r->cid];
+    // enough for all the numbers and tabs
+    ks_resize(s, s->l + l_name + r->length + 160);
+    char *p = s->s + s->l;
+    memcpy(p, f->names.s + f->offset[r->cid], l_name);
+    p += l_name;
+    p = put_int32(p, r->start);
+    *p++ = '\t';
+    p = put_int32(p, r->end);
+    *p++ = '\t';
+    p = put_int32(p, r->length);
+    *p++ = '\t';
+    if ( r->seq ) {
+	memcpy(p, r->seq, r->length);
+	p += r->length;
+    } else {
+	*p++ = '.';
+    }
+    *p++ = '\t';
+    p = put_int32(p, r->n_block);
+    *p++ = '\t';
+    p = put_int32(p, r->starts[0]);
+    *p++ = ',';
+    if ( r->n_block == 2 ) {
+	p = put_int32(p, r->starts[1]);
+	*p++ = ',';
+    }
+    *p++ = '\t';
+    p = put_int32(p, r->ends[0]);
+    *p++ = ',';
+    if ( r->n_block == 2 ) {
+	p = put_int32(p, r->ends[1]);
+	*p++ = ',';
+    }
+    *p++ = '\t';
+    p = put_fixed2(p, r->repeat);
+    *p++ = '\t';
+    p = put_fixed2(p, r->gc);
+    *p++ = '\t';
+    p = put_int32(p, r->rank);
+    s->l = p - s->s;
+    s->s[s->l] = '\0';
+}
+
+void kput_int32(int32_t x, kstring_t *s)
+{
+    ks_resize(s, s->l + 13);
+    s->l = put_int32(s->s + s->l, x) - s->s;
+    s->s[s->l] = '\0';
+}
+
+void kput_fixed(float x, int decimals, kstring_t *s)
+{
+    static const int scale[5] = { 1, 10, 100, 1000, 10000 };
+    if ( !isfinite(x) || fabsf(x) > 1e9 || decimals < 0 || decimals > 4 ) {
+	ksprintf(s, "%.*f", decimals, x);
+	return;
+    }
+    // a float times the scale is exact in double, so ties are rounded to even like printf
+    uint64_t v = llrint(fabs((double)x) * scale[decimals]);
+    ks_resize(s, s->l + 24);
+    char *p = s->s + s->l;
+    // printf keeps the sign of negative values rounded to zero
+    if ( signbit(x) )
+	*p++ = '-';
+    p = put_uint64(p, v / scale[decimals]);
+    if ( decimals ) {
+	char frac[4];
+	int i, d = v % scale[decimals];
+	for ( i = decimals - 1; i >= 0; --i, d /= 10 )
+	    frac[i] = '0' + d % 10;
+	*p++ = '.';
+	memcpy(p, frac, decimals);
+	p += decimals;
+    }
+    s->l = p - s->s;
+    s->s[s->l] = '\0';
+}
+
+#ifdef _MAIN_PROBE_FORMAT
+// benchmark of the formatter, checked against ksprintf
+#include <time.h>
+#include <inttypes.h>
+
+static void printf_record(char *const *names, const struct probe_record *r, float repeat, float gc, kstring_t *s)
+{
+    if ( r->n_block == 2 )
+	ksprintf(s, "%s\t%d\t%d\t%d\t%s\t%d\t%d,%d,\t%d,%d,\t%.2f\t%.2f\t%d", names[r->cid], r->start, r->end, r->length, r->seq, 2, r->starts[0], r->starts[1], r->ends[0], r->ends[1], repeat, gc, r->rank);
+    else
+	ksprintf(s, "%s\t%d\t%d\t%d\t%s\t%d\t%d,\t%d,\t%.2f\t%.2f\t%d", names[r->cid], r->start, r->end, r->length, r->seq, 1, r->starts[0], r->ends[0], repeat, gc, r->rank);
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int l = argc > 2 ? atoi(argv[2]) : 120;
+    if ( n < 1 || l < 1 || l > 65535 )
+	error("Bad number or length of oligos.");
+    char *names[3] = { "chr1", "chrX", "chrUn_KI270302v1" };
+    struct probe_format f = PROBE_FORMAT_INIT;
+    probe_format_init(&f, names, 3);
+    struct probe_record *recs = (struct probe_record*)calloc(n, sizeof(struct probe_record));
+    float *ratios = (float*)malloc(n * 2 * sizeof(float));
+    char *seq = (char*)malloc(l + 1);
+    check_mem(recs);
+    int i, j;
+    srand(11);
+    for ( j = 0; j < l; ++j )
+	seq[j] = "ACGT"[rand() & 3];
+    seq[l] = '\0';
+    for ( i = 0; i < n; ++i ) {
+	struct probe_record *r = &recs[i];
+	r->cid = rand() % 3;
+	r->start = rand() % 250000000;
+	r->length = l;
+	r->end = r->start + l + (rand() & 1 ? 0 : rand() % 100);
+	r->seq = seq;
+	r->n_block = r->end - r->start > l ? 2 : 1;
+	r->starts[0] = r->start;
+	r->ends[0] = r->n_block == 2 ? r->start + l / 2 : r->end;
+	r->starts[1] = r->end - (l - l / 2);
+	r->ends[1] = r->end;
+	r->rank = rand() % 4;
+	// ratios of real oligos are k/l
+	ratios[i*2] = (float)(rand() % (l + 1)) / l;
+	ratios[i*2+1] = (float)(rand() % (l + 1)) / l;
+	r->repeat = probe_fixed(ratios[i*2]);
+	r->gc = probe_fixed(ratios[i*2+1]);
+    }
+    kstring_t a = { 0, 0, 0 }, b = { 0, 0, 0 };
+    for ( i = 0; i < n; ++i ) {
+	a.l = b.l = 0;
+	printf_record(names, &recs[i], ratios[i*2], ratios[i*2+1], &a);
+	probe_format_record(&f, &recs[i], &b);
+	if ( a.l != b.l || memcmp(a.s, b.s, a.l) != 0 )
+	    error("Inconsistent lines :\n%s\n%s", a.s, b.s);
+    }
+    // fixed point of other columns, Tm, dG and score
+    for ( i = 0; i < n; ++i ) {
+	float x = ((float)rand() / RAND_MAX - 0.5) * 200;
+	int d = i % 3;
+	a.l = b.l = 0;
+	ksprintf(&a, "%.*f", d, x);
+	kput_fixed(x, d, &b);
+	if ( a.l != b.l || memcmp(a.s, b.s, a.l) != 0 )
+	    error("Inconsistent numbers : %s %s", a.s, b.s);
+    }
+    LOG_print("%d lines checked.", n);
+
+    uint64_t sum = 0;
+    clock_t t = clock();
+    for ( i = 0; i < n; ++i ) {
+	a.l = 0;
+	printf_record(names, &recs[i], ratios[i*2], ratios[i*2+1], &a);
+	sum += a.l;
+    }
+    double sec0 = (double)(clock() - t) / CLOCKS_PER_SEC;
+    t = clock();
+    for ( i = 0; i < n; ++i ) {
+	b.l = 0;
+	probe_format_record(&f, &recs[i], &b);
+	sum += b.l;
+    }
+    double sec1 = (double)(clock() - t) / CLOCKS_PER_SEC;
+    LOG_print("ksprintf : %.2f sec, %.1f ns per line.", sec0, sec0 * 1e9 / n);
+    LOG_print("probe_format : %.2f sec, %.1f ns per line, checksum %"PRIu64".", sec1, sec1 * 1e9 / n, sum);
+    free(a.s);
+    free(b.s);
+    free(recs);
+    free(ratios);
+    free(seq);
+    probe_format_destroy(&f);
+    return 0;
+}
+#endif
@@ -0,0 +1,29 @@
+// probe_format.h - formatter of probe lines without printf. Chromosome names are kept as ready fragments, integers are
+// converted two digits at a time, and ratios are printed from fixed point, the output is byte-identical with the
+// printf based formatting ("%d" and "%.2f").
+
+#ifndef PROBE_FORMAT_HEADER
+#define PROBE_FORMAT_HEADER
+#include <stdint.h>
+#include "htslib/kstring.h"
+#include "probe_binary.h"
+
+struct probe_format {
+    int n;
+    // "name\t" of each chromosome
+    kstring_t names;
+    int *offset;
+    int *length;
+};
+
+#define PROBE_FORMAT_INIT { 0, { 0, 0, 0 }, 0, 0 }
+
+extern void probe_format_init(struct probe_format *f, char *const *names, int n);
+extern void probe_format_destroy(struct probe_format *f);
+// base columns of record, from chrom to rank, without the trailing newline, sequence is "." if r->seq is NULL
+extern void probe_format_record(const struct probe_format *f, const struct probe_record *r, kstring_t *s);
+extern void kput_int32(int32_t x, kstring_t *s);
+// same as printf("%.*f", decimals, x), decimals should be no more than 4
+extern void kput_fixed(float x, int decimals, kstring_t *s);
+
+#endif
@@ -0,0 +1,267 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
+#include "probe_shard.h"
+#include "run_stats.h"
+#include "trace.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+
+// empty block at the end of BGZF files
+static const uint8_t bgzf_eof[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+struct shard {
+    int id;
+    char *fname;
+    kstring_t text;
+    int n, m;
+    // cid, start and end of each line
+    int *coords;
+    // virtual offset in the shard after each line
+    uint64_t *voffs;
+    int failed;
+};
+
+struct probe_shards {
+    const char *fname;
+    int fd;
+    // bytes written to output
+    uint64_t offset;
+    t_pool *pool;
+    t_results_queue *results;
+    int n_threads;
+    int n_pending;
+    int n_shards;
+    struct shard *cur;
+    hts_idx_t *idx;
+};
+
+static struct shard *shard_init(struct probe_shards *s)
+{
+    struct shard *sh = (struct shard*)calloc(1, sizeof(struct shard));
+    kstring_t str = KSTRING_INIT;
+    ksprintf(&str, "%s.shard.%d", s->fname, s->n_shards);
+    sh->id = s->n_shards++;
+    sh->fname = str.s;
+    return sh;
+}
+
+static void shard_destroy(struct shard *sh)
+{
+    free(sh->fname);
+    free(sh->text.s);
+    free(sh->coords);
+    free(sh->voffs);
+    free(sh);
+}
+
+static const struct trace_kind trace_shard = { "compress_shard", "compress", NULL, { "lines", "bytes" } };
+
+// compress lines of the shard to its own file, keep the virtual offset after each line
+static void *shard_compress(void *_sh)
+{
+    struct shard *sh = (struct shard*)_sh;
+    double cpu = run_stats_thread_cpu();
+    TRACE_BEGIN(t);
+    BGZF *fp = bgzf_open(sh->fname, "w");
+    if ( fp == NULL ) {
+        sh->failed = 1;
+        return sh;
+    }
+    if ( sh->n == 0 ) {
+        if ( sh->text.l && bgzf_write(fp, sh->text.s, sh->text.l) != sh->text.l )
+            sh->failed = 1;
+    }
+    else {
+        sh->voffs = (uint64_t*)malloc(sh->n * sizeof(uint64_t));
+        char *p = sh->text.s;
+        int i;
+        for ( i = 0; i < sh->n && sh->failed == 0; ++i ) {
+            char *e = strchr(p, '\n') + 1;
+            if ( bgzf_write(fp, p, e - p) != e - p )
+                sh->failed = 1;
+            sh->voffs[i] = bgzf_tell(fp);
+            p = e;
+        }
+    }
+    if ( bgzf_close(fp) != 0 )
+        sh->failed = 1;
+    run_stats_add_cpu(STAGE_COMPRESS, run_stats_thread_cpu() - cpu);
+    TRACE_SPAN(&trace_shard, t, NULL, sh->n, (int)sh->text.l);
+    return sh;
+}
+
+// append the shard without its EOF block
+static int append_file(struct probe_shards *s, const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if ( fd < 0 )
+        return -1;
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || st.st_size < sizeof(bgzf_eof) ) {
+        close(fd);
+        return -1;
+    }
+    size_t left = st.st_size - sizeof(bgzf_eof);
+    s->offset += left;
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    // copied in the kernel, or shared extents on some file systems
+    while ( left > 0 ) {
+        ssize_t n = copy_file_range(fd, NULL, s->fd, NULL, left, 0);
+        if ( n <= 0 )
+            break;
+        left -= n;
+    }
+#endif
+    char buf[65536];
+    if ( left > 0 && lseek(fd, st.st_size - sizeof(bgzf_eof) - left, SEEK_SET) < 0 ) {
+        close(fd);
+        return -1;
+    }
+    while ( left > 0 ) {
+        ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+        if ( n <= 0 || write(s->fd, buf, n) != n ) {
+            close(fd);
+            return -1;
+        }
+        left -= n;
+    }
+    close(fd);
+    return 0;
+}
+
+static void shard_finish(struct probe_shards *s, struct shard *sh)
+{
+    uint64_t base = s->offset;
+    if ( sh->failed || append_file(s, sh->fname) != 0 )
+        error("Failed to write shard %s : %s.", sh->fname, strerror(errno));
+    unlink(sh->fname);
+    int i;
+    for ( i = 0; i < sh->n && s->idx; ++i ) {
+        uint64_t v = (base + (sh->voffs[i] >> 16)) << 16 | (sh->voffs[i] & 0xffff);
+        if ( hts_idx_push(s->idx, sh->coords[i*3], sh->coords[i*3+1], sh->coords[i*3+2], v, 1) < 0 ) {
+            warnings("Probes are not sorted, index is not built.");
+            hts_idx_destroy(s->idx);
+            s->idx = NULL;
+        }
+    }
+    shard_destroy(sh);
+}
+
+static void collect_shards(struct probe_shards *s, int all)
+{
+    int wait = all || s->n_pending >= s->n_threads * 2;
+    while ( s->n_pending > 0 ) {
+        run_stats_wait(wait);
+        t_pool_result *r = wait ? t_pool_next_result_wait(s->results) : t_pool_next_result(s->results);
+        run_stats_wait(0);
+        if ( r == NULL )
+            break;
+        shard_finish(s, (struct shard*)r->data);
+        t_pool_delete_result(r, 0);
+        s->n_pending--;
+        // at most two shards of each thread are kept in memory
+        wait = all || s->n_pending >= s->n_threads * 2;
+    }
+}
+
+static void dispatch_shard(struct probe_shards *s)
+{
+    struct shard *sh = s->cur;
+    s->cur = NULL;
+    if ( sh == NULL )
+        return;
+    if ( s->pool == NULL ) {
+        shard_finish(s, (struct shard*)shard_compress(sh));
+        return;
+    }
+    // blocks if the queue of pool is full
+    run_stats_wait(1);
+    t_pool_dispatch(s->pool, s->results, shard_compress, sh);
+    run_stats_wait(0);
+    s->n_pending++;
+    collect_shards(s, 0);
+}
+
+struct probe_shards *probe_shards_open(const char *fname, const char *header, size_t l, t_pool *pool, int n_threads)
+{
+    struct probe_shards *s = (struct probe_shards*)calloc(1, sizeof(struct probe_shards));
+    s->fname = fname;
+    s->fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if ( s->fd < 0 ) {
+        free(s);
+        return NULL;
+    }
+    s->pool = pool;
+    s->results = pool ? t_results_queue_init() : NULL;
+    s->n_threads = n_threads < 1 ? 1 : n_threads;
+    // header is a shard without records, so the first record starts a new block
+    struct shard *sh = shard_init(s);
+    kputsn(header, l, &sh->text);
+    shard_finish(s, (struct shard*)shard_compress(sh));
+    return s;
+}
+
+uint64_t probe_shards_tell(const struct probe_shards *s)
+{
+    return s->offset << 16;
+}
+
+void probe_shards_set_index(struct probe_shards *s, hts_idx_t *idx)
+{
+    s->idx = idx;
+}
+
+void probe_shards_push(struct probe_shards *s, int cid, int start, int end, const char *line, int l)
+{
+    struct shard *sh = s->cur;
+    // a shard keeps one chromosome
+    if ( sh && (sh->coords[(sh->n-1)*3] != cid || sh->text.l + l > PROBE_SHARD_SIZE) ) {
+        dispatch_shard(s);
+        sh = NULL;
+    }
+    if ( sh == NULL )
+        sh = s->cur = shard_init(s);
+    if ( sh->n == sh->m ) {
+        sh->m = sh->m ? sh->m * 2 : 1024;
+        sh->coords = (int*)realloc(sh->coords, sh->m * 3 * sizeof(int));
+    }
+    sh->coords[sh->n*3] = cid;
+    sh->coords[sh->n*3+1] = start;
+    sh->coords[sh->n*3+2] = end;
+    sh->n++;
+    kputsn(line, l, &sh->text);
+}
+
+int probe_shards_close(struct probe_shards *s, hts_idx_t **idx)
+{
+    int ret = 0;
+    dispatch_shard(s);
+    collect_shards(s, 1);
+    if ( s->idx )
+        hts_idx_finish(s->idx, probe_shards_tell(s));
+    if ( write(s->fd, bgzf_eof, sizeof(bgzf_eof)) != sizeof(bgzf_eof) || close(s->fd) != 0 )
+        ret = -1;
+    if ( idx )
+        *idx = s->idx;
+    if ( s->results ) {
+        // workers may still hold the queue after their results are taken
+        t_pool_flush(s->pool);
+        t_results_queue_destroy(s->results);
+    }
+    free(s);
+    return ret;
+}
@@ -0,0 +1,29 @@
+// probe_shard.h - write probes.txt.gz by independent BGZF shards compressed in parallel.
+//
+// Lines are collected in shards of one chromosome and up to PROBE_SHARD_SIZE bytes, each shard is compressed by a
+// worker of the thread pool into its own BGZF file. BGZF members can be concatenated byte-wise, so finished shards
+// are appended to the output in order without recompression (by copy_file_range if possible), and the virtual
+// offsets of lines recorded in the shard are shifted by the position of the shard to build the tabix index.
+
+#ifndef PROBE_SHARD_HEADER
+#define PROBE_SHARD_HEADER
+#include <stdint.h>
+#include "htslib/hts.h"
+#include "cram/thread_pool.h"
+
+#define PROBE_SHARD_SIZE (4<<20)
+
+// open output, header is compressed and written at once, return NULL on failure
+extern struct probe_shards *probe_shards_open(const char *fname, const char *header, size_t l, t_pool *pool,
+                                              int n_threads);
+// virtual offset of the end of the written data, the first record starts here
+extern uint64_t probe_shards_tell(const struct probe_shards *s);
+// keep the index of records, initialized by the caller with probe_shards_tell()
+extern void probe_shards_set_index(struct probe_shards *s, hts_idx_t *idx);
+// line should end with '\n', the line is kept by copy
+extern void probe_shards_push(struct probe_shards *s, int cid, int start, int end, const char *line, int l);
+// flush all shards and write the EOF block, return 0 on success. The finished index is returned by idx, or NULL if
+// it is dropped for unsorted records
+extern int probe_shards_close(struct probe_shards *s, hts_idx_t **idx);
+
+#endif
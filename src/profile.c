@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <ctype.h>
+#include "utils.h"
+#include "seq_utils.h"
+#include "profile.h"
+
+void region_profile_build(struct region_profile *p, const char *seq, int len)
+{
+    int i, k;
+    if ( len + 1 > p->m ) {
+        // grown by half, so regions in increasing length do not realloc each time
+        p->m = len + 1;
+        p->m += p->m >> 1;
+        p->lower = (int32_t*)realloc(p->lower, p->m * sizeof(int32_t));
+        p->amb = (int32_t*)realloc(p->amb, p->m * sizeof(int32_t));
+        p->run_start = (int32_t*)realloc(p->run_start, p->m * sizeof(int32_t));
+        p->variant = (int32_t*)realloc(p->variant, p->m * sizeof(int32_t));
+        for ( k = 0; k < PROFILE_LEVELS; ++k )
+            p->rmq[k] = (uint8_t*)realloc(p->rmq[k], p->m);
+    }
+    p->l = len;
+    p->lower[0] = p->amb[0] = 0;
+    for ( i = 0; i < len; ++i ) {
+        unsigned char c = seq[i];
+        int amb = seq_nt4_table[c] > 3;
+        p->lower[i+1] = p->lower[i] + (!amb && islower(c));
+        p->amb[i+1] = p->amb[i] + amb;
+        p->run_start[i] = i > 0 && toupper(c) == toupper((unsigned char)seq[i-1]) ? p->run_start[i-1] : i;
+    }
+    uint8_t *run = p->rmq[0];
+    for ( i = len - 1; i >= 0; --i ) {
+        int n = i + 1 < len && p->run_start[i+1] == p->run_start[i] ? run[i+1] + 1 : 1;
+        run[i] = n > 255 ? 255 : n;
+    }
+    for ( k = 1; k < PROFILE_LEVELS; ++k ) {
+        int half = 1 << (k - 1);
+        for ( i = 0; i + (1 << k) <= len; ++i )
+            p->rmq[k][i] = p->rmq[k-1][i] > p->rmq[k-1][i+half] ? p->rmq[k-1][i] : p->rmq[k-1][i+half];
+    }
+}
+
+void region_profile_destroy(struct region_profile *p)
+{
+    int k;
+    free(p->lower);
+    free(p->amb);
+    free(p->run_start);
+    free(p->variant);
+    for ( k = 0; k < PROFILE_LEVELS; ++k ) {
+        free(p->rmq[k]);
+        p->rmq[k] = 0;
+    }
+    p->lower = p->amb = p->run_start = p->variant = 0;
+    p->l = p->m = 0;
+}
+
+void region_profile_variants(struct region_profile *p, int beg, int len, const uint32_t *sites, int n, int start)
+{
+    int i, j = 0;
+    if ( beg == 0 )
+        p->variant[0] = 0;
+    for ( i = 0; i < len; ++i ) {
+        int count = 0;
+        while ( j < n && (int)sites[j] - start <= i ) {
+            if ( (int)sites[j] - start == i )
+                count = 1;
+            j++;
+        }
+        p->variant[beg+i+1] = p->variant[beg+i] + count;
+    }
+}
+
+int region_homopolymer(const struct region_profile *p, int beg, int len)
+{
+    int end = beg + len;
+    // the run crossing the end of window is clipped, runs start before it are inside the window or start before beg
+    int s = p->run_start[end-1];
+    if ( s <= beg )
+        return len;
+    int max = end - s;
+    int n = s - beg, k = 0;
+    while ( (2 << k) <= n )
+        k++;
+    int a = p->rmq[k][beg], b = p->rmq[k][s - (1 << k)];
+    if ( a > max ) max = a;
+    if ( b > max ) max = b;
+    return max;
+}
@@ -0,0 +1,50 @@
+// profile.h - composition profile of a design region, filled once for each region so that the soft-masked ratio,
+// ambiguous bases and the longest homopolymer of any window are answered in O(1).
+
+#ifndef PROFILE_HEADER
+#define PROFILE_HEADER
+#include <stdint.h>
+
+// longest window supported by homopolymer queries
+#define PROFILE_MAX_WINDOW 256
+#define PROFILE_LEVELS 9
+
+struct region_profile {
+    int l, m;
+    // prefix counts of soft-masked (lower case) bases and bases other than A,C,G,T
+    int32_t *lower;
+    int32_t *amb;
+    // start of the homopolymer run containing base i
+    int32_t *run_start;
+    // prefix counts of common variant sites, filled by region_profile_variants()
+    int32_t *variant;
+    // sparse table of run lengths from base i to the end of its run, capped at 255, rmq[k][i] is the max of 2^k bases
+    uint8_t *rmq[PROFILE_LEVELS];
+};
+
+#define REGION_PROFILE_INIT { 0, 0, 0, 0, 0, 0, { 0 } }
+
+extern void region_profile_build(struct region_profile *p, const char *seq, int len);
+extern void region_profile_destroy(struct region_profile *p);
+// fill variant counts of bases [beg, beg+len) by sorted sites, start is the genome position of base beg. counts of bases
+// before beg should be filled already
+extern void region_profile_variants(struct region_profile *p, int beg, int len, const uint32_t *sites, int n, int start);
+// longest homopolymer inside window [beg, beg+len), len should be no more than PROFILE_MAX_WINDOW
+extern int region_homopolymer(const struct region_profile *p, int beg, int len);
+
+static inline float region_repeat(const struct region_profile *p, int beg, int len)
+{
+    return (float)(p->lower[beg+len] - p->lower[beg]) / len;
+}
+
+static inline int region_variants(const struct region_profile *p, int beg, int len)
+{
+    return p->variant[beg+len] - p->variant[beg];
+}
+
+static inline int region_amb(const struct region_profile *p, int beg, int len)
+{
+    return p->amb[beg+len] - p->amb[beg];
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "utils.h"
+#include "run_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t read_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+static inline uint64_t read_ticks(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
+
+#define MAX_COUNTERS 64
+
+static const char *stage_names[RUN_STAGES] = {
+    "setup", "bed_parse", "merge", "db_join", "fetch", "score", "format", "compress", "summary"
+};
+
+static struct {
+    int stage;
+    int waiting;
+    uint64_t start_ticks;
+    double start_wall;
+    // ticks of the last switch
+    uint64_t last;
+    // CPU time of the main thread at the start of phase
+    double phase_cpu;
+    uint64_t phase_ticks[RUN_STAGES];
+    uint64_t wait_ticks[RUN_STAGES];
+    uint64_t ticks[RUN_STAGES];
+    double cpu[RUN_STAGES];
+    // nanoseconds of worker threads
+    uint64_t worker_cpu[RUN_STAGES];
+    // heap allocations, only counted by the ALLOC_STATS build
+    uint64_t allocs[RUN_STAGES];
+    int n_counters;
+    const char *keys[MAX_COUNTERS];
+    uint64_t values[MAX_COUNTERS];
+} stats;
+
+static double wall_time(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+double run_stats_thread_cpu(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void run_stats_start(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.stage = STAGE_SETUP;
+    stats.start_wall = wall_time();
+    stats.phase_cpu = run_stats_thread_cpu();
+    stats.start_ticks = stats.last = read_ticks();
+}
+
+static inline void add_ticks(void)
+{
+    uint64_t now = read_ticks();
+    if ( stats.waiting )
+        stats.wait_ticks[stats.stage] += now - stats.last;
+    else
+        stats.phase_ticks[stats.stage] += now - stats.last;
+    stats.last = now;
+}
+
+int run_stats_switch(int stage)
+{
+    int prev = stats.stage;
+    add_ticks();
+    stats.stage = stage;
+    return prev;
+}
+
+void run_stats_wait(int waiting)
+{
+    add_ticks();
+    stats.waiting = waiting;
+}
+
+void run_stats_phase(int stage)
+{
+    run_stats_switch(stage);
+    double cpu = run_stats_thread_cpu();
+    uint64_t sum = 0;
+    int i;
+    for ( i = 0; i < RUN_STAGES; ++i )
+        sum += stats.phase_ticks[i];
+    for ( i = 0; i < RUN_STAGES; ++i ) {
+        if ( sum )
+            stats.cpu[i] += (cpu - stats.phase_cpu) * stats.phase_ticks[i] / sum;
+        stats.ticks[i] += stats.phase_ticks[i] + stats.wait_ticks[i];
+        stats.phase_ticks[i] = 0;
+        stats.wait_ticks[i] = 0;
+    }
+    stats.phase_cpu = cpu;
+}
+
+void run_stats_add_cpu(int stage, double sec)
+{
+    __sync_fetch_and_add(&stats.worker_cpu[stage], (uint64_t)(sec * 1e9));
+}
+
+void run_stats_set(const char *key, uint64_t value)
+{
+    int i;
+    for ( i = 0; i < stats.n_counters; ++i ) {
+        if ( strcmp(stats.keys[i], key) == 0 ) {
+            stats.values[i] = value;
+            return;
+        }
+    }
+    if ( stats.n_counters == MAX_COUNTERS )
+        return;
+    stats.keys[stats.n_counters] = key;
+    stats.values[stats.n_counters++] = value;
+}
+
+#ifdef ALLOC_STATS
+// The ALLOC_STATS build is linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so each allocation of the
+// program and htslib goes through the wrappers below and is counted in the current stage of the main thread.
+// Allocations of worker threads are counted in that stage too.
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t n, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+
+static inline void count_alloc(void)
+{
+    __sync_fetch_and_add(&stats.allocs[stats.stage], 1);
+}
+void *__wrap_malloc(size_t size)
+{
+    count_alloc();
+    return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size)
+{
+    count_alloc();
+    return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    count_alloc();
+    return __real_realloc(ptr, size);
+}
+#endif
+
+int run_stats_write(const char *fname, const char *program, const char *version)
+{
+    run_stats_phase(stats.stage);
+    double wall = wall_time() - stats.start_wall;
+    // ticks are calibrated by the wall time of the whole run
+    uint64_t total = stats.last - stats.start_ticks;
+    double tick_sec = total ? wall / total : 0;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    long max_rss = ru.ru_maxrss / 1024;
+#else
+    long max_rss = ru.ru_maxrss;
+#endif
+    FILE *fp = fopen(fname, "w");
+    if ( fp == NULL )
+        return -1;
+    fprintf(fp, "{\n  \"program\": \"%s\",\n  \"version\": \"%s\",\n", program, version);
+    fprintf(fp, "  \"wall_sec\": %.6f,\n  \"cpu_sec\": %.6f,\n  \"peak_rss_kb\": %ld,\n", wall,
+            ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6, max_rss);
+    fprintf(fp, "  \"stages\": {\n");
+    int i;
+    for ( i = 0; i < RUN_STAGES; ++i ) {
+        fprintf(fp, "    \"%s\": { \"wall_sec\": %.6f, \"cpu_sec\": %.6f", stage_names[i], stats.ticks[i] * tick_sec,
+                stats.cpu[i] + stats.worker_cpu[i] * 1e-9);
+#ifdef ALLOC_STATS
+        fprintf(fp, ", \"allocs\": %"PRIu64, stats.allocs[i]);
+#endif
+        fprintf(fp, " }%s\n", i == RUN_STAGES - 1 ? "" : ",");
+    }
+    fprintf(fp, "  },\n  \"counts\": {\n");
+    for ( i = 0; i < stats.n_counters; ++i )
+        fprintf(fp, "    \"%s\": %"PRIu64"%s\n", stats.keys[i], stats.values[i], i == stats.n_counters - 1 ? "" : ",");
+    fprintf(fp, "  }\n}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
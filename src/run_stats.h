@@ -0,0 +1,46 @@
+// run_stats.h - timers and counters of a run, exported in JSON by generate_oligos -stats.
+//
+// The main thread is in one stage at any time. Switching the stage only reads the time stamp counter (rdtsc on x86, the
+// monotonic clock elsewhere), so switches around each region or batch are cheap enough to be always on. CPU time of the
+// main thread is read at the boundaries of phases, and split to the stages switched in the phase in proportion to their
+// ticks, except the ticks blocked on workers. Worker threads add the CPU time of their jobs to the stage of the job.
+// Built with ALLOC_STATS (make test), heap allocations of each stage are counted and reported too.
+
+#ifndef RUN_STATS_HEADER
+#define RUN_STATS_HEADER
+#include <stdint.h>
+
+enum run_stage {
+    STAGE_SETUP,
+    STAGE_BED_PARSE,
+    // merge, round and flank of target regions
+    STAGE_MERGE,
+    // join with the designability database
+    STAGE_DB_JOIN,
+    STAGE_FETCH,
+    STAGE_SCORE,
+    STAGE_FORMAT,
+    STAGE_COMPRESS,
+    STAGE_SUMMARY,
+    RUN_STAGES
+};
+
+// start the clock in the setup stage, called by the main thread
+extern void run_stats_start(void);
+// close the current phase and start a new one in stage
+extern void run_stats_phase(int stage);
+// switch the main thread to stage in the same phase, return the previous stage
+extern int run_stats_switch(int stage);
+// the main thread starts (waiting = 1) or stops blocking on workers, the time is in the wall time of the stage but
+// not in the split of CPU time
+extern void run_stats_wait(int waiting);
+// CPU time of the calling thread in seconds
+extern double run_stats_thread_cpu(void);
+// add CPU time of a worker thread to stage, thread safe
+extern void run_stats_add_cpu(int stage, double sec);
+// set a counter, counters are reported in the order of first set
+extern void run_stats_set(const char *key, uint64_t value);
+// close the last phase and write the report, return 0 on success
+extern int run_stats_write(const char *fname, const char *program, const char *version);
+
+#endif
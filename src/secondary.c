@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include "utils.h"
+#include "seq_utils.h"
+#include "secondary.h"
+
+int ss_seq_init(struct ss_seq *s, const char *seq, int len)
+{
+    if ( len > SS_MAX_LENGTH )
+        return -1;
+    memset(s, 0, sizeof(*s));
+    s->l = len;
+    int i;
+    for ( i = 0; i < len; ++i ) {
+        int c = seq_nt4_table[(unsigned char)seq[i]];
+        // ambiguous bases pair with nothing
+        if ( c > 3 )
+            continue;
+        int k = len - 1 - i;
+        uint64_t bi = 1ULL << (i & 63), bk = 1ULL << (k & 63);
+        if ( c & 1 ) {
+            s->f[0][i>>6] |= bi;
+            s->r[0][k>>6] |= bk;
+        }
+        if ( c & 2 ) {
+            s->f[1][i>>6] |= bi;
+            s->r[1][k>>6] |= bk;
+        }
+        s->f[2][i>>6] |= bi;
+        s->r[2][k>>6] |= bk;
+    }
+    return 0;
+}
+
+// shift planes right by one base
+static inline void shift1(uint64_t x[3][SS_WORDS], int n_w)
+{
+    int p, i;
+    for ( p = 0; p < 3; ++p ) {
+        for ( i = 0; i < n_w - 1; ++i )
+            x[p][i] = x[p][i] >> 1 | x[p][i+1] << 63;
+        x[p][n_w-1] >>= 1;
+    }
+}
+
+// return 0 if no pair
+static inline uint64_t pair_mask(const uint64_t a[3][SS_WORDS], const uint64_t b[3][SS_WORDS], uint64_t *m, int n_w)
+{
+    int i;
+    uint64_t any = 0;
+    for ( i = 0; i < n_w; ++i ) {
+        m[i] = (a[0][i] ^ b[0][i]) & (a[1][i] ^ b[1][i]) & a[2][i] & b[2][i];
+        any |= m[i];
+    }
+    return any;
+}
+
+// clear bits above hi
+static inline void mask_above(uint64_t *m, int hi, int n_w)
+{
+    int i;
+    for ( i = 0; i < n_w; ++i ) {
+        int lo = i << 6;
+        if ( lo > hi )
+            m[i] = 0;
+        else if ( hi - lo < 63 )
+            m[i] &= (1ULL << (hi - lo + 1)) - 1;
+    }
+}
+
+// m &= m >> b, 0 < b < 64, return 0 if m is cleared
+static inline uint64_t and_shift(uint64_t *m, int b, int n_w)
+{
+    int i;
+    uint64_t any = 0;
+    for ( i = 0; i < n_w - 1; ++i ) {
+        m[i] &= m[i] >> b | m[i+1] << (64 - b);
+        any |= m[i];
+    }
+    m[n_w-1] &= m[n_w-1] >> b;
+    return any | m[n_w-1];
+}
+
+// length of longest run of set bits if it is longer than min, otherwise 0. Runs of at least min+1 bits are tested with
+// O(log(min)) shifts first, most diagonals stop here.
+static inline int longest_run(uint64_t *m, int min, int n_w)
+{
+    int n = 1, b;
+    for ( b = 1; n < min + 1; b <<= 1 ) {
+        if ( b > min + 1 - n )
+            b = min + 1 - n;
+        if ( b > 63 )
+            b = 63;
+        if ( and_shift(m, b, n_w) == 0 )
+            return 0;
+        n += b;
+    }
+    while ( and_shift(m, 1, n_w) )
+        n++;
+    return n;
+}
+
+int ss_screen(const struct ss_seq *s, int max_hairpin, int max_dimer, int *hairpin, int *dimer)
+{
+    uint64_t x[3][SS_WORDS], m[SS_WORDS], h[SS_WORDS];
+    int n_w = (s->l + 63) >> 6;
+    int pass, t, hp = 0, dm = 0, ret = 0;
+    if ( max_hairpin < 0 )
+        max_hairpin = INT_MAX;
+    if ( max_dimer < 0 )
+        max_dimer = INT_MAX;
+    // offset t = k - i of base i of forward and base k of reversed sequence, the diagonal is d = l-1-t. For t >= 0
+    // the reversed planes are shifted by t, bit i of pair mask for base i; otherwise the forward planes are shifted by
+    // -t, bit k for base i = k-t.
+    for ( pass = 0; pass < 2 && ret == 0; ++pass ) {
+        memcpy(x, pass == 0 ? s->r : s->f, sizeof(x));
+        // diagonal of t = 0 is scanned in the first pass
+        if ( pass == 1 )
+            shift1(x, n_w);
+        for ( t = pass; t < s->l; ++t, shift1(x, n_w) ) {
+            if ( pass == 0 ? pair_mask(s->f, (const uint64_t (*)[SS_WORDS])x, m, n_w) == 0 : pair_mask((const uint64_t (*)[SS_WORDS])x, s->r, m, n_w) == 0 )
+                continue;
+            int tt = pass == 0 ? t : -t;
+            // pairs (i, d-i) with d-2i > SS_MIN_LOOP
+            int d = s->l - 1 - tt;
+            int hi = d - SS_MIN_LOOP - 1 < 0 ? -1 : (d - SS_MIN_LOOP - 1) / 2;
+            if ( pass == 1 )
+                hi += tt;
+            if ( hi >= 0 ) {
+                memcpy(h, m, n_w * sizeof(uint64_t));
+                mask_above(h, hi, n_w);
+                int run = longest_run(h, hp, n_w);
+                if ( run > hp )
+                    hp = run;
+            }
+            int run = longest_run(m, dm, n_w);
+            if ( run > dm )
+                dm = run;
+            if ( hp > max_hairpin || dm > max_dimer ) {
+                ret = 1;
+                break;
+            }
+        }
+    }
+    *hairpin = hp;
+    *dimer = dm;
+    return ret;
+}
+
+#ifdef _MAIN_SECONDARY
+// benchmark of the kernels, checked against a plain dynamic programming implementation
+static int naive_score(const char *seq, int l, int hairpin)
+{
+    int d, i, best = 0;
+    for ( d = 0; d <= 2 * l - 2; ++d ) {
+        int run = 0;
+        for ( i = 0; i < l; ++i ) {
+            int j = d - i;
+            int ok = j >= 0 && j < l && (!hairpin || j - i > SS_MIN_LOOP);
+            int a = seq_nt4_table[(unsigned char)seq[i]];
+            int b = ok ? seq_nt4_table[(unsigned char)seq[j]] : 4;
+            run = a < 4 && b < 4 && a + b == 3 ? run + 1 : 0;
+            if ( run > best )
+                best = run;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int l = argc > 2 ? atoi(argv[2]) : 120;
+    if ( l < 1 || l > SS_MAX_LENGTH )
+        error("Length should be between 1 and %d.", SS_MAX_LENGTH);
+    char *seqs = (char*)malloc((uint64_t)n * l);
+    check_mem(seqs);
+    int i, j;
+    srand(11);
+    for ( i = 0; i < n; ++i )
+        for ( j = 0; j < l; ++j )
+            seqs[(uint64_t)i*l+j] = "ACGT"[rand() & 3];
+    int n_check = n < 10000 ? n : 10000;
+    for ( i = 0; i < n_check; ++i ) {
+        struct ss_seq s;
+        const char *seq = seqs + (uint64_t)i * l;
+        ss_seq_init(&s, seq, l);
+        int hp, dm;
+        ss_screen(&s, -1, -1, &hp, &dm);
+        if ( hp != naive_score(seq, l, 1) || dm != naive_score(seq, l, 0) )
+            error("Inconsistent scores of %.*s.", l, seq);
+    }
+    LOG_print("%d oligos checked.", n_check);
+    uint64_t sum = 0;
+    clock_t t = clock();
+    for ( i = 0; i < n; ++i ) {
+        struct ss_seq s;
+        ss_seq_init(&s, seqs + (uint64_t)i * l, l);
+        int hp, dm;
+        ss_screen(&s, -1, -1, &hp, &dm);
+        sum += hp + dm;
+    }
+    double sec = (double)(clock() - t) / CLOCKS_PER_SEC;
+    LOG_print("%d oligos of %db : %.2f sec, %.1f ns per oligo, checksum %"PRIu64".", n, l, sec, sec * 1e9 / n, sum);
+    free(seqs);
+    return 0;
+}
+#endif
@@ -0,0 +1,32 @@
+// secondary.h - hairpin and self-dimer screening of oligos.
+//
+// An oligo is kept as two bit planes of its 2-bit codes, 64 bases per word, together with the planes of its reversed
+// sequence. Base i pairs with base j if both bits of their codes differ, so all complementary pairs on an antiparallel
+// diagonal i+j=d are found by a few word operations. Sliding the reversed planes by one base steps to the next
+// diagonal. The longest run of pairs on a diagonal is the stem of a self-dimer, or of a hairpin if the pairs are
+// restricted to one side of a loop of at least SS_MIN_LOOP bases. Scores are the length of the longest stem in bases.
+
+#ifndef SECONDARY_HEADER
+#define SECONDARY_HEADER
+#include <stdint.h>
+
+#define SS_MAX_LENGTH 256
+#define SS_WORDS (SS_MAX_LENGTH / 64)
+#define SS_MIN_LOOP 3
+
+struct ss_seq {
+    int l;
+    // code bits and valid (A,C,G,T) mask of forward sequence, bit i for base i
+    uint64_t f[3][SS_WORDS];
+    // same planes of reversed sequence, bit k for base l-1-k
+    uint64_t r[3][SS_WORDS];
+};
+
+// return -1 if seq is longer than SS_MAX_LENGTH
+extern int ss_seq_init(struct ss_seq *s, const char *seq, int len);
+
+// longest stems of hairpin and self-dimer, scanning stops once either one is longer than its limit (negative value
+// for no limit), return 1 in this case
+extern int ss_screen(const struct ss_seq *s, int max_hairpin, int max_dimer, int *hairpin, int *dimer);
+
+#endif
@@ -0,0 +1,44 @@
+// seq_utils.h - nucleotide encoding helpers shared by the index builders and oligo screening.
+//
+
+#ifndef SEQ_UTILS_HEADER
+#define SEQ_UTILS_HEADER
+#include <stdint.h>
+
+// 2-bit code of A,C,G,T (case insensitive), any other char is 4
+extern unsigned char seq_nt4_table[256];
+// same as seq_nt4_table, but soft-masked (lower case) bases are 4
+extern unsigned char seq_nt4_upper_table[256];
+
+// invertible integer hash, used to partition k-mers and to order minimizers
+static inline uint64_t hash64(uint64_t key, uint64_t mask)
+{
+    key = (~key + (key << 21)) & mask;
+    key = key ^ key >> 24;
+    key = ((key + (key << 3)) + (key << 8)) & mask;
+    key = key ^ key >> 14;
+    key = ((key + (key << 2)) + (key << 4)) & mask;
+    key = key ^ key >> 28;
+    key = (key + (key << 31)) & mask;
+    return key;
+}
+
+// reverse complement of a 2-bit packed k-mer
+static inline uint64_t kmer_revcomp(uint64_t x, int k)
+{
+    x = ~x;
+    x = (x & 0x3333333333333333ULL) << 2 | (x >> 2 & 0x3333333333333333ULL);
+    x = (x & 0x0F0F0F0F0F0F0F0FULL) << 4 | (x >> 4 & 0x0F0F0F0F0F0F0F0FULL);
+    x = (x & 0x00FF00FF00FF00FFULL) << 8 | (x >> 8 & 0x00FF00FF00FF00FFULL);
+    x = (x & 0x0000FFFF0000FFFFULL) << 16 | (x >> 16 & 0x0000FFFF0000FFFFULL);
+    x = x << 32 | x >> 32;
+    return x >> (64 - 2 * k);
+}
+
+// MD5 of sequence in upper case, as the M5 tag of SAM header, hex should have 33 bytes
+extern void seq_md5_hex(const char *seq, int len, char *hex);
+
+// parse memory size like 4G, 500M, 1024K or plain bytes, return 0 for malformed string
+extern uint64_t parse_mem_size(const char *s);
+
+#endif
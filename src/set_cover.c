@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include "set_cover.h"
+
+int set_cover_add_target(struct set_cover *sc, int start, int end, int depth)
+{
+    if ( sc->n_targets && start < sc->targets[sc->n_targets-1].end )
+        start = sc->targets[sc->n_targets-1].end;
+    if ( start >= end )
+        return -1;
+    if ( sc->n_targets == sc->m_targets ) {
+        sc->m_targets = sc->m_targets == 0 ? 64 : sc->m_targets << 1;
+        sc->targets = (struct cover_target*)realloc(sc->targets, sc->m_targets * sizeof(struct cover_target));
+    }
+    int length = end - start;
+    if ( sc->l_residual + length > sc->m_residual ) {
+        sc->m_residual = sc->l_residual + length;
+        sc->m_residual += sc->m_residual >> 1;
+        sc->residual = (uint8_t*)realloc(sc->residual, sc->m_residual);
+    }
+    struct cover_target *t = &sc->targets[sc->n_targets];
+    t->start = start;
+    t->end = end;
+    t->offset = sc->l_residual;
+    memset(sc->residual + sc->l_residual, depth < 1 ? 1 : depth > 255 ? 255 : depth, length);
+    sc->l_residual += length;
+    return sc->n_targets++;
+}
+
+int set_cover_add_candidate(struct set_cover *sc, int start, int end)
+{
+    if ( sc->n_cands == sc->m_cands ) {
+        sc->m_cands = sc->m_cands == 0 ? 1024 : sc->m_cands << 1;
+        sc->cands = (struct cover_candidate*)realloc(sc->cands, sc->m_cands * sizeof(struct cover_candidate));
+    }
+    struct cover_candidate *c = &sc->cands[sc->n_cands];
+    c->start = start;
+    c->end = end;
+    c->gain = 0;
+    c->next = -1;
+    c->selected = 0;
+    return sc->n_cands++;
+}
+
+// first target ending after pos
+static int first_target(const struct set_cover *sc, int pos)
+{
+    int lo = 0, hi = sc->n_targets;
+    while ( lo < hi ) {
+        int mid = (lo + hi) >> 1;
+        if ( sc->targets[mid].end <= pos )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// number of target bases covered by candidate, with residual demand only if residual is set
+static int cover_gain(const struct set_cover *sc, const struct cover_candidate *c, int residual)
+{
+    int i, t, gain = 0;
+    for ( t = first_target(sc, c->start); t < sc->n_targets && sc->targets[t].start < c->end; ++t ) {
+        const struct cover_target *target = &sc->targets[t];
+        int beg = c->start > target->start ? c->start : target->start;
+        int end = c->end < target->end ? c->end : target->end;
+        if ( residual == 0 ) {
+            gain += end - beg;
+            continue;
+        }
+        const uint8_t *r = sc->residual + target->offset - target->start;
+        for ( i = beg; i < end; ++i )
+            gain += r[i] > 0;
+    }
+    return gain;
+}
+
+static void cover_apply(struct set_cover *sc, const struct cover_candidate *c)
+{
+    int i, t;
+    for ( t = first_target(sc, c->start); t < sc->n_targets && sc->targets[t].start < c->end; ++t ) {
+        const struct cover_target *target = &sc->targets[t];
+        int beg = c->start > target->start ? c->start : target->start;
+        int end = c->end < target->end ? c->end : target->end;
+        uint8_t *r = sc->residual + target->offset - target->start;
+        for ( i = beg; i < end; ++i )
+            if ( r[i] )
+                r[i]--;
+    }
+}
+
+int set_cover_select(struct set_cover *sc)
+{
+    int i, top = 0;
+    sc->n_selected = 0;
+    // all residual demand is full at the beginning, so initial gains are the number of target bases
+    for ( i = 0; i < sc->n_cands; ++i ) {
+        struct cover_candidate *c = &sc->cands[i];
+        c->gain = cover_gain(sc, c, 0);
+        if ( c->gain > top )
+            top = c->gain;
+    }
+    if ( top + 1 > sc->m_buckets ) {
+        sc->m_buckets = top + 1;
+        sc->buckets = (int*)realloc(sc->buckets, sc->m_buckets * sizeof(int));
+    }
+    for ( i = 0; i <= top; ++i )
+        sc->buckets[i] = -1;
+    // push in reverse order, so candidates of the same gain are popped from left to right
+    for ( i = sc->n_cands - 1; i >= 0; --i ) {
+        struct cover_candidate *c = &sc->cands[i];
+        if ( c->gain == 0 )
+            continue;
+        c->next = sc->buckets[c->gain];
+        sc->buckets[c->gain] = i;
+    }
+    while ( top > 0 ) {
+        i = sc->buckets[top];
+        if ( i == -1 ) {
+            top--;
+            continue;
+        }
+        struct cover_candidate *c = &sc->cands[i];
+        sc->buckets[top] = c->next;
+        c->gain = cover_gain(sc, c, 1);
+        // gain decreased, move it to its new bucket
+        if ( c->gain < top ) {
+            if ( c->gain > 0 ) {
+                c->next = sc->buckets[c->gain];
+                sc->buckets[c->gain] = i;
+            }
+            continue;
+        }
+        c->selected = 1;
+        sc->n_selected++;
+        cover_apply(sc, c);
+    }
+    sc->uncovered = 0;
+    for ( i = 0; i < sc->l_residual; ++i )
+        sc->uncovered += sc->residual[i];
+    return sc->n_selected;
+}
+
+void set_cover_clear(struct set_cover *sc)
+{
+    sc->n_targets = 0;
+    sc->n_cands = 0;
+    sc->l_residual = 0;
+    sc->n_selected = 0;
+    sc->uncovered = 0;
+}
+
+void set_cover_destroy(struct set_cover *sc)
+{
+    free(sc->targets);
+    free(sc->cands);
+    free(sc->residual);
+    free(sc->buckets);
+    memset(sc, 0, sizeof(*sc));
+}
@@ -0,0 +1,54 @@
+// set_cover.h - select a small set of candidates covering every target base at required multiplicity.
+//
+// Each candidate covers a range of bases. The greedy algorithm of Johnson (1974) picks the candidate covering the most
+// bases with residual demand in turn, which is within a factor of ln(longest range) of the optimum. Gains only decrease,
+// so candidates are kept in a bucket queue indexed by gain and their gains are updated lazily when popped.
+
+#ifndef SET_COVER_HEADER
+#define SET_COVER_HEADER
+#include <stdint.h>
+
+struct cover_target {
+    int start;
+    int end;
+    // offset of residual demand of the first base
+    int offset;
+};
+
+struct cover_candidate {
+    int start;
+    int end;
+    int gain;
+    // next candidate in the same bucket
+    int next;
+    int selected;
+};
+
+struct set_cover {
+    int n_targets, m_targets;
+    struct cover_target *targets;
+    int n_cands, m_cands;
+    struct cover_candidate *cands;
+    // residual demand of target bases, capped at 255
+    int l_residual, m_residual;
+    uint8_t *residual;
+    int m_buckets;
+    int *buckets;
+    int n_selected;
+    // sum of residual demand after selection
+    int64_t uncovered;
+};
+
+#define SET_COVER_INIT { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+// targets should be added in order, overlapped part of a target is trimmed. each base of target should be covered by
+// depth candidates. return index of target, -1 if empty
+extern int set_cover_add_target(struct set_cover *sc, int start, int end, int depth);
+extern int set_cover_add_candidate(struct set_cover *sc, int start, int end);
+// select candidates and mark them, return the number of selected candidates
+extern int set_cover_select(struct set_cover *sc);
+// remove all targets and candidates, memory is kept for next round
+extern void set_cover_clear(struct set_cover *sc);
+extern void set_cover_destroy(struct set_cover *sc);
+
+#endif
@@ -0,0 +1,591 @@
+// synth_corpus.c - synthesize a deterministic corpus for benchmarks : reference genome, target panels and the
+// designability database.
+//
+// Each contig is a walk of segments : unique sequence with varied GC content, copies of repeat families which are
+// soft-masked (truncated and diverged copies of interspersed families, or short tandem repeats), and N gaps (the
+// telomeres of chromosomes and the gaps between scaffolded pieces). Target panels are shaped like the real ones : exons
+// of genes for an exome panel, small sites in exons for a hotspot panel, and all the sequences between gaps for a
+// whole-genome panel. Unique segments are exported as the designability database, in the format of build_uniq_db.
+// The same options always give the same files, byte by byte.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "number.h"
+#include "seq_utils.h"
+#include "htslib/kstring.h"
+#include "htslib/faidx.h"
+#include "htslib/bgzf.h"
+#include "htslib/tbx.h"
+
+#define KSTRING_INIT { 0, 0, 0 }
+
+// mean lengths of segments
+#define UNIQUE_MEAN 2000
+#define REPEAT_MEAN 600
+#define GAP_MEAN 20000
+#define TELOMERE_LENGTH 10000
+#define N_FAMILIES 24
+// families of short tandem repeats, the others are interspersed
+#define N_TANDEM 4
+// bases of chromosomes, the rest are scaffolds
+#define CHROM_SHARE 0.95
+#define MIN_CONTIG_LENGTH 1000
+// genes and exons, like the human genome
+#define GENE_SPACING 150000
+#define EXON_MEAN 9
+#define EXON_LENGTH 170
+#define INTRON_LENGTH 3000
+// ratio of exons with hotspots
+#define HOTSPOT_RATE 0.05
+
+enum { SEG_UNIQUE, SEG_REPEAT, SEG_GAP };
+
+struct segment {
+    int start;
+    int end;
+    int type;
+};
+
+struct family {
+    char *seq;
+    int length;
+    // ratio of mutated bases in copies
+    double divergence;
+};
+
+struct args {
+    const char *output_dir;
+    uint64_t size;
+    int n_chroms;
+    int n_scaffolds;
+    double repeat_ratio;
+    double gap_ratio;
+    uint64_t seed;
+    // states of random numbers, sequences and genes use different streams
+    uint64_t seq_rand;
+    uint64_t gene_rand;
+    // probabilities of the next segment is a gap or a repeat
+    double p_gap;
+    double p_repeat;
+    struct family families[N_FAMILIES];
+    // segments of current contig
+    int n_segs;
+    int m_segs;
+    struct segment *segs;
+    kstring_t seq;
+    FILE *fasta;
+    FILE *exome;
+    FILE *hotspot;
+    FILE *wgs;
+    BGZF *db;
+    kstring_t db_str;
+    uint64_t bases[3];
+    uint64_t n_regions[4];
+    uint64_t region_bases[4];
+} args = {
+    .output_dir = 0,
+    .size = 20<<20,
+    .n_chroms = 8,
+    .n_scaffolds = 16,
+    .repeat_ratio = 0.45,
+    .gap_ratio = 0.02,
+    .seed = 11,
+    .seq_rand = 0,
+    .gene_rand = 0,
+    .p_gap = 0,
+    .p_repeat = 0,
+    .n_segs = 0,
+    .m_segs = 0,
+    .segs = 0,
+    .seq = KSTRING_INIT,
+    .fasta = 0,
+    .exome = 0,
+    .hotspot = 0,
+    .wgs = 0,
+    .db = 0,
+    .db_str = KSTRING_INIT,
+};
+
+// panels in n_regions and region_bases
+enum { PANEL_EXOME, PANEL_HOTSPOT, PANEL_WGS, PANEL_DB };
+
+static int quiet_mode = 0;
+
+int usage()
+{
+    fprintf(stderr,
+	    "synth_corpus - synthesize a deterministic reference genome, target panels and designability database for benchmarks.\n"
+	    "Usage: \n"
+	    "synth_corpus -o corpus -size 100M\n"
+	    "Options:\n"
+	    "  -o [directory]\n"
+	    "            output directory of ref.fa, exome.bed, hotspot.bed, wgs.bed and db.bed.gz.\n"
+	    "  -size [20M]\n"
+	    "            bases of the reference genome, K, M and G are accepted.\n"
+	    "  -chroms [8]\n"
+	    "            number of chromosomes, which have telomeres and most of the bases.\n"
+	    "  -scaffolds [16]\n"
+	    "            number of unplaced scaffolds.\n"
+	    "  -repeat [0.45]\n"
+	    "            ratio of soft-masked repeats.\n"
+	    "  -gap [0.02]\n"
+	    "            ratio of N gaps, telomeres excluded.\n"
+	    "  -seed [11]\n"
+	    "            seed of random numbers.\n"
+	    "  -quiet\n"
+	    "            quiet mode.\n"
+	    "  -h, -help\n"
+	    "            for help information.\n"
+	    "Homepage: https://github.com/shiquan/titling_array_designer\n"
+	);
+    return 1;
+}
+
+int parse_args(int argc, char **argv)
+{
+    int i;
+    const char *size = 0;
+    const char *chroms = 0;
+    const char *scaffolds = 0;
+    const char *repeat = 0;
+    const char *gap = 0;
+    const char *seed = 0;
+    for (i = 0; i < argc; ) {
+	const char *a = argv[i++];
+	if ( strcmp(a, "-h") == 0 || strcmp(a, "-help") == 0 )
+	    return usage();
+	if ( strcmp(a, "-quiet") == 0 ) {
+	    quiet_mode = 1;
+	    continue;
+	}
+	const char **var = 0;
+	if ( strcmp(a, "-o") == 0 && args.output_dir == 0 )
+	    var = &args.output_dir;
+	else if ( strcmp(a, "-size") == 0 && size == 0 )
+	    var = &size;
+	else if ( strcmp(a, "-chroms") == 0 && chroms == 0 )
+	    var = &chroms;
+	else if ( strcmp(a, "-scaffolds") == 0 && scaffolds == 0 )
+	    var = &scaffolds;
+	else if ( strcmp(a, "-repeat") == 0 && repeat == 0 )
+	    var = &repeat;
+	else if ( strcmp(a, "-gap") == 0 && gap == 0 )
+	    var = &gap;
+	else if ( strcmp(a, "-seed") == 0 && seed == 0 )
+	    var = &seed;
+
+	if ( var != 0 ) {
+	    if (i == argc) {
+		error_print("Miss an argument after %s.", a);
+		return -2;
+	    }
+	    *var = argv[i++];
+	    continue;
+	}
+	error_print("Unknown parameter : %s. Use -h to for more help.", a);
+	return 1;
+    }
+    if ( args.output_dir == 0 )
+	error("Required an output directory. Use -o to specify.");
+    if ( size ) {
+	args.size = parse_mem_size(size);
+	if ( args.size == 0 )
+	    error("Bad size : %s.", size);
+    }
+    if ( chroms ) {
+	args.n_chroms = str2int((char*)chroms);
+	if ( args.n_chroms < 0 ) args.n_chroms = 0;
+    }
+    if ( scaffolds ) {
+	args.n_scaffolds = str2int((char*)scaffolds);
+	if ( args.n_scaffolds < 0 ) args.n_scaffolds = 0;
+    }
+    if ( args.n_chroms + args.n_scaffolds == 0 )
+	error("No contig to synthesize.");
+    if ( repeat )
+	args.repeat_ratio = atof(repeat);
+    if ( gap )
+	args.gap_ratio = atof(gap);
+    if ( args.repeat_ratio < 0 || args.gap_ratio < 0 || args.repeat_ratio + args.gap_ratio >= 0.95 )
+	error("Bad ratios of repeats and gaps : %g, %g.", args.repeat_ratio, args.gap_ratio);
+    if ( seed )
+	args.seed = strtoull(seed, NULL, 10);
+    if ( args.size / (args.n_chroms + args.n_scaffolds) > INT32_MAX - TELOMERE_LENGTH )
+	error("Contigs are too long, use more -chroms or -scaffolds.");
+
+    struct stat s;
+    if ( stat(args.output_dir, &s) == -1 && mkdir(args.output_dir, 0755) )
+	error("Failed to create directory %s : %s.", args.output_dir, strerror(errno));
+
+    args.seq_rand = args.seed;
+    args.gene_rand = args.seed ^ 0x5851f42d4c957f2dULL;
+    return 0;
+}
+
+// splitmix64, the same on every platform
+static uint64_t next_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double rand_unit(uint64_t *state)
+{
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// exponential length of the mean, in [min, max]
+static int rand_length(uint64_t *state, int mean, int min, int max)
+{
+    double x = -log(1 - rand_unit(state)) * mean;
+    if ( x < min )
+	return min;
+    if ( x > max )
+	return max;
+    return (int)x;
+}
+
+static void random_bases(uint64_t *state, char *s, int l, double gc)
+{
+    uint32_t t = (uint32_t)(gc * 4294967295.0);
+    int i;
+    for ( i = 0; i < l; ++i ) {
+	uint64_t r = next_rand(state);
+	s[i] = (uint32_t)(r >> 32) < t ? "GC"[r & 1] : "AT"[r & 1];
+    }
+}
+
+static void init_families()
+{
+    uint64_t *st = &args.seq_rand;
+    double mean_repeat = 0;
+    int i, j;
+    for ( i = 0; i < N_FAMILIES; ++i ) {
+	struct family *f = &args.families[i];
+	if ( i < N_TANDEM ) {
+	    // unit of tandem repeats, copies are up to hundreds of bases
+	    f->length = 1 + i + (int)(next_rand(st) % 3);
+	    f->divergence = 0.01;
+	}
+	else {
+	    // short families like Alu, long families like L1
+	    f->length = rand_unit(st) < 0.5 ? 250 + (int)(next_rand(st) % 100) : 1000 + (int)(next_rand(st) % 5000);
+	    f->divergence = 0.02 + rand_unit(st) * 0.2;
+	}
+	f->seq = (char*)malloc(f->length + 1);
+	random_bases(st, f->seq, f->length, 0.45);
+	// poly-A tails of retrotransposons
+	for ( j = f->length - f->length / 20; i >= N_TANDEM && j < f->length; ++j )
+	    f->seq[j] = 'A';
+	f->seq[f->length] = '\0';
+	// copies of interspersed repeats are not longer than the family
+	mean_repeat += i < N_TANDEM ? REPEAT_MEAN : REPEAT_MEAN * (1 - exp(-(double)f->length / REPEAT_MEAN));
+    }
+    mean_repeat /= N_FAMILIES;
+    // the next segment is picked in proportion to the ratio of bases over the mean length
+    double w_gap = args.gap_ratio / GAP_MEAN;
+    double w_repeat = args.repeat_ratio / mean_repeat;
+    double w_unique = (1 - args.gap_ratio - args.repeat_ratio) / UNIQUE_MEAN;
+    args.p_gap = w_gap / (w_gap + w_repeat + w_unique);
+    args.p_repeat = w_repeat / (w_gap + w_repeat + w_unique);
+}
+
+static char *reserve_seq(int l)
+{
+    ks_resize(&args.seq, args.seq.l + l + 1);
+    char *s = args.seq.s + args.seq.l;
+    args.seq.l += l;
+    return s;
+}
+
+// copy of a random family, return the length of the copy
+static int repeat_copy(int l)
+{
+    uint64_t *st = &args.seq_rand;
+    struct family *f = &args.families[next_rand(st) % N_FAMILIES];
+    int i;
+    if ( f->length >= 10 && l > f->length )
+	l = f->length;
+    char *s = reserve_seq(l);
+    if ( f->length < 10 ) {
+	int offset = next_rand(st) % f->length;
+	for ( i = 0; i < l; ++i )
+	    s[i] = f->seq[(offset + i) % f->length];
+    }
+    else {
+	// truncated at 5' end mostly
+	int offset = f->length - l - (int)(next_rand(st) % (f->length - l + 1) / 4);
+	memcpy(s, f->seq + offset, l);
+	if ( next_rand(st) & 1 ) {
+	    for ( i = 0; i < l / 2; ++i ) {
+		char c = s[i];
+		s[i] = s[l - 1 - i];
+		s[l - 1 - i] = c;
+	    }
+	    for ( i = 0; i < l; ++i )
+		s[i] = s[i] == 'A' ? 'T' : s[i] == 'C' ? 'G' : s[i] == 'G' ? 'C' : 'A';
+	}
+    }
+    uint32_t t = (uint32_t)(f->divergence * 4294967295.0);
+    for ( i = 0; i < l; ++i ) {
+	uint64_t r = next_rand(st);
+	if ( (uint32_t)(r >> 32) < t )
+	    s[i] = "ACGT"[r & 3];
+	s[i] = tolower(s[i]);
+    }
+    return l;
+}
+
+static void push_segment(int start, int end, int type)
+{
+    if ( args.n_segs && args.segs[args.n_segs-1].type == type && args.segs[args.n_segs-1].end == start ) {
+	args.segs[args.n_segs-1].end = end;
+	return;
+    }
+    if ( args.n_segs == args.m_segs ) {
+	args.m_segs = args.m_segs ? args.m_segs * 2 : 1024;
+	args.segs = (struct segment*)realloc(args.segs, args.m_segs * sizeof(struct segment));
+    }
+    args.segs[args.n_segs].start = start;
+    args.segs[args.n_segs].end = end;
+    args.segs[args.n_segs].type = type;
+    args.n_segs++;
+}
+
+static void add_segment(int l, int type)
+{
+    int start = args.seq.l;
+    if ( type == SEG_GAP )
+	memset(reserve_seq(l), 'N', l);
+    else if ( type == SEG_REPEAT )
+	l = repeat_copy(l);
+    else
+	random_bases(&args.seq_rand, reserve_seq(l), l, 0.35 + rand_unit(&args.seq_rand) * 0.2);
+    push_segment(start, args.seq.l, type);
+    args.bases[type] += l;
+}
+
+static void build_contig(int length, int is_chrom)
+{
+    uint64_t *st = &args.seq_rand;
+    int telomere = is_chrom ? (length / 50 < TELOMERE_LENGTH ? length / 50 : TELOMERE_LENGTH) : 0;
+    int end = length - telomere;
+    args.seq.l = 0;
+    args.n_segs = 0;
+    if ( telomere )
+	add_segment(telomere, SEG_GAP);
+    while ( args.seq.l < end ) {
+	int left = end - args.seq.l;
+	double r = rand_unit(st);
+	int type, l;
+	if ( r < args.p_gap ) {
+	    type = SEG_GAP;
+	    l = rand_length(st, GAP_MEAN, 100, 100000);
+	}
+	else if ( r < args.p_gap + args.p_repeat ) {
+	    type = SEG_REPEAT;
+	    l = rand_length(st, REPEAT_MEAN, 20, 6000);
+	}
+	else {
+	    type = SEG_UNIQUE;
+	    l = rand_length(st, UNIQUE_MEAN, 50, 50000);
+	}
+	// scaffolds do not start or end with gaps
+	if ( type == SEG_GAP && (args.seq.l == telomere || l >= left) )
+	    type = SEG_UNIQUE;
+	add_segment(l < left ? l : left, type);
+    }
+    if ( telomere )
+	add_segment(telomere, SEG_GAP);
+}
+
+static void write_fasta(const char *name)
+{
+    int i;
+    fprintf(args.fasta, ">%s\n", name);
+    for ( i = 0; i < args.seq.l; i += 60 ) {
+	int l = args.seq.l - i < 60 ? args.seq.l - i : 60;
+	fwrite(args.seq.s + i, 1, l, args.fasta);
+	fputc('\n', args.fasta);
+    }
+}
+
+static void write_region(FILE *fp, int panel, const char *name, int start, int end, const char *label)
+{
+    if ( label )
+	fprintf(fp, "%s\t%d\t%d\t%s\n", name, start, end, label);
+    else
+	fprintf(fp, "%s\t%d\t%d\n", name, start, end);
+    args.n_regions[panel]++;
+    args.region_bases[panel] += end - start;
+}
+
+// check gaps in [start, end), the segment index k moves forward with queries
+static int overlap_gap(int *k, int start, int end)
+{
+    while ( *k < args.n_segs && args.segs[*k].end <= start )
+	(*k)++;
+    int i;
+    for ( i = *k; i < args.n_segs && args.segs[i].start < end; ++i )
+	if ( args.segs[i].type == SEG_GAP )
+	    return 1;
+    return 0;
+}
+
+static void write_panels(const char *name, int *gene_id)
+{
+    uint64_t *st = &args.gene_rand;
+    int i, k = 0;
+    int pos = rand_length(st, GENE_SPACING / 2, 0, INT32_MAX);
+    char label[64];
+    while ( pos < args.seq.l ) {
+	int n_exons = rand_length(st, EXON_MEAN, 1, 60);
+	++*gene_id;
+	for ( i = 0; i < n_exons && pos < args.seq.l; ++i ) {
+	    int l = rand_length(st, EXON_LENGTH, 50, 3000);
+	    int end = pos + l < args.seq.l ? pos + l : args.seq.l;
+	    if ( overlap_gap(&k, pos, end) == 0 ) {
+		snprintf(label, sizeof(label), "G%d_%d", *gene_id, i + 1);
+		write_region(args.exome, PANEL_EXOME, name, pos, end, label);
+		if ( rand_unit(st) < HOTSPOT_RATE ) {
+		    // mostly single base sites, some short indels
+		    int w = rand_unit(st) < 0.7 ? 1 : 2 + (int)(next_rand(st) % 29);
+		    int s = pos + (int)(next_rand(st) % (end - pos));
+		    write_region(args.hotspot, PANEL_HOTSPOT, name, s, s + w < end ? s + w : end, label);
+		}
+	    }
+	    pos = end + rand_length(st, INTRON_LENGTH, 80, 100000);
+	}
+	pos += rand_length(st, GENE_SPACING, 1000, INT32_MAX - pos);
+    }
+    for ( i = 0; i < args.n_segs; ) {
+	if ( args.segs[i].type == SEG_GAP ) {
+	    ++i;
+	    continue;
+	}
+	int start = args.segs[i].start;
+	while ( i < args.n_segs && args.segs[i].type != SEG_GAP )
+	    ++i;
+	write_region(args.wgs, PANEL_WGS, name, start, args.segs[i-1].end, NULL);
+    }
+    for ( i = 0; i < args.n_segs; ++i ) {
+	if ( args.segs[i].type != SEG_UNIQUE )
+	    continue;
+	ksprintf(&args.db_str, "%s\t%d\t%d\n", name, args.segs[i].start, args.segs[i].end);
+	args.n_regions[PANEL_DB]++;
+	args.region_bases[PANEL_DB] += args.segs[i].end - args.segs[i].start;
+	if ( args.db_str.l > 1<<16 ) {
+	    if ( bgzf_write(args.db, args.db_str.s, args.db_str.l) != args.db_str.l )
+		error("Write error : %d.", args.db->errcode);
+	    args.db_str.l = 0;
+	}
+    }
+}
+
+static FILE *open_file(const char *name, kstring_t *path)
+{
+    path->l = 0;
+    ksprintf(path, "%s/%s", args.output_dir, name);
+    FILE *fp = fopen(path->s, "w");
+    if ( fp == NULL )
+	error("Failed to write %s : %s.", path->s, strerror(errno));
+    return fp;
+}
+
+static void synth_corpus()
+{
+    kstring_t path = KSTRING_INIT;
+    kstring_t name = KSTRING_INIT;
+    int i, gene_id = 0;
+    int n = args.n_chroms + args.n_scaffolds;
+    uint64_t chrom_bases = args.n_scaffolds ? args.size * CHROM_SHARE : args.size;
+    if ( args.n_chroms == 0 )
+	chrom_bases = 0;
+    double sum_chroms = 0, sum_scaffolds = 0;
+    // chromosomes get shorter linearly to half of the first, scaffolds by 1/i
+    for ( i = 0; i < args.n_chroms; ++i )
+	sum_chroms += 2 * args.n_chroms - i;
+    for ( i = 0; i < args.n_scaffolds; ++i )
+	sum_scaffolds += 1.0 / (i + 1);
+
+    init_families();
+    args.exome = open_file("exome.bed", &path);
+    args.hotspot = open_file("hotspot.bed", &path);
+    args.wgs = open_file("wgs.bed", &path);
+    path.l = 0;
+    ksprintf(&path, "%s/db.bed.gz", args.output_dir);
+    args.db = bgzf_open(path.s, "w");
+    if ( args.db == NULL )
+	error("Failed to write %s : %s.", path.s, strerror(errno));
+    args.fasta = open_file("ref.fa", &path);
+
+    for ( i = 0; i < n; ++i ) {
+	int is_chrom = i < args.n_chroms;
+	double length = is_chrom ? chrom_bases * (2 * args.n_chroms - i) / sum_chroms :
+	    (args.size - chrom_bases) / (i - args.n_chroms + 1) / sum_scaffolds;
+	name.l = 0;
+	if ( is_chrom )
+	    ksprintf(&name, "chr%d", i + 1);
+	else
+	    ksprintf(&name, "scaffold_%d", i - args.n_chroms + 1);
+	build_contig(length < MIN_CONTIG_LENGTH ? MIN_CONTIG_LENGTH : (int)length, is_chrom);
+	write_fasta(name.s);
+	write_panels(name.s, &gene_id);
+    }
+    if ( fclose(args.fasta) != 0 )
+	error("Failed to write %s : %s.", path.s, strerror(errno));
+    if ( fai_build(path.s) != 0 )
+	error("Failed to build index of %s.", path.s);
+    fclose(args.exome);
+    fclose(args.hotspot);
+    fclose(args.wgs);
+    if ( args.db_str.l && bgzf_write(args.db, args.db_str.s, args.db_str.l) != args.db_str.l )
+	error("Write error : %d.", args.db->errcode);
+    if ( bgzf_close(args.db) != 0 )
+	error("Failed to close database.");
+    path.l = 0;
+    ksprintf(&path, "%s/db.bed.gz", args.output_dir);
+    if ( tbx_index_build(path.s, 0, &tbx_conf_bed) )
+	error("Failed to build index of %s.", path.s);
+    free(path.s);
+    free(name.s);
+}
+
+static void clean_memory()
+{
+    int i;
+    for ( i = 0; i < N_FAMILIES; ++i )
+	free(args.families[i].seq);
+    free(args.segs);
+    free(args.seq.s);
+    free(args.db_str.s);
+}
+
+int main(int argc, char **argv)
+{
+    if ( argc == 1 )
+	return usage();
+    if ( parse_args(--argc, ++argv) )
+	return 1;
+    synth_corpus();
+    if ( quiet_mode == 0 ) {
+	uint64_t total = args.bases[SEG_UNIQUE] + args.bases[SEG_REPEAT] + args.bases[SEG_GAP];
+	static const char *panels[4] = { "exome.bed", "hotspot.bed", "wgs.bed", "db.bed.gz" };
+	int i;
+	LOG_print("%d contigs, %"PRIu64" bases, %.1f%% soft-masked, %.1f%% N.", args.n_chroms + args.n_scaffolds, total,
+		  100.0 * args.bases[SEG_REPEAT] / total, 100.0 * args.bases[SEG_GAP] / total);
+	for ( i = 0; i < 4; ++i )
+	    LOG_print("%s : %"PRIu64" regions, %"PRIu64" bases.", panels[i], args.n_regions[i], args.region_bases[i]);
+    }
+    clean_memory();
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <math.h>
+#include "utils.h"
+#include "seq_utils.h"
+#include "thermo.h"
+
+// unified nearest-neighbor parameters, indexed by the 2-bit codes of 5'->3' dinucleotide, in 0.1 kcal/mol and
+// 0.1 cal/K/mol
+static const int16_t nn_dh[4][4] = {
+    //  A     C     G     T
+    {  -79,  -84,  -78,  -72 }, // A
+    {  -85,  -80, -106,  -78 }, // C
+    {  -82,  -98,  -80,  -84 }, // G
+    {  -72,  -82,  -85,  -79 }, // T
+};
+static const int16_t nn_ds[4][4] = {
+    { -222, -224, -210, -204 },
+    { -227, -199, -272, -210 },
+    { -222, -244, -199, -224 },
+    { -213, -222, -227, -222 },
+};
+// initiation with terminal G.C or A.T pair, per end
+static const int16_t init_dh[5] = { 23, 1, 1, 23, 0 };
+static const int16_t init_ds[5] = { 41, -28, -28, 41, 0 };
+
+#define GAS_CONSTANT 1.9872
+
+void thermo_opts_init(struct thermo_opts *opts, double na, double mg, double oligo_conc)
+{
+    opts->na = na;
+    opts->mg = mg;
+    opts->oligo_conc = oligo_conc;
+    // Mg2+ is converted to equivalent Na+ (von Ahsen et al. 2001)
+    double salt = (na + 120 * sqrt(mg)) / 1000;
+    if ( salt <= 0 )
+        error("Salt concentration should be positive.");
+    // entropy correction per stack
+    opts->salt_corr = 0.368 * log(salt);
+    // non self-complementary duplex
+    opts->conc_term = GAS_CONSTANT * log(oligo_conc * 1e-9 / 4);
+}
+
+void thermo_profile_build(struct thermo_profile *p, const char *seq, int len)
+{
+    if ( len + 1 > p->m ) {
+        // grown by half, so regions in increasing length do not realloc each time
+        p->m = len + 1;
+        p->m += p->m >> 1;
+        p->c = (uint8_t*)realloc(p->c, p->m);
+        p->h = (int32_t*)realloc(p->h, p->m * sizeof(int32_t));
+        p->s = (int32_t*)realloc(p->s, p->m * sizeof(int32_t));
+        p->g = (int32_t*)realloc(p->g, p->m * sizeof(int32_t));
+    }
+    p->l = len;
+    int i;
+    for ( i = 0; i < len; ++i )
+        p->c[i] = seq_nt4_table[(unsigned char)seq[i]];
+    p->h[0] = p->s[0] = p->g[0] = 0;
+    for ( i = 0; i < len; ++i )
+        p->g[i+1] = p->g[i] + (p->c[i] == 1 || p->c[i] == 2);
+    for ( i = 1; i < len; ++i ) {
+        int a = p->c[i-1], b = p->c[i];
+        // stacks with ambiguous bases are ignored, these oligos are discarded before export
+        if ( a < 4 && b < 4 ) {
+            p->h[i] = p->h[i-1] + nn_dh[a][b];
+            p->s[i] = p->s[i-1] + nn_ds[a][b];
+        } else {
+            p->h[i] = p->h[i-1];
+            p->s[i] = p->s[i-1];
+        }
+    }
+}
+
+void thermo_profile_destroy(struct thermo_profile *p)
+{
+    free(p->c);
+    free(p->h);
+    free(p->s);
+    free(p->g);
+    p->l = p->m = 0;
+    p->c = 0;
+    p->h = p->s = p->g = 0;
+}
+
+static inline float thermo_calc(int32_t dh, int32_t ds, int len, const struct thermo_opts *opts, float *dg)
+{
+    double h = dh * 0.1;
+    double s = ds * 0.1 + opts->salt_corr * (len - 1);
+    if ( dg )
+        *dg = h - 310.15 * s / 1000;
+    return 1000 * h / (s + opts->conc_term) - 273.15;
+}
+
+float thermo_window(const struct thermo_profile *p, const struct thermo_opts *opts, int beg, int len, float *dg)
+{
+    int end = beg + len - 1;
+    int32_t dh = p->h[end] - p->h[beg] + init_dh[p->c[beg]] + init_dh[p->c[end]];
+    int32_t ds = p->s[end] - p->s[beg] + init_ds[p->c[beg]] + init_ds[p->c[end]];
+    return thermo_calc(dh, ds, len, opts, dg);
+}
+
+float thermo_tm(const char *seq, int len, const struct thermo_opts *opts, float *dg)
+{
+    int i;
+    int a = seq_nt4_table[(unsigned char)seq[0]], b = a;
+    int32_t dh = init_dh[a], ds = init_ds[a];
+    for ( i = 1; i < len; ++i ) {
+        b = seq_nt4_table[(unsigned char)seq[i]];
+        if ( a < 4 && b < 4 ) {
+            dh += nn_dh[a][b];
+            ds += nn_ds[a][b];
+        }
+        a = b;
+    }
+    dh += init_dh[b];
+    ds += init_ds[b];
+    return thermo_calc(dh, ds, len, opts, dg);
+}
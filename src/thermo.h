@@ -0,0 +1,51 @@
+// thermo.h - melting temperature and free energy of oligos by the unified nearest-neighbor parameters of
+// SantaLucia (PNAS 1998, see reference/tm).
+//
+// A region is converted into a thermo profile once, with prefix sums of nearest-neighbor enthalpy and entropy, so
+// that Tm and dG of any window of the region are computed in O(1). The two blocks of a bubble oligo are concatenated
+// in the profile, the dinucleotide across the junction is counted like any other stack.
+
+#ifndef THERMO_HEADER
+#define THERMO_HEADER
+#include <stdint.h>
+
+struct thermo_opts {
+    // Na+ and Mg2+ concentrations, mM
+    double na;
+    double mg;
+    // total oligo concentration, nM
+    double oligo_conc;
+    // derived by thermo_opts_init()
+    double salt_corr;
+    double conc_term;
+};
+
+struct thermo_profile {
+    int l, m;
+    // 2-bit code of bases, 4 for others
+    uint8_t *c;
+    // prefix sums of stacking enthalpy (0.1 kcal/mol) and entropy (0.1 cal/K/mol), h[i] sums stacks before base i
+    int32_t *h;
+    int32_t *s;
+    // prefix counts of G and C, g[i] counts bases before i
+    int32_t *g;
+};
+
+#define THERMO_PROFILE_INIT { 0, 0, 0, 0, 0, 0 }
+
+extern void thermo_opts_init(struct thermo_opts *opts, double na, double mg, double oligo_conc);
+
+extern void thermo_profile_build(struct thermo_profile *p, const char *seq, int len);
+extern void thermo_profile_destroy(struct thermo_profile *p);
+
+// Tm (Celsius) and dG at 37C (kcal/mol) of window [beg, beg+len) of the profile, dg could be NULL
+extern float thermo_window(const struct thermo_profile *p, const struct thermo_opts *opts, int beg, int len, float *dg);
+// GC ratio of window [beg, beg+len) of the profile
+static inline float thermo_window_gc(const struct thermo_profile *p, int beg, int len)
+{
+    return (float)(p->g[beg+len] - p->g[beg]) / len;
+}
+// Tm and dG of a sequence, O(len)
+extern float thermo_tm(const char *seq, int len, const struct thermo_opts *opts, float *dg);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_STR_SIZE 32
+
+struct trace_event {
+    const struct trace_kind *kind;
+    uint64_t beg;
+    uint64_t end;
+    int32_t v[TRACE_ARGS];
+    char str[TRACE_STR_SIZE];
+};
+
+// ring of one thread, written only by its thread
+struct trace_ring {
+    struct trace_ring *next;
+    int tid;
+    // spans recorded, the last TRACE_RING_SIZE are kept
+    uint64_t n;
+    struct trace_event *a;
+};
+
+int trace_enabled = 0;
+
+static uint64_t trace_start_time = 0;
+static struct trace_ring *rings = NULL;
+static int n_rings = 0;
+static __thread struct trace_ring *thread_ring = NULL;
+
+uint64_t trace_clock(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// new ring of the calling thread, pushed to the list without lock
+static struct trace_ring *ring_register(void)
+{
+    struct trace_ring *r = (struct trace_ring*)calloc(1, sizeof(struct trace_ring));
+    r->a = (struct trace_event*)malloc(TRACE_RING_SIZE * sizeof(struct trace_event));
+    r->tid = __sync_fetch_and_add(&n_rings, 1);
+    do {
+        r->next = rings;
+    } while ( !__sync_bool_compare_and_swap(&rings, r->next, r) );
+    thread_ring = r;
+    return r;
+}
+
+void trace_start(void)
+{
+    trace_start_time = trace_clock();
+    trace_enabled = 1;
+    if ( thread_ring == NULL )
+        ring_register();
+}
+
+void trace_span(const struct trace_kind *kind, uint64_t beg, const char *str, ...)
+{
+    struct trace_ring *r = thread_ring ? thread_ring : ring_register();
+    struct trace_event *e = &r->a[r->n & (TRACE_RING_SIZE - 1)];
+    e->kind = kind;
+    e->beg = beg;
+    e->end = trace_clock();
+    e->str[0] = 0;
+    if ( str && kind->str_key ) {
+        strncpy(e->str, str, TRACE_STR_SIZE - 1);
+        e->str[TRACE_STR_SIZE - 1] = 0;
+    }
+    va_list ap;
+    va_start(ap, str);
+    int i;
+    for ( i = 0; i < TRACE_ARGS && kind->keys[i]; ++i )
+        e->v[i] = va_arg(ap, int);
+    va_end(ap);
+    r->n++;
+}
+
+static void write_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for ( ; *s; ++s ) {
+        if ( *s == '"' || *s == '\\' )
+            fputc('\\', fp);
+        if ( (unsigned char)*s >= 0x20 )
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE *fp, int tid, struct trace_event *e)
+{
+    const struct trace_kind *kind = e->kind;
+    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{",
+            kind->name, kind->cat, (e->beg - trace_start_time) * 1e-3, (e->end - e->beg) * 1e-3, tid);
+    int i, n = 0;
+    if ( kind->str_key ) {
+        fprintf(fp, "\"%s\":", kind->str_key);
+        write_string(fp, e->str);
+        n++;
+    }
+    for ( i = 0; i < TRACE_ARGS && kind->keys[i]; ++i )
+        fprintf(fp, "%s\"%s\":%d", n++ ? "," : "", kind->keys[i], e->v[i]);
+    fputs("}}", fp);
+}
+
+int trace_write(const char *fname, const char *program, const char *version)
+{
+    FILE *fp = fopen(fname, "w");
+    if ( fp == NULL )
+        return -1;
+    // rings are read after the workers are idle
+    __sync_synchronize();
+    fprintf(fp, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"%s\"}}", program);
+    uint64_t dropped = 0;
+    struct trace_ring *r;
+    for ( r = rings; r; r = r->next ) {
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", r->tid);
+        if ( r->tid == 0 )
+            fputs("\"main\"}}", fp);
+        else
+            fprintf(fp, "\"worker %d\"}}", r->tid);
+        uint64_t i = r->n > TRACE_RING_SIZE ? r->n - TRACE_RING_SIZE : 0;
+        dropped += i;
+        for ( ; i < r->n; ++i )
+            write_event(fp, r->tid, &r->a[i & (TRACE_RING_SIZE - 1)]);
+    }
+    fprintf(fp, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"version\":\"%s\",\"dropped_spans\":%llu}}\n", version,
+            (unsigned long long)dropped);
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+// trace.h - timeline of span events of a run, exported in Chrome trace event JSON by generate_oligos -trace.
+//
+// Each thread records its spans to its own ring buffer, registered by a lock-free push at the first span, so recording
+// never takes a lock. A ring keeps the last TRACE_RING_SIZE spans of its thread. Rings are read by trace_write() at
+// the end of the run, when the workers are idle. When tracing is off, TRACE_BEGIN and TRACE_SPAN only test a flag.
+
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+#include <stdint.h>
+
+#define TRACE_ARGS 8
+#define TRACE_RING_SIZE (1<<15)
+
+// kind of span, the names of arguments are kept here so each span only saves the values. str_key names the string
+// argument, and keys the integer arguments in order, ended by NULL.
+struct trace_kind {
+    const char *name;
+    const char *cat;
+    const char *str_key;
+    const char *keys[TRACE_ARGS];
+};
+
+extern int trace_enabled;
+
+// start tracing, the calling thread is recorded as the main thread
+extern void trace_start(void);
+// monotonic clock in nanoseconds
+extern uint64_t trace_clock(void);
+// record a span of kind from beg to now in the ring of calling thread, str is copied (truncated), integer arguments
+// follow in the order of kind->keys as int
+extern void trace_span(const struct trace_kind *kind, uint64_t beg, const char *str, ...);
+// write spans of all threads, return 0 on success
+extern int trace_write(const char *fname, const char *program, const char *version);
+
+#define TRACE_BEGIN(t) uint64_t t = trace_enabled ? trace_clock() : 0
+#define TRACE_SPAN(kind, t, str, ...) do { if ( trace_enabled ) trace_span(kind, t, str, ##__VA_ARGS__); } while(0)
+
+#endif
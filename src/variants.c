@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/kstring.h"
+#include "htslib/synced_bcf_reader.h"
+#include "utils.h"
+#include "variants.h"
+
+static int u32_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void chrom_push(struct variant_chrom *c, uint32_t pos)
+{
+    if ( c->n == c->m ) {
+        c->m = c->m == 0 ? 256 : c->m << 1;
+        c->a = (uint32_t*)realloc(c->a, c->m * sizeof(uint32_t));
+    }
+    c->a[c->n++] = pos;
+}
+
+struct variant_sites *variant_sites_load(const char *fname, struct bedaux *regions, int flank)
+{
+    int i, j;
+    // region list of synced reader, 1-based and inclusive, nearby regions are merged after flanking
+    kstring_t str = { 0, 0, 0 };
+    for ( i = 0; i < regions->l_names; ++i ) {
+        struct bed_chrom *chrom = get_chrom(regions, regions->names[i]);
+        if ( chrom == NULL )
+            continue;
+        int last_start = -1, last_end = -1;
+        for ( j = 0; j < chrom->cached; ++j ) {
+            int start = (int)(chrom->a[j] >> 32) - flank, end = (int)(uint32_t)chrom->a[j] + flank;
+            if ( start < 0 )
+                start = 0;
+            if ( last_end >= start ) {
+                if ( end > last_end )
+                    last_end = end;
+                continue;
+            }
+            if ( last_end != -1 )
+                ksprintf(&str, "%s%s:%d-%d", str.l ? "," : "", regions->names[i], last_start + 1, last_end);
+            last_start = start;
+            last_end = end;
+        }
+        if ( last_end != -1 )
+            ksprintf(&str, "%s%s:%d-%d", str.l ? "," : "", regions->names[i], last_start + 1, last_end);
+    }
+    struct variant_sites *v = (struct variant_sites*)calloc(1, sizeof(struct variant_sites));
+    v->n_chroms = regions->l_names;
+    v->chroms = (struct variant_chrom*)calloc(v->n_chroms > 0 ? v->n_chroms : 1, sizeof(struct variant_chrom));
+    if ( str.l == 0 )
+        return v;
+
+    bcf_srs_t *sr = bcf_sr_init();
+    bcf_hdr_t *hdr;
+    int last_rid = -1;
+    struct variant_chrom *c = NULL;
+    if ( bcf_sr_set_regions(sr, str.s, 0) < 0 ) {
+        error_print("Failed to parse regions of variants.");
+        goto fail;
+    }
+    sr->require_index = 1;
+    if ( bcf_sr_add_reader(sr, fname) == 0 ) {
+        error_print("Failed to open %s : %s.", fname, bcf_sr_strerror(sr->errnum));
+        goto fail;
+    }
+    hdr = bcf_sr_get_header(sr, 0);
+    while ( bcf_sr_next_line(sr) ) {
+        bcf1_t *rec = bcf_sr_get_line(sr, 0);
+        if ( rec->rid != last_rid ) {
+            last_rid = rec->rid;
+            struct bed_chrom *chrom = get_chrom(regions, bcf_seqname(hdr, rec));
+            c = chrom == NULL ? NULL : &v->chroms[chrom->id];
+        }
+        if ( c == NULL )
+            continue;
+        int k;
+        for ( k = 0; k < rec->rlen; ++k )
+            chrom_push(c, rec->pos + k);
+    }
+    bcf_sr_destroy(sr);
+    free(str.s);
+    // sites of overlapped records are kept once
+    for ( i = 0; i < v->n_chroms; ++i ) {
+        c = &v->chroms[i];
+        if ( c->n == 0 )
+            continue;
+        qsort(c->a, c->n, sizeof(uint32_t), u32_cmp);
+        int n = 1;
+        for ( j = 1; j < c->n; ++j )
+            if ( c->a[j] != c->a[n-1] )
+                c->a[n++] = c->a[j];
+        c->n = n;
+        v->n_sites += n;
+    }
+    return v;
+
+  fail:
+    bcf_sr_destroy(sr);
+    free(str.s);
+    variant_sites_destroy(v);
+    return NULL;
+}
+
+void variant_sites_destroy(struct variant_sites *v)
+{
+    if ( v == NULL )
+        return;
+    int i;
+    for ( i = 0; i < v->n_chroms; ++i )
+        free(v->chroms[i].a);
+    free(v->chroms);
+    free(v);
+}
+
+// first site not smaller than pos
+static int lower_bound(const struct variant_chrom *c, uint32_t pos)
+{
+    int lo = 0, hi = c->n;
+    while ( lo < hi ) {
+        int mid = (lo + hi) >> 1;
+        if ( c->a[mid] < pos )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const uint32_t *variant_sites_range(const struct variant_sites *v, int cid, int start, int end, int *n)
+{
+    *n = 0;
+    if ( cid < 0 || cid >= v->n_chroms || v->chroms[cid].n == 0 )
+        return NULL;
+    const struct variant_chrom *c = &v->chroms[cid];
+    int beg = lower_bound(c, start < 0 ? 0 : start);
+    *n = lower_bound(c, end < 0 ? 0 : end) - beg;
+    return c->a + beg;
+}
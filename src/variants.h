@@ -0,0 +1,29 @@
+// variants.h - common variant sites of design regions, like dbSNP or gnomAD common sites. Sites are streamed from a
+// indexed VCF/BCF by the synced reader, restricted to the design regions, and kept as sorted positions of each
+// chromosome. Sites of a fetched region are turned into prefix counts by region_profile_variants().
+
+#ifndef VARIANTS_HEADER
+#define VARIANTS_HEADER
+#include <stdint.h>
+#include "bed_utils.h"
+
+struct variant_chrom {
+    int n, m;
+    // sorted 0-based positions, bases of reference alleles longer than one base are all kept
+    uint32_t *a;
+};
+
+struct variant_sites {
+    // chromosomes are indexed by the id of design regions
+    int n_chroms;
+    struct variant_chrom *chroms;
+    uint64_t n_sites;
+};
+
+// load sites overlapping regions extended by flank, return NULL if the file could not be opened
+extern struct variant_sites *variant_sites_load(const char *fname, struct bedaux *regions, int flank);
+extern void variant_sites_destroy(struct variant_sites *v);
+// sites of chromosome cid in [start, end), return the first site and set the number
+extern const uint32_t *variant_sites_range(const struct variant_sites *v, int cid, int start, int end, int *n);
+
+#endif
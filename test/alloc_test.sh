@@ -0,0 +1,54 @@
+#!/bin/sh
+# allocation test of the design loop, usage: test/alloc_test.sh bin_dir corpus_dir
+#
+# generate_oligos_alloc counts heap allocations of each stage in -stats. Scratch buffers of the fetch, score and format
+# stages grow to the longest region and then are reused, so their allocations are bounded by a fixed budget, plus one
+# for each chunk of reference in fetch and a few for the thread pool jobs of each batch of oligos. An allocation for
+# each region or each oligo breaks the budget. Allocations of compress are only reported, the index grows by bins.
+
+BIN=$1
+DIR=$2
+BUDGET=256
+fail=0
+
+stage_allocs()
+{
+    sed -n "s/^ *\"$2\": {.*\"allocs\": \([0-9]*\).*/\1/p" $1
+}
+count()
+{
+    sed -n "s/^ *\"$2\": \([0-9]*\).*/\1/p" $1
+}
+run()
+{
+    name=$1
+    shift
+    rm -rf $DIR/$name
+    if ! $BIN/generate_oligos_alloc -p t -r $DIR/ref.fa "$@" -o $DIR/$name -quiet -stats $DIR/$name.json > $DIR/$name.log 2>&1; then
+        echo "FAIL $name : generate_oligos failed, see $DIR/$name.log"
+        fail=1
+        return
+    fi
+    fetch=$(stage_allocs $DIR/$name.json fetch)
+    score=$(stage_allocs $DIR/$name.json score)
+    format=$(stage_allocs $DIR/$name.json format)
+    compress=$(stage_allocs $DIR/$name.json compress)
+    chunks=$(count $DIR/$name.json reference_chunks)
+    emitted=$(count $DIR/$name.json emitted)
+    status=ok
+    if [ $((score + format)) -gt $((BUDGET + emitted / 256)) ] || [ $fetch -gt $((chunks + BUDGET / 8)) ]; then
+        status=FAIL
+        fail=1
+    fi
+    printf "%s %s : %s oligos, allocations fetch %s (%s chunks), score %s, format %s, compress %s\n" \
+           $status $name $emitted $fetch $chunks $score $format $compress
+}
+
+run exome -t $DIR/exome.bed
+run wgs -t $DIR/wgs.bed
+run hotspot -t $DIR/hotspot.bed -u $DIR/db.bed.gz
+run set_cover -t $DIR/exome.bed -set_cover -fragment_size 200
+run dense -t $DIR/exome.bed -dense 3 -tm
+run target_tm -t $DIR/exome.bed -l 0 -tm -target_tm 60-70
+run threads -t $DIR/wgs.bed -secondary -score -threads 2
+exit $fail
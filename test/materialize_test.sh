@@ -0,0 +1,29 @@
+#!/bin/sh
+# round trip of coordinate-only probe file, usage: test/materialize_test.sh bin_dir corpus_dir
+#
+# Runs after alloc_test.sh, which designs the exome panel with sequences. The reference of the corpus is soft-masked,
+# so the body of generate_oligos -no_sequence filled by materialize should be the same as the panel, bases in upper
+# case.
+
+BIN=$1
+DIR=$2
+name=no_sequence
+
+rm -rf $DIR/$name
+if ! $BIN/generate_oligos_alloc -p t -r $DIR/ref.fa -t $DIR/exome.bed -o $DIR/$name -quiet -no_sequence \
+     > $DIR/$name.log 2>&1; then
+    echo "FAIL $name : generate_oligos failed, see $DIR/$name.log"
+    exit 1
+fi
+if ! $BIN/materialize -r $DIR/ref.fa -i $DIR/$name/probes.txt.gz -o $DIR/$name/filled.txt.gz -quiet \
+     >> $DIR/$name.log 2>&1; then
+    echo "FAIL $name : materialize failed, see $DIR/$name.log"
+    exit 1
+fi
+gzip -dc $DIR/exome/probes.txt.gz | grep -v '^#' > $DIR/$name/exome.body
+if gzip -dc $DIR/$name/filled.txt.gz | grep -v '^#' | cmp -s - $DIR/$name/exome.body; then
+    echo "ok materialize : $(wc -l < $DIR/$name/exome.body) records, same as designed with sequences"
+else
+    echo "FAIL materialize : records filled by materialize differ from designed with sequences"
+    exit 1
+fi
@@ -0,0 +1,34 @@
+#!/bin/sh
+# merge test of probe files designed on the same reference, usage: test/merge_test.sh bin_dir corpus_dir
+#
+# Runs after alloc_test.sh, which designs the exome and hotspot panels. The panels visit different contigs, so
+# merge_oligos without -r merges the orders of contigs of both inputs, and the body should be the same as merged in
+# the order of the reference by -r.
+
+BIN=$1
+DIR=$2
+fail=0
+
+merge()
+{
+    name=$1
+    shift
+    if ! $BIN/merge_oligos "$@" -o $DIR/$name.txt.gz $DIR/exome/probes.txt.gz $DIR/hotspot/probes.txt.gz \
+         > $DIR/$name.log 2>&1; then
+        echo "FAIL $name : merge_oligos failed, see $DIR/$name.log"
+        fail=1
+    fi
+}
+
+merge merged
+merge merged_ref -r $DIR/ref.fa
+if [ $fail -eq 0 ]; then
+    gzip -dc $DIR/merged_ref.txt.gz | grep -v '^#' > $DIR/merged_ref.body
+    if gzip -dc $DIR/merged.txt.gz | grep -v '^#' | cmp -s - $DIR/merged_ref.body; then
+        echo "ok merge : $(wc -l < $DIR/merged_ref.body) records, contigs ordered without -r"
+    else
+        echo "FAIL merge : records merged without -r differ from -r"
+        fail=1
+    fi
+fi
+exit $fail
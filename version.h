@@ -0,0 +1 @@
+#define OLIGOS_VERSION ""